@@ -0,0 +1,684 @@
+// benchmark suite, ran by `meson benchmark`
+//
+// measures throughput and latency of every engine, for every pattern family,
+// in anchored and unanchored mode, on inputs from 16 B up to --max-size.
+// the "compile" family measures compile time of alternations of 1K, 10K and
+// 100K words instead.
+// results are written as JSON to stdout, progress to stderr.
+//
+//   bench [--max-size 1G] [--min-time-ms 100] [--max-run-time-ms 2000]
+//         [--engine tpre] [--family literal] [--perf]
+//
+// --max-size can also be set with the TPRE_BENCH_MAX_SIZE environment
+// variable. with --perf, hardware counters are read around the measured
+// matches, and reported per byte and per match.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/tpre.h"
+#include "bench.h"
+#include "perf_counters.h"
+
+#ifdef TPRE_BENCH_PCRE2
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+#endif
+
+#ifndef TPRE_VERSION
+#define TPRE_VERSION "unknown"
+#endif
+
+#define MIN_SIZE ((size_t) 16)
+#define DEFAULT_MAX_SIZE ((size_t) 16 << 20)
+#define MAX_MAX_SIZE ((size_t) 1 << 30)
+
+// libstdc++'s std::regex recurses once per matched char
+#define STD_REGEX_MAX_SIZE ((size_t) 4 << 10)
+
+typedef struct
+{
+  char const* name;
+  // consumes the filler from the start of the input
+  char const* anchored;
+  // only finds the tail
+  char const* unanchored;
+  char const* filler;
+  char const* tail;
+} Family;
+
+static Family const families[] = {
+  { "literal", "[a-z ]*needle", "needle",
+    "the quick brown fox jumps over the lazy dog ", "needle" },
+  { "alternation", "[a-z ]*(red|green|blue) (car|train)",
+    "(red|green|blue) (car|train)",
+    "the quick brown fox jumps over the lazy dog ", "green car" },
+  { "digits", "[a-z ]*(\\d+)-(\\d+)", "(\\d+)-(\\d+)",
+    "the quick brown fox jumps over the lazy dog ", "1234-5678" },
+  { "cartrain", "\\s*?(red|green|blue)?\\s*?(car|train)\\s*?",
+    "\\s*?(red|green|blue)?\\s*?(car|train)\\s*?", " ", " green car " },
+};
+
+#define NUM_FAMILIES (sizeof(families) / sizeof(*families))
+
+// the compile family: alternations of this many words, like generated
+// blocklists
+static size_t const compile_branches[] = { 1000, 10000, 100000 };
+
+#define NUM_COMPILE_BRANCHES \
+  (sizeof(compile_branches) / sizeof(*compile_branches))
+
+#define MATCH_TIMEOUT (-2)
+
+typedef struct
+{
+  char const* name;
+  // larger inputs are skipped. 0 = no limit
+  size_t max_size;
+  /** null on failure */
+  void* (*compile)(char const* pattern, bool anchored);
+  /** 1 = match, 0 = no match, MATCH_TIMEOUT if the deadline was hit,
+   * other negative values on failure. deadline_ns can be ignored */
+  int (*match)(
+      void* re,
+      char const* str,
+      size_t strl,
+      bool anchored,
+      uint64_t deadline_ns);
+  void (*free)(void* re);
+} Engine;
+
+static void* tpre_engine_compile(char const* pattern, bool anchored)
+{
+  tpre_re_t* re = malloc(sizeof(tpre_re_t));
+  if (!re)
+    return NULL;
+  tpre_opts_t opts = { 0 };
+  opts.start_unanchored = !anchored;
+  opts.end_unanchored = true;
+  if (tpre_compile(re, pattern, NULL, opts))
+  {
+    free(re);
+    return NULL;
+  }
+  return re;
+}
+
+static void* tpre_fsm_engine_compile(char const* pattern, bool anchored)
+{
+  tpre_re_t* re = malloc(sizeof(tpre_re_t));
+  if (!re)
+    return NULL;
+  tpre_opts_t opts = { 0 };
+  opts.start_unanchored = !anchored;
+  opts.end_unanchored = true;
+  tpre_fsm_t fsm;
+  if (tpre2fsm(&fsm, pattern, NULL, opts))
+  {
+    free(re);
+    return NULL;
+  }
+  int status = tpre_fsm2re(re, &fsm);
+  tpre_fsm_free(&fsm);
+  if (status)
+  {
+    free(re);
+    return NULL;
+  }
+  return re;
+}
+
+static int tpre_engine_match(
+    void* re,
+    char const* str,
+    size_t strl,
+    bool anchored,
+    uint64_t deadline_ns)
+{
+  (void) anchored;
+  tpre_match_cfg_t cfg = { 0 };
+  cfg.deadline_ns = deadline_ns;
+  tpre_match_t m = tpre_matchn_cfg(re, str, strl, &cfg);
+  int found = m.aborted ? MATCH_TIMEOUT : m.found;
+  tpre_match_free(m);
+  return found;
+}
+
+static void tpre_engine_free(void* re)
+{
+  tpre_free(*(tpre_re_t*) re);
+  free(re);
+}
+
+static void* std_regex_engine_compile(char const* pattern, bool anchored)
+{
+  (void) anchored;
+  return bench_std_regex_compile(pattern);
+}
+
+static int std_regex_engine_match(
+    void* re,
+    char const* str,
+    size_t strl,
+    bool anchored,
+    uint64_t deadline_ns)
+{
+  (void) deadline_ns;
+  return bench_std_regex_match(re, str, strl, anchored);
+}
+
+#ifdef TPRE_BENCH_PCRE2
+typedef struct
+{
+  pcre2_code* code;
+  pcre2_match_data* data;
+} Pcre2;
+
+static void* pcre2_compile_impl(char const* pattern, bool anchored, bool jit)
+{
+  Pcre2* p = malloc(sizeof(Pcre2));
+  if (!p)
+    return NULL;
+  int errnum;
+  PCRE2_SIZE erroff;
+  p->code = pcre2_compile(
+      (PCRE2_SPTR) pattern, PCRE2_ZERO_TERMINATED,
+      anchored ? PCRE2_ANCHORED : 0, &errnum, &erroff, NULL);
+  if (!p->code)
+  {
+    free(p);
+    return NULL;
+  }
+  if (jit && pcre2_jit_compile(p->code, PCRE2_JIT_COMPLETE))
+  {
+    pcre2_code_free(p->code);
+    free(p);
+    return NULL;
+  }
+  p->data = pcre2_match_data_create_from_pattern(p->code, NULL);
+  return p;
+}
+
+static void* pcre2_engine_compile(char const* pattern, bool anchored)
+{
+  return pcre2_compile_impl(pattern, anchored, false);
+}
+
+static void* pcre2_jit_engine_compile(char const* pattern, bool anchored)
+{
+  return pcre2_compile_impl(pattern, anchored, true);
+}
+
+static int pcre2_engine_match(
+    void* re,
+    char const* str,
+    size_t strl,
+    bool anchored,
+    uint64_t deadline_ns)
+{
+  (void) anchored;
+  (void) deadline_ns;
+  Pcre2* p = re;
+  int rc = pcre2_match(
+      p->code, (PCRE2_SPTR) str, strl, 0, 0, p->data, NULL);
+  if (rc == PCRE2_ERROR_NOMATCH)
+    return 0;
+  return rc < 0 ? -1 : 1;
+}
+
+static void pcre2_engine_free(void* re)
+{
+  Pcre2* p = re;
+  pcre2_match_data_free(p->data);
+  pcre2_code_free(p->code);
+  free(p);
+}
+#endif
+
+static Engine const engines[] = {
+  { "tpre", 0, tpre_engine_compile, tpre_engine_match, tpre_engine_free },
+  { "tpre-fsm", 0, tpre_fsm_engine_compile, tpre_engine_match,
+    tpre_engine_free },
+#ifdef TPRE_BENCH_PCRE2
+  { "pcre2", 0, pcre2_engine_compile, pcre2_engine_match,
+    pcre2_engine_free },
+  { "pcre2-jit", 0, pcre2_jit_engine_compile, pcre2_engine_match,
+    pcre2_engine_free },
+#endif
+  { "std-regex", STD_REGEX_MAX_SIZE, std_regex_engine_compile,
+    std_regex_engine_match, bench_std_regex_free },
+};
+
+#define NUM_ENGINES (sizeof(engines) / sizeof(*engines))
+
+typedef struct
+{
+  size_t max_size;
+  uint64_t min_time_ns;
+  // a single match is stopped after this long, if the engine supports it.
+  // larger inputs are skipped once a match took longer than a 16th of it
+  uint64_t max_run_time_ns;
+  char const* engine;
+  char const* family;
+  // null if counters are not read
+  perf_counters_t* perf;
+} Config;
+
+/** filler repeated, and the tail at the end. null on failure */
+static char* make_input(Family const* fam, size_t size)
+{
+  size_t taill = strlen(fam->tail);
+  size_t filll = strlen(fam->filler);
+  if (size < taill)
+    return NULL;
+  char* buf = malloc(size);
+  if (!buf)
+    return NULL;
+  size_t n = size - taill;
+  size_t i;
+  for (i = 0; i < n; i += filll)
+    memcpy(buf + i, fam->filler, n - i < filll ? n - i : filll);
+  memcpy(buf + n, fam->tail, taill);
+  return buf;
+}
+
+typedef struct
+{
+  uint64_t iters;
+  uint64_t total_ns;
+  // first (cold) match, to decide if bigger inputs are worth it
+  uint64_t first_ns;
+  char const* error;
+  // summed over all iterations
+  perf_values_t perf;
+} Measurement;
+
+static Measurement measure(
+    Engine const* eng,
+    void* re,
+    char const* str,
+    size_t strl,
+    bool anchored,
+    Config const* cfg)
+{
+  Measurement r = { 0 };
+  perf_values_t first_perf = { 0 };
+
+  if (cfg->perf)
+    perf_counters_start(cfg->perf);
+  uint64_t begin = tpre_monotonic_ns();
+  int found = eng->match(
+      re, str, strl, anchored, begin + cfg->max_run_time_ns);
+  r.first_ns = tpre_monotonic_ns() - begin;
+  if (cfg->perf)
+    perf_counters_stop(cfg->perf, &first_perf);
+  if (found == MATCH_TIMEOUT)
+  {
+    r.error = "timeout";
+    return r;
+  }
+  if (found < 0)
+  {
+    r.error = "match failed";
+    return r;
+  }
+  if (!found)
+  {
+    r.error = "no match";
+    return r;
+  }
+
+  // the first match is already slow enough to be measured on its own
+  if (r.first_ns >= cfg->min_time_ns)
+  {
+    r.iters = 1;
+    r.total_ns = r.first_ns;
+    r.perf = first_perf;
+    return r;
+  }
+
+  uint64_t batch = 1;
+  while (r.total_ns < cfg->min_time_ns)
+  {
+    if (cfg->perf)
+      perf_counters_start(cfg->perf);
+    begin = tpre_monotonic_ns();
+    uint64_t k;
+    for (k = 0; k < batch; k++)
+      eng->match(re, str, strl, anchored, 0);
+    r.total_ns += tpre_monotonic_ns() - begin;
+    if (cfg->perf)
+      perf_counters_stop(cfg->perf, &r.perf);
+    r.iters += batch;
+    if (batch < (1u << 20))
+      batch *= 2;
+  }
+  return r;
+}
+
+/** num random lowercase words of 6 to 12 letters, separated by `|`. null on
+ * failure */
+static char* make_alternation(size_t num)
+{
+  char* buf = malloc(num * 13 + 1);
+  if (!buf)
+    return NULL;
+  uint32_t rng = 1;
+  size_t len = 0;
+  size_t i, k;
+  for (i = 0; i < num; i++)
+  {
+    if (i)
+      buf[len++] = '|';
+    rng = rng * 1103515245u + 12345u;
+    size_t wordl = 6 + (rng >> 16) % 7;
+    for (k = 0; k < wordl; k++)
+    {
+      rng = rng * 1103515245u + 12345u;
+      buf[len++] = (char) ('a' + (rng >> 16) % 26);
+    }
+  }
+  buf[len] = '\0';
+  return buf;
+}
+
+static Measurement measure_compile(
+    Engine const* eng, char const* pattern, bool anchored, Config const* cfg)
+{
+  Measurement r = { 0 };
+  // at least once, even if that is already slower than min_time_ns
+  do
+  {
+    uint64_t begin = tpre_monotonic_ns();
+    void* re = eng->compile(pattern, anchored);
+    r.total_ns += tpre_monotonic_ns() - begin;
+    if (!re)
+    {
+      r.error = "compile failed";
+      return r;
+    }
+    eng->free(re);
+    r.iters++;
+  } while (r.total_ns < cfg->min_time_ns);
+  return r;
+}
+
+static void json_str(char const* s)
+{
+  putchar('"');
+  for (; *s; s++)
+  {
+    if (*s == '"' || *s == '\\')
+      putchar('\\');
+    putchar(*s);
+  }
+  putchar('"');
+}
+
+static bool first_result = true;
+
+static void report(
+    Engine const* eng,
+    Family const* fam,
+    char const* pattern,
+    bool anchored,
+    size_t size,
+    Measurement const* m)
+{
+  printf("%s\n    { \"engine\": ", first_result ? "" : ",");
+  first_result = false;
+  json_str(eng->name);
+  printf(", \"family\": ");
+  json_str(fam->name);
+  printf(", \"pattern\": ");
+  json_str(pattern);
+  printf(
+      ", \"mode\": \"%s\", \"size\": %zu",
+      anchored ? "anchored" : "unanchored", size);
+  if (m->error)
+  {
+    printf(", \"error\": ");
+    json_str(m->error);
+    printf(" }");
+    fprintf(
+        stderr, "%-10s %-12s %-10s %10zu B: %s\n", eng->name, fam->name,
+        anchored ? "anchored" : "unanchored", size, m->error);
+    return;
+  }
+
+  double ns_per_match = (double) m->total_ns / (double) m->iters;
+  double mb_per_s = (double) size * 1e3 / ns_per_match;
+  printf(
+      ", \"iterations\": %llu, \"total_ns\": %llu, \"ns_per_match\": %.1f, "
+      "\"mb_per_s\": %.3f",
+      (unsigned long long) m->iters, (unsigned long long) m->total_ns,
+      ns_per_match, mb_per_s);
+  fprintf(
+      stderr, "%-10s %-12s %-10s %10zu B: %14.1f ns/match %10.3f MB/s",
+      eng->name, fam->name, anchored ? "anchored" : "unanchored", size,
+      ns_per_match, mb_per_s);
+
+  bool first_counter = true;
+  for (int c = 0; c < PERF_NUM_COUNTERS; c++)
+  {
+    if (!m->perf.available[c])
+      continue;
+    double total = (double) m->perf.value[c];
+    printf(
+        "%s\"%s\": { \"total\": %llu, \"per_byte\": %.4f, "
+        "\"per_match\": %.1f }",
+        first_counter ? ", \"perf\": { " : ", ", perf_counter_name(c),
+        (unsigned long long) m->perf.value[c],
+        total / ((double) size * (double) m->iters),
+        total / (double) m->iters);
+    first_counter = false;
+    if (c == PERF_INSTRUCTIONS)
+      fprintf(
+          stderr, " %8.2f insn/B",
+          total / ((double) size * (double) m->iters));
+    else if (c == PERF_BRANCH_MISSES)
+      fprintf(stderr, " %10.1f br-miss/match", total / (double) m->iters);
+  }
+  printf("%s }", first_counter ? "" : " }");
+  fputc('\n', stderr);
+}
+
+static void bench_one(
+    Engine const* eng, Family const* fam, bool anchored, Config const* cfg)
+{
+  char const* pattern = anchored ? fam->anchored : fam->unanchored;
+  void* re = eng->compile(pattern, anchored);
+  if (!re)
+  {
+    Measurement m = { 0 };
+    m.error = "compile failed";
+    report(eng, fam, pattern, anchored, 0, &m);
+    return;
+  }
+
+  size_t size;
+  for (size = MIN_SIZE; size <= cfg->max_size; size *= 16)
+  {
+    if (eng->max_size && size > eng->max_size)
+      break;
+
+    char* str = make_input(fam, size);
+    if (!str)
+    {
+      Measurement m = { 0 };
+      m.error = "out of memory";
+      report(eng, fam, pattern, anchored, size, &m);
+      break;
+    }
+    Measurement m = measure(eng, re, str, size, anchored, cfg);
+    free(str);
+    report(eng, fam, pattern, anchored, size, &m);
+
+    // the next size is 16 times bigger
+    if (m.error || m.first_ns > cfg->max_run_time_ns / 16)
+      break;
+  }
+
+  eng->free(re);
+}
+
+static void report_compile(
+    Engine const* eng, size_t branches, bool anchored, Measurement const* m)
+{
+  printf("%s\n    { \"engine\": ", first_result ? "" : ",");
+  first_result = false;
+  json_str(eng->name);
+  printf(
+      ", \"family\": \"compile\", \"branches\": %zu, \"mode\": \"%s\"",
+      branches, anchored ? "anchored" : "unanchored");
+  if (m->error)
+  {
+    printf(", \"error\": ");
+    json_str(m->error);
+    printf(" }");
+    fprintf(
+        stderr, "%-10s %-12s %-10s %10zu br: %s\n", eng->name, "compile",
+        anchored ? "anchored" : "unanchored", branches, m->error);
+    return;
+  }
+
+  double ns_per_compile = (double) m->total_ns / (double) m->iters;
+  printf(
+      ", \"iterations\": %llu, \"total_ns\": %llu, \"ns_per_compile\": "
+      "%.1f }",
+      (unsigned long long) m->iters, (unsigned long long) m->total_ns,
+      ns_per_compile);
+  fprintf(
+      stderr, "%-10s %-12s %-10s %10zu br: %14.1f ns/compile\n", eng->name,
+      "compile", anchored ? "anchored" : "unanchored", branches,
+      ns_per_compile);
+}
+
+static void bench_compile(Engine const* eng, bool anchored, Config const* cfg)
+{
+  size_t i;
+  for (i = 0; i < NUM_COMPILE_BRANCHES; i++)
+  {
+    Measurement m = { 0 };
+    char* pattern = make_alternation(compile_branches[i]);
+    if (pattern)
+      m = measure_compile(eng, pattern, anchored, cfg);
+    else
+      m.error = "out of memory";
+    free(pattern);
+    report_compile(eng, compile_branches[i], anchored, &m);
+    if (m.error)
+      break;
+  }
+}
+
+/** 0 on failure */
+static size_t parse_size(char const* s)
+{
+  char* end;
+  unsigned long long v = strtoull(s, &end, 10);
+  switch (*end)
+  {
+    case 'k': case 'K': v <<= 10; end++; break;
+    case 'm': case 'M': v <<= 20; end++; break;
+    case 'g': case 'G': v <<= 30; end++; break;
+    default:            break;
+  }
+  if (*end || end == s || v > MAX_MAX_SIZE)
+    return 0;
+  return (size_t) v;
+}
+
+static int usage(char const* prog)
+{
+  fprintf(
+      stderr,
+      "usage: %s [--max-size N[K|M|G]] [--min-time-ms N] "
+      "[--max-run-time-ms N] [--engine NAME] [--family NAME] [--perf]\n",
+      prog);
+  return 1;
+}
+
+int main(int argc, char** argv)
+{
+  Config cfg = { 0 };
+  cfg.max_size = DEFAULT_MAX_SIZE;
+  cfg.min_time_ns = 100 * 1000000ull;
+  cfg.max_run_time_ns = 2000 * 1000000ull;
+
+  char const* env = getenv("TPRE_BENCH_MAX_SIZE");
+  if (env && !(cfg.max_size = parse_size(env)))
+    return usage(argv[0]);
+
+  bool perf = false;
+  int i;
+  for (i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--perf"))
+    {
+      perf = true;
+      continue;
+    }
+    if (i + 1 >= argc)
+      return usage(argv[0]);
+    char const* arg = argv[i];
+    char const* val = argv[++i];
+    if (!strcmp(arg, "--max-size"))
+    {
+      if (!(cfg.max_size = parse_size(val)))
+        return usage(argv[0]);
+    }
+    else if (!strcmp(arg, "--min-time-ms"))
+      cfg.min_time_ns = strtoull(val, NULL, 10) * 1000000ull;
+    else if (!strcmp(arg, "--max-run-time-ms"))
+      cfg.max_run_time_ns = strtoull(val, NULL, 10) * 1000000ull;
+    else if (!strcmp(arg, "--engine"))
+      cfg.engine = val;
+    else if (!strcmp(arg, "--family"))
+      cfg.family = val;
+    else
+      return usage(argv[0]);
+  }
+
+  perf_counters_t counters;
+  if (perf)
+  {
+    if (perf_counters_open(&counters))
+      cfg.perf = &counters;
+    else
+      fprintf(
+          stderr, "no performance counters available (check "
+                  "/proc/sys/kernel/perf_event_paranoid)\n");
+  }
+
+  printf("{\n  \"tpre_version\": ");
+  json_str(TPRE_VERSION);
+  printf(",\n  \"simd\": ");
+  json_str(tpre_simd_name(tpre_simd()));
+  printf(",\n  \"max_size\": %zu,\n  \"results\": [", cfg.max_size);
+
+  size_t e, f;
+  for (e = 0; e < NUM_ENGINES; e++)
+  {
+    if (cfg.engine && strcmp(cfg.engine, engines[e].name))
+      continue;
+    for (f = 0; f < NUM_FAMILIES; f++)
+    {
+      if (cfg.family && strcmp(cfg.family, families[f].name))
+        continue;
+      bench_one(&engines[e], &families[f], true, &cfg);
+      bench_one(&engines[e], &families[f], false, &cfg);
+    }
+
+    // std::regex only gets small inputs, and these patterns are not small
+    if (engines[e].max_size || (cfg.family && strcmp(cfg.family, "compile")))
+      continue;
+    bench_compile(&engines[e], true, &cfg);
+    bench_compile(&engines[e], false, &cfg);
+  }
+
+  printf("\n  ]\n}\n");
+  if (cfg.perf)
+    perf_counters_close(cfg.perf);
+  return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef _TPRE_BENCH_H
+#define _TPRE_BENCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** null on failure */
+void* bench_std_regex_compile(char const* pattern);
+
+/** 1 = match, 0 = no match, negative on failure */
+int bench_std_regex_match(
+    void* re, char const* str, size_t strl, bool anchored);
+
+void bench_std_regex_free(void* re);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
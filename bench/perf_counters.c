@@ -0,0 +1,136 @@
+#define _GNU_SOURCE
+#include "perf_counters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static char const* const names[PERF_NUM_COUNTERS] = {
+  [PERF_INSTRUCTIONS] = "instructions",
+  [PERF_CYCLES] = "cycles",
+  [PERF_BRANCH_MISSES] = "branch_misses",
+  [PERF_L1D_MISSES] = "l1d_misses",
+  [PERF_LLC_MISSES] = "llc_misses",
+};
+
+char const* perf_counter_name(perf_counter_t c)
+{
+  return names[c];
+}
+
+#ifdef __linux__
+
+#define CACHE_MISS(cache) \
+  ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static struct
+{
+  uint32_t type;
+  uint64_t config;
+} const events[PERF_NUM_COUNTERS] = {
+  [PERF_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  [PERF_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  [PERF_BRANCH_MISSES] = { PERF_TYPE_HARDWARE,
+                           PERF_COUNT_HW_BRANCH_MISSES },
+  [PERF_L1D_MISSES] = { PERF_TYPE_HW_CACHE,
+                        CACHE_MISS(PERF_COUNT_HW_CACHE_L1D) },
+  [PERF_LLC_MISSES] = { PERF_TYPE_HW_CACHE,
+                        CACHE_MISS(PERF_COUNT_HW_CACHE_LL) },
+};
+
+bool perf_counters_open(perf_counters_t* pc)
+{
+  bool any = false;
+  for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+  {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // not a group, so that one missing counter doesn't disable the others
+    pc->fd[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (pc->fd[i] >= 0)
+      any = true;
+  }
+  return any;
+}
+
+void perf_counters_close(perf_counters_t* pc)
+{
+  for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+  {
+    if (pc->fd[i] >= 0)
+      close(pc->fd[i]);
+    pc->fd[i] = -1;
+  }
+}
+
+void perf_counters_start(perf_counters_t* pc)
+{
+  for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+  {
+    if (pc->fd[i] < 0)
+      continue;
+    ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+    ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+void perf_counters_stop(perf_counters_t* pc, perf_values_t* out)
+{
+  for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+    if (pc->fd[i] >= 0)
+      ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+  for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+  {
+    // value, time enabled, time running
+    uint64_t buf[3];
+    if (pc->fd[i] < 0 || read(pc->fd[i], buf, sizeof(buf)) != sizeof(buf))
+      continue;
+    uint64_t v = buf[0];
+    if (buf[2] && buf[2] < buf[1])
+      v = (uint64_t) ((double) v * (double) buf[1] / (double) buf[2]);
+    out->available[i] = true;
+    out->value[i] += v;
+  }
+}
+
+#else
+
+bool perf_counters_open(perf_counters_t* pc)
+{
+  for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+    pc->fd[i] = -1;
+  return false;
+}
+
+void perf_counters_close(perf_counters_t* pc)
+{
+  (void) pc;
+}
+
+void perf_counters_start(perf_counters_t* pc)
+{
+  (void) pc;
+}
+
+void perf_counters_stop(perf_counters_t* pc, perf_values_t* out)
+{
+  (void) pc;
+  (void) out;
+}
+
+#endif
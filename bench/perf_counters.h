@@ -0,0 +1,47 @@
+#ifndef _TPRE_BENCH_PERF_COUNTERS_H
+#define _TPRE_BENCH_PERF_COUNTERS_H
+
+// hardware performance counters, read with perf_event_open on linux.
+// everywhere else, and if the kernel doesn't allow it, no counter is available
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum
+{
+  PERF_INSTRUCTIONS,
+  PERF_CYCLES,
+  PERF_BRANCH_MISSES,
+  PERF_L1D_MISSES,
+  PERF_LLC_MISSES,
+
+  PERF_NUM_COUNTERS,
+} perf_counter_t;
+
+typedef struct
+{
+  // -1 if not available
+  int fd[PERF_NUM_COUNTERS];
+} perf_counters_t;
+
+typedef struct
+{
+  bool available[PERF_NUM_COUNTERS];
+  uint64_t value[PERF_NUM_COUNTERS];
+} perf_values_t;
+
+/** name of the counter, like "instructions" */
+char const* perf_counter_name(perf_counter_t c);
+
+/** opens all counters that are available. false if none is */
+bool perf_counters_open(perf_counters_t* pc);
+void perf_counters_close(perf_counters_t* pc);
+
+/** resets and starts the counters */
+void perf_counters_start(perf_counters_t* pc);
+
+/** stops the counters, and adds the counts since perf_counters_start() to
+ * out. counts are scaled up if the kernel had to multiplex the counters */
+void perf_counters_stop(perf_counters_t* pc, perf_values_t* out);
+
+#endif
@@ -0,0 +1,40 @@
+// std::regex as a comparison engine for bench.c
+
+#include <regex>
+
+#include "bench.h"
+
+extern "C" void* bench_std_regex_compile(char const* pattern)
+{
+  try
+  {
+    return new std::regex(pattern, std::regex::ECMAScript);
+  }
+  catch (std::exception const&)
+  {
+    return nullptr;
+  }
+}
+
+extern "C" int bench_std_regex_match(
+    void* re, char const* str, size_t strl, bool anchored)
+{
+  std::cmatch m;
+  auto flags = anchored ? std::regex_constants::match_continuous
+                        : std::regex_constants::match_default;
+  try
+  {
+    return std::regex_search(
+        str, str + strl, m, *static_cast<std::regex*>(re), flags);
+  }
+  catch (std::exception const&)
+  {
+    // libstdc++ throws error_complexity / error_stack on big inputs
+    return -1;
+  }
+}
+
+extern "C" void bench_std_regex_free(void* re)
+{
+  delete static_cast<std::regex*>(re);
+}
@@ -12,171 +12,177 @@ int tpre_find_group(tpre_re_t const* re, char const* name)
 {
   for (tpre_groupid_t i = 0; i < re->num_named_groups; i++)
     if (!strcmp(re->named_groups[i], name))
-      return (int) (re->num_named_groups + i);
+      return (int) (re->first_named_group + i);
 
   return -1;
 }
 
 typedef struct
 {
-  Node** items;
-  size_t len;
-} NodeLi;
-
-static void NodeLi_add(NodeLi* li, Node* nd)
-{
-  li->items = realloc(li->items, sizeof(Node*) * (li->len + 1));
-  li->items[li->len++] = nd;
-}
+  tpre_re_t const* re;
+  tpre_errs_t* errs;
+  int status;
+} Backrefs;
 
-static void or_cases(Node* or, NodeLi* out)
+static void resolve_backref(Node* nd, void* ctx)
 {
-  if (!or || or->kind != NodeOr)
-    return;
-  if (or->or.a->kind != NodeOr)
-    NodeLi_add(out, or->or.a);
-  else
-    or_cases(or->or.a, out);
-  if (or->or.b->kind != NodeOr)
-    NodeLi_add(out, or->or.b);
-  else
-    or_cases(or->or.b, out);
+  Backrefs* b = ctx;
+  size_t where = nd->wherePlus1 ? nd->wherePlus1 - 1 : 0;
+  if (nd->kind == NodeNamedBackref)
+  {
+    int id = tpre_find_group(b->re, nd->named_backref.name);
+    if (id < 0)
+    {
+      tprec_add_err(
+          b->errs, where, "backreference to unknown group '%s'",
+          nd->named_backref.name);
+      id = 0;
+      b->status = 1;
+    }
+    nd->kind = NodeBackref;
+    nd->backref = (tpre_groupid_t) id;
+  }
+  else if (nd->kind == NodeBackref)
+  {
+    if (nd->backref == 0 ||
+        nd->backref >= b->re->first_named_group + b->re->num_named_groups)
+    {
+      tprec_add_err(
+          b->errs, where, "backreference to unknown group %u", nd->backref);
+      nd->backref = 0;
+      b->status = 1;
+    }
+  }
 }
 
-static Node* find_trough_rep(Node* node, NodeKind what)
+/** turns named backrefs into numbered ones, and checks that the groups exist */
+static int resolve_backrefs(Node* nd, tpre_re_t const* re, tpre_errs_t* errs)
 {
-  if (node->kind == what)
-    return node;
-
-  switch (node->kind)
-  {
-    case NodeLazyRepeatLeast0:
-    case NodeLazyRepeatLeast1:
-    case NodeGreedyRepeatLeast0:
-    case NodeGreedyRepeatLeast1:
-      return find_trough_rep(node->repeat, what);
-
-    default: return NULL;
-  }
+  Backrefs b = { re, errs, 0 };
+  if (Node_walk(nd, NULL, resolve_backref, &b))
+    return 1;
+  return b.status;
 }
 
 static Node* last_left_chain(Node* node)
 {
-  if (node->kind == NodeOr)
-    return last_left_chain(node->or.a);
   if (node->kind != NodeChain)
     return NULL;
-  if (node->chain.a->kind == NodeChain)
-    return last_left_chain(node->chain.a);
+  while (node->chain.a->kind == NodeChain)
+    node = node->chain.a;
   return node;
 }
 
-static int verify(Node* nd, tpre_errs_t* errs)
+typedef struct
 {
-  if (nd == NULL)
-    return 1;
-  Node* children[2];
-  Node_children(nd, children);
-  verify(children[0], errs);
-  verify(children[1], errs);
-
-  return 0;
-}
+  size_t groups;
+  size_t named_groups;
+} GroupCount;
 
-static size_t count_groups(Node* nd)
+static void count_group(Node* nd, void* ctx)
 {
-  if (nd == NULL)
-    return 0;
-
-  Node* children[2];
-  Node_children(nd, children);
-
-  size_t count = 0;
-
+  GroupCount* count = ctx;
   if (nd->kind == NodeCaptureGroup)
-    count += 1;
-
-  count += count_groups(children[0]);
-  count += count_groups(children[1]);
-
-  return count;
+    count->groups++;
+  else if (nd->kind == NodeNamedCaptureGroup)
+    count->named_groups++;
 }
 
-static size_t count_named_groups(Node* nd)
+/** 0 = ok */
+static int count_groups(Node* nd, GroupCount* out)
 {
-  if (nd == NULL)
-    return 0;
-
-  Node* children[2];
-  Node_children(nd, children);
-
-  size_t count = 0;
-
-  if (nd->kind == NodeNamedCaptureGroup)
-    count += 1;
-
-  count += count_named_groups(children[0]);
-  count += count_named_groups(children[1]);
-
-  return count;
+  memset(out, 0, sizeof(*out));
+  return Node_walk(nd, count_group, NULL, out);
 }
 
-static void named_groups(Node* nd, char*** out)
+static void named_group(Node* nd, void* ctx)
 {
-  if (nd == NULL)
-    return;
-  Node* children[2];
-  Node_children(nd, children);
-
+  char*** out = ctx;
   if (nd->kind == NodeNamedCaptureGroup)
   {
     **out = tprec_strdup(nd->named_capture.name);
     (*out)++;
   }
-
-  named_groups(children[0], out);
-  named_groups(children[1], out);
 }
 
-static void groups(
-    Node* nd,
-    tpre_groupid_t group,
-    tpre_groupid_t* global_next_group_id,
-    tpre_groupid_t* next_named_gr)
+/** 0 = ok */
+static int named_groups(Node* nd, char*** out)
 {
-  if (nd == NULL)
-    return;
-  Node* children[2];
-  Node_children(nd, children);
+  return Node_walk(nd, named_group, NULL, out);
+}
 
-  if (nd->kind == NodeJustGroup)
+typedef struct
+{
+  tpre_groupid_t next_group;
+  tpre_groupid_t next_named_group;
+  // if false, capture groups are treated like non capture groups
+  bool captures;
+  // backrefs need to know which groups matched, and what they matched in
+  // the last iteration
+  bool backrefs;
+} Groups;
+
+/** removes the group nodes at nd, and gives nd and its children the group
+ * they are in. the parent already set the group of nd */
+static void group_one(Node* nd, void* ctx)
+{
+  Groups* g = ctx;
+  tpre_groupid_t group = nd->group;
+  bool begin = false;
+  for (;;)
   {
-    memcpy(nd, nd->just_group, sizeof(Node));
-    groups(nd, group, global_next_group_id, next_named_gr);
-    return;
+    Node* inner;
+    if (nd->kind == NodeJustGroup)
+      inner = nd->just_group;
+    else if (nd->kind == NodeCaptureGroup)
+    {
+      inner = nd->capture;
+      if (g->captures)
+        group = g->next_group++;
+      begin = g->captures;
+    }
+    else if (nd->kind == NodeNamedCaptureGroup)
+    {
+      inner = nd->named_capture.group;
+      if (g->captures)
+        group = g->next_named_group++;
+      begin = g->captures;
+    }
+    else
+      break;
+    memcpy(nd, inner, sizeof(Node));
+    free(inner);
   }
 
-  if (nd->kind == NodeCaptureGroup)
-  {
-    memcpy(nd, nd->capture, sizeof(Node));
-    groups(
-        nd, (*global_next_group_id)++, global_next_group_id,
-        next_named_gr);
-    return;
-  }
+  nd->group = group;
+  nd->group_begin = begin && g->backrefs;
+  Node* children[2];
+  Node_children(nd, children);
+  for (int i = 0; i < 2; i++)
+    if (children[i])
+      children[i]->group = group;
+}
 
-  if (nd->kind == NodeNamedCaptureGroup)
-  {
-    memcpy(nd, nd->named_capture.group, sizeof(Node));
-    groups(
-        nd, (*next_named_gr)++, global_next_group_id,
-        next_named_gr);
-    return;
-  }
+/** 0 = ok */
+static int groups(Node* nd, Groups* g)
+{
+  if (nd)
+    nd->group = 0;
+  return Node_walk(nd, group_one, NULL, g);
+}
 
-  nd->group = group;
-  groups(children[0], group, global_next_group_id, next_named_gr);
-  groups(children[1], group, global_next_group_id, next_named_gr);
+static void find_one_backref(Node* nd, void* ctx)
+{
+  Node** found = ctx;
+  if (!*found && (nd->kind == NodeBackref || nd->kind == NodeNamedBackref))
+    *found = nd;
+}
+
+static Node* find_backref(Node* nd)
+{
+  Node* found = NULL;
+  Node_walk(nd, find_one_backref, NULL, &found);
+  return found;
 }
 
 static bool isRepeatLeast0(NodeKind k)
@@ -184,17 +190,13 @@ static bool isRepeatLeast0(NodeKind k)
   return k == NodeLazyRepeatLeast0 || k == NodeGreedyRepeatLeast0;
 }
 
+// the fix_*() are rewrites of a single node, done after its children with
+// Node_walk()
+
 /** convert RepeatLeast1 to RepeatLeast0 */
-static void fix_0(Node* node)
+static void fix_0(Node* node, void* ctx)
 {
-  if (node == NULL)
-    return;
-  Node* children[2];
-  Node_children(node, children);
-
-  fix_0(children[0]);
-  fix_0(children[1]);
-
+  (void) ctx;
   if (node->kind == NodeLazyRepeatLeast1)
   {
     Node* first = Node_clone(node->repeat);
@@ -222,56 +224,11 @@ static void fix_0(Node* node)
   }
 }
 
-/** move all code chained to or into all or cases if any or case contains
- * repetition */
-static void fix_1(Node* node)
-{
-  if (node == NULL)
-    return;
-  Node* children[2];
-  Node_children(node, children);
-
-  if (node->kind == NodeChain)
-  {
-    Node* orr = find_trough_rep(node->chain.a, NodeOr);
-    if (orr != NULL)
-    {
-      NodeLi cases = { 0 };
-      or_cases(orr, &cases);
-      Node* mov = node->chain.b;
-      size_t i;
-      for (i = 0; i < cases.len; i++)
-      {
-        Node* cas = cases.items[i];
-        Node* inner = Node_alloc();
-        memcpy(inner, cas, sizeof(Node));
-        cas->kind = NodeChain;
-        cas->chain.a = inner;
-        Node* mov2 = Node_clone(mov);
-        cas->chain.b = mov2;
-      }
-      free(cases.items);
-      Node_free(mov);
-      memcpy(node, node->chain.a, sizeof(Node));
-    }
-  }
-
-  fix_1(children[0]);
-  fix_1(children[1]);
-}
-
-/** move duplicate code in beginning of or cases to befre the or; required
- * because otherwise will break engine */
-static void fix_2(Node* node)
+/** move duplicate code in beginning of or cases to before the or, so that it
+ * only gets matched once */
+static void fix_2(Node* node, void* ctx)
 {
-  if (node == NULL)
-    return;
-  Node* children[2];
-  Node_children(node, children);
-
-  fix_2(children[0]);
-  fix_2(children[1]);
-
+  (void) ctx;
   if (node->kind == NodeOr)
   {
     Node* a = node->or.a;
@@ -283,9 +240,13 @@ static void fix_2(Node* node)
     if (a && b && Node_eq(a->chain.a, b->chain.a))
     {
       Node* prefix = a->chain.a;
-      free(b->chain.a);
-      memcpy(a, a->chain.b, sizeof(Node));
-      memcpy(b, b->chain.b, sizeof(Node));
+      Node_free(b->chain.a);
+      Node* rest_a = a->chain.b;
+      Node* rest_b = b->chain.b;
+      memcpy(a, rest_a, sizeof(Node));
+      memcpy(b, rest_b, sizeof(Node));
+      free(rest_a);
+      free(rest_b);
 
       Node* right = Node_alloc();
       memcpy(right, node, sizeof(Node));
@@ -296,310 +257,1372 @@ static void fix_2(Node* node)
   }
 }
 
-static void lower(
-    tpre_re_t* out,
-    tpre_nodeid_t this_id,
-    tpre_nodeid_t on_ok,
-    tpre_nodeid_t on_error,
-    tpre_backtrack_t bt,
-    size_t* num_match,
-    Node* node)
-{
-  assert(node);
-  switch (node->kind)
-  {
-    // removed/checked by fix_*() and verify()
-    case NodeLazyRepeatLeast1:
-    case NodeGreedyRepeatLeast1:
-#ifdef __GNUC__
-      __builtin_unreachable();
-#endif
-      break;
-
-    case NodeMatch: {
-      if (num_match)
-        (*num_match)++;
-      tprec_re_setnode(
-          out, this_id,
-          (tpre_re_node_t) {
-            node->match, on_ok, on_error, bt, node->group });
-    }
-    break;
-
-    // parse everything, and backtrack until next pattern matches
-    case NodeGreedyRepeatLeast0: {
-      // this: bt_push(then: loop, onbt: on_error)
-      // loop: bt_push(then: step, onbt: next/on_ok)
-      // step: node(ok: loop, err: next/on_ok)
-      tpre_nodeid_t step = tprec_re_resvnode(out);
-      tpre_nodeid_t loop;
-      if (on_error == -1)
-      {
-        loop = this_id;
-      }
-      else
-      {
-        loop = tprec_re_resvnode(out);
-        tprec_re_setnode(
-            out, this_id,
-            (tpre_re_node_t) {
-              SP(SPECIAL_BT_PUSH),
-              /* then: */ loop,
-              /* onbt: */ on_error, 0, 0 });
-      }
-
-      tprec_re_setnode(
-          out, loop,
-          (tpre_re_node_t) {
-            SP(SPECIAL_BT_PUSH),
-            /* then: */ step,
-            /* onbt: */ on_ok, 0, 0 });
-      lower(
-          out, step, /*on_ok=*/loop, /*on_error=*/on_ok, 0, NULL,
-          node->repeat);
-    }
-    break;
-
-    // parse until next pattern matches
-    case NodeLazyRepeatLeast0: {
-      tpre_nodeid_t step = tprec_re_resvnode(out);
-      lower(
-          out, step, /*on_ok=*/this_id, /*on_error=*/on_error,
-          /*bt=*/0, NULL, node->repeat);
-      tprec_re_setnode(
-          out, this_id,
-          (tpre_re_node_t) {
-            SP(SPECIAL_BT_PUSH), /* then: */ on_ok,
-            /* onbt: */ step, 0, 0 });
-    }
-    break;
+// counted repeats that need at most this many copies are unrolled, the others
+// are lowered to loops with a counter
+#define TPREC_UNROLL_MAX (8)
 
-    case NodeChain: {
-      size_t nimatch = 0;
-      tpre_nodeid_t right = tprec_re_resvnode(out);
-      assert(right != this_id);
-      lower(
-          out, this_id, right, on_error, bt, &nimatch,
-          node->chain.a);
-      if (num_match)
-        (*num_match) += nimatch;
-      lower(
-          out, right, on_ok, on_error, bt + nimatch, num_match,
-          node->chain.b);
-    }
-    break;
+/** unroll small counted repeats, and split off the unbounded part of large
+ * ones */
+static void fix_4(Node* node, void* ctx)
+{
+  (void) ctx;
+  if (node->kind != NodeRepeat)
+    return;
 
-    case NodeOr: {
-      tpre_nodeid_t right = tprec_re_resvnode(out);
-      assert(right != this_id);
-      lower(out, this_id, on_ok, right, 0, NULL, node->or.a);
-      lower(out, right, on_ok, on_error, 0, NULL, node->or.b);
-    }
-    break;
+  if (unrollSize(node) <= TPREC_UNROLL_MAX && unroll(node))
+    return;
 
-    case NodeMaybe: {
-      lower(out, this_id, on_ok, on_ok, bt, num_match, node->maybe);
-    }
-    break;
+  if (node->counted.max == TPREC_REPEAT_INF)
+  {
+    // x{n,} = x{n}x*
+    Node* rest = Node_alloc();
+    rest->kind = node->counted.lazy ? NodeLazyRepeatLeast0
+                                    : NodeGreedyRepeatLeast0;
+    rest->group = node->group;
+    rest->wherePlus1 = node->wherePlus1;
+    rest->repeat = Node_clone(node->counted.node);
+
+    Node* counted = Node_alloc();
+    memcpy(counted, node, sizeof(Node));
+    counted->counted.max = counted->counted.min;
 
-    default: assert(false && "bruh"); break;
+    node->kind = NodeChain;
+    node->chain.a = counted;
+    node->chain.b = rest;
   }
 }
 
 /** get rid of outer of nested RepeatLeast0 */
-static void fix_3(Node* node)
+static void fix_3(Node* node, void* ctx)
 {
-  if (node == NULL)
-    return;
-  Node* children[2];
-  Node_children(node, children);
-
-  fix_3(children[0]);
-  fix_3(children[1]);
-
+  (void) ctx;
+  // an empty iteration ends the outer repeat, so (x*?)* is x*?. but (x*)*?
+  // tries no x first, and then as many as possible, which neither of them
+  // does
   if (isRepeatLeast0(node->kind) &&
-      isRepeatLeast0(node->repeat->kind))
+      isRepeatLeast0(node->repeat->kind) &&
+      !(node->kind == NodeLazyRepeatLeast0 &&
+        node->repeat->kind == NodeGreedyRepeatLeast0))
   {
+    node->kind = node->repeat->kind;
     node->wherePlus1 = node->repeat->wherePlus1;
     node->group = node->repeat->group;
+    node->group_begin |= node->repeat->group_begin;
     Node* old = node->repeat;
     node->repeat = node->repeat->repeat;
     free(old);
   }
 }
 
-static Node* leftmost(Node* node)
+/** bytes that a match of the node can begin with. false if it can match
+ * without consuming anything, or if that is not known. todo is scratch space,
+ * and empty before and after */
+static bool first_bytes(Node* nd, tpre_class_t* out, tprec_stack_t* todo)
 {
-  switch (node->kind)
+  // the union of the first bytes of everything a match can begin with
+  memset(out, 0, sizeof(*out));
+  bool ok = true;
+  while (ok && nd)
   {
-    case NodeLazyRepeatLeast0:
-    case NodeLazyRepeatLeast1:
-    case NodeGreedyRepeatLeast0:
-    case NodeGreedyRepeatLeast1: return leftmost(node->repeat);
+    Node* next = NULL;
+    switch (nd->kind)
+    {
+      case NodeMatch:
+      case NodeNot:   {
+        tpre_class_t cls;
+        ok = Node_class(nd, &cls);
+        for (size_t i = 0; ok && i < sizeof(cls.bits); i++)
+          out->bits[i] |= cls.bits[i];
+      }
+      break;
+
+      case NodeChain: next = nd->chain.a; break;
 
-    case NodeChain: return leftmost(node->chain.a);
+      case NodeOr:
+        ok = tprec_stack_push(todo, nd->or.b);
+        next = nd->or.a;
+        break;
 
-    case NodeMaybe: return leftmost(node->maybe);
+      case NodeGreedyRepeatLeast1:
+      case NodeLazyRepeatLeast1:   next = nd->repeat; break;
 
-    default: return node;
+      case NodeRepeat:
+        ok = nd->counted.min > 0;
+        next = nd->counted.node;
+        break;
+
+      case NodeAtomic: next = nd->atomic; break;
+
+      default: ok = false; break;
+    }
+    nd = next || !todo->len ? next : tprec_stack_pop(todo);
   }
+  todo->len = 0;
+  return ok;
 }
 
-static int check_legal(tpre_errs_t* errs, Node* nd)
+/** results of the children of the nodes that can_be_empty() visited */
+typedef struct
+{
+  tprec_stack_t results;
+  bool oom;
+} Empty;
+
+static void empty_one(Node* nd, void* ctx)
 {
-  if (nd->kind == NodeOr)
+  Empty* e = ctx;
+  if (e->oom)
+    return;
+  Node* children[2];
+  Node_children(nd, children);
+  bool b = children[1] && tprec_stack_pop(&e->results);
+  bool a = children[0] && tprec_stack_pop(&e->results);
+
+  bool r;
+  switch (nd->kind)
   {
-    // this is invalid: a*?b|ac
-    // this is invalid too: (ab)*|(ac)*
+    case NodeMatch:
+    case NodeNot:   r = false; break;
 
-    NodeLi cases = { 0 };
-    or_cases(nd, &cases);
+    case NodeChain: r = a && b; break;
+    case NodeOr:    r = a || b; break;
 
-    size_t i, j;
-    for (i = 0; i < cases.len; i++)
-    {
-      for (j = 0; j < cases.len; j++)
-      {
-        if (i == j)
-          continue;
-
-        Node* a = leftmost(cases.items[i]);
-        Node* b = leftmost(cases.items[j]);
-
-        if (Node_eq(a, b))
-        {
-          tprec_add_err(
-              errs,
-              nd->wherePlus1 - 1, "patterns where a case has the same starting pattern in a repeating sequence as in another case are not yet supported");
-          return 1;
-        }
-      }
-    }
+    case NodeGreedyRepeatLeast1:
+    case NodeLazyRepeatLeast1:
+    case NodeAtomic:             r = a; break;
 
-    free(cases.items);
+    case NodeRepeat: r = nd->counted.min == 0 || a; break;
+
+    // repeats that can be skipped, and backrefs to empty groups
+    default: r = true; break;
   }
+  if (!tprec_stack_push(&e->results, (void*) (uintptr_t) r))
+    e->oom = true;
+}
 
-  Node* children[2];
-  Node_children(nd, children);
-  for (int i = 0; i < 2; i++)
-    if (children[i] && check_legal(errs, children[i]))
-      return 1;
-  return 0;
+/** whether the node can match without consuming anything. true if that is
+ * not known */
+static bool can_be_empty(Node* nd)
+{
+  Empty e = { 0 };
+  bool r = Node_walk(nd, NULL, empty_one, &e) || e.oom ||
+      tprec_stack_pop(&e.results);
+  free(e.results.items);
+  return r;
 }
 
-static void tpre_dump(tpre_re_t out)
+/** how often the node began a match, from the weight of its first nodes. todo
+ * is like in first_bytes() */
+static uint64_t case_weight(
+    Node* nd, uint64_t const* weights, size_t patl, tprec_stack_t* todo)
 {
-  printf("start = %i\n", out.first_node);
-  printf("nd\tok\terr\tv\tbt\tg\n");
-  size_t i;
-  for (i = 0; i < out.num_nodes; i++)
+  uint64_t weight = 0;
+  bool ok = true;
+  while (ok && nd)
   {
-    char s[3];
-    if (out.i[i].pat.is_special)
-    {
-      s[0] = '\\';
-      switch (out.i[i].pat.val)
-      {
-        case SPECIAL_ANY:     s[1] = '*'; break;
-        case SPECIAL_END:     s[1] = '$'; break;
-        case SPECIAL_SPACE:   s[1] = 's'; break;
-        case SPECIAL_START:   s[1] = '^'; break;
-        case SPECIAL_BT_PUSH: s[1] = '{'; break;
-        default:              break;
-      }
-      s[2] = '\0';
-    }
-    else
+    Node* next = NULL;
+    switch (nd->kind)
     {
-      s[0] = out.i[i].pat.val;
-      s[1] = '\0';
+      case NodeMatch:
+      case NodeNot:
+        if (nd->wherePlus1 && nd->wherePlus1 - 1 < patl)
+          weight += weights[nd->wherePlus1 - 1];
+        break;
+
+      case NodeChain: next = nd->chain.a; break;
+
+      case NodeOr:
+        ok = tprec_stack_push(todo, nd->or.b);
+        next = nd->or.a;
+        break;
+
+      case NodeGreedyRepeatLeast1:
+      case NodeLazyRepeatLeast1:   next = nd->repeat; break;
+
+      case NodeRepeat: next = nd->counted.node; break;
+
+      case NodeAtomic: next = nd->atomic; break;
+
+      default: break;
     }
-    printf(
-        "%zu\t%i\t%i\t%s\t%u\t%u\n", i, out.i[i].ok,
-        out.i[i].err, s, out.i[i].backtrack, out.i[i].group);
+    nd = next || !todo->len ? next : tprec_stack_pop(todo);
   }
-  fflush(stdout);
+  todo->len = 0;
+  return weight;
 }
 
-int tpre_compile(
-    tpre_re_t* out,
-    char const* str,
-    tpre_errs_t* errs_out,
-    tpre_opts_t opts)
+typedef struct
 {
-  int status = 0;
+  Node* node;
+  uint64_t weight;
+  size_t index;
+} WeightedCase;
 
-  memset(out, 0, sizeof(tpre_re_t));
+static int weighted_case_cmp(void const* pa, void const* pb)
+{
+  WeightedCase const* a = pa;
+  WeightedCase const* b = pb;
+  if (a->weight != b->weight)
+    return a->weight > b->weight ? -1 : 1;
+  return a->index < b->index ? -1 : a->index > b->index;
+}
 
-  if (errs_out)
+/** sorts the cases of one alternation by their weight, most often matched
+ * first. only cases that can't match at the same position are moved past
+ * each other, so that the first match is still the same one. cases has room
+ * for all of them. todo is like in first_bytes() */
+static void reorder_spine(
+    Node* node,
+    WeightedCase* cases,
+    size_t num,
+    uint64_t const* weights,
+    size_t patl,
+    tprec_stack_t* todo)
+{
+  size_t i = 0;
+  Node* spine;
+  for (spine = node; spine->kind == NodeOr && spine->group == node->group;
+       spine = spine->or.b)
+    cases[i++].node = spine->or.a;
+  cases[i].node = spine;
+
+  for (i = 0; i < num; i++)
   {
-    errs_out->len = 0;
-    errs_out->items = NULL;
+    cases[i].weight = case_weight(cases[i].node, weights, patl, todo);
+    cases[i].index = i;
   }
 
-  TkL li = { 0 };
-  if (tprec_lexe(&li, errs_out, str, &opts))
+  // sort each run of cases whose first bytes don't overlap
+  size_t begin = 0;
+  while (begin < num)
+  {
+    tpre_class_t seen, first;
+    size_t end = begin;
+    memset(&seen, 0, sizeof(seen));
+    while (end < num && first_bytes(cases[end].node, &first, todo))
+    {
+      bool overlaps = false;
+      for (size_t b = 0; b < sizeof(seen.bits); b++)
+      {
+        overlaps |= (seen.bits[b] & first.bits[b]) != 0;
+        seen.bits[b] |= first.bits[b];
+      }
+      if (overlaps)
+        break;
+      end++;
+    }
+    if (end - begin > 1)
+      qsort(
+          cases + begin, end - begin, sizeof(WeightedCase),
+          weighted_case_cmp);
+    begin = end > begin ? end : begin + 1;
+  }
+
+  i = 0;
+  for (spine = node; spine->kind == NodeOr && spine->group == node->group;
+       spine = spine->or.b)
+  {
+    spine->or.a = cases[i++].node;
+    if (i == num - 1)
+    {
+      spine->or.b = cases[i].node;
+      break;
+    }
+  }
+}
+
+/** sorts the cases of every alternation with reorder_spine(). 0 = ok */
+static int reorder_cases(Node* root, uint64_t const* weights, size_t patl)
+{
+  tprec_stack_t todo = { 0 };
+  tprec_stack_t scratch = { 0 };
+  WeightedCase* cases = NULL;
+  size_t cases_cap = 0;
+  bool ok = root == NULL || tprec_stack_push(&todo, root);
+  while (ok && todo.len)
+  {
+    Node* node = tprec_stack_pop(&todo);
+    if (node->kind != NodeOr)
+    {
+      Node* children[2];
+      Node_children(node, children);
+      for (int i = 1; ok && i >= 0; i--)
+        if (children[i])
+          ok = tprec_stack_push(&todo, children[i]);
+      continue;
+    }
+
+    // a|(b|(c|d)) has the cases a, b, c and d
+    size_t num = 1;
+    Node* spine;
+    for (spine = node; spine->kind == NodeOr && spine->group == node->group;
+         spine = spine->or.b)
+      num++;
+
+    if (num > cases_cap)
+    {
+      void* grown = realloc(cases, sizeof(WeightedCase) * num);
+      if (!grown)
+      {
+        ok = false;
+        break;
+      }
+      cases = grown;
+      cases_cap = num;
+    }
+    reorder_spine(node, cases, num, weights, patl, &scratch);
+
+    // the cases themselves can contain alternations
+    for (size_t i = num; ok && i-- > 0;)
+      ok = tprec_stack_push(&todo, cases[i].node);
+  }
+  free(todo.items);
+  free(scratch.items);
+  free(cases);
+  return !ok;
+}
+
+/** a single char match with the given group */
+static bool is_class_case(Node* node, tpre_groupid_t group)
+{
+  if (node->kind != NodeMatch || node->group != group)
+    return false;
+  if (!node->match.is_special)
+    return true;
+  switch (node->match.val)
+  {
+    case SPECIAL_ANY:
+    case SPECIAL_SPACE:
+    case SPECIAL_DIGIT:
+    case SPECIAL_WORDC: return true;
+
+    default: return false;
+  }
+}
+
+/** or where every case is a single char match with the given group */
+static bool is_class_or(Node* node, tpre_groupid_t group)
+{
+  // ors lean right, so this only has to remember few cases
+  tprec_stack_t todo = { 0 };
+  bool ok = true;
+  while (ok && node)
+  {
+    if (node->kind == NodeOr)
+    {
+      ok = tprec_stack_push(&todo, node->or.b);
+      node = node->or.a;
+      continue;
+    }
+    ok = is_class_case(node, group);
+    node = todo.len ? tprec_stack_pop(&todo) : NULL;
+  }
+  free(todo.items);
+  return ok;
+}
+
+/** splits the class into byte ranges, if there are few enough */
+static void run_ranges(tpre_run_t* run, tpre_class_t const* bits)
+{
+  run->num_ranges = 0;
+  unsigned c = 0;
+  while (c < 256)
+  {
+    if (!tprec_class_has(bits, (uint8_t) c))
+    {
+      c++;
+      continue;
+    }
+    unsigned lo = c;
+    while (c < 256 && tprec_class_has(bits, (uint8_t) c))
+      c++;
+    if (run->num_ranges == TPRE_RUN_MAX_RANGES)
+    {
+      run->num_ranges = 0;
+      return;
+    }
+    run->lo[run->num_ranges] = (uint8_t) lo;
+    run->hi[run->num_ranges] = (uint8_t) (c - 1);
+    run->num_ranges++;
+  }
+}
+
+/** lowers a repeat of a single char match into one SPECIAL_RUN node. false if
+ * it repeats something else */
+static bool lower_run(
+    tpre_re_t* out, tpre_nodeid_t this_id, tpre_nodeid_t on_ok, Node* node)
+{
+  Node* rep = node->repeat;
+  // the run captures all of its bytes, not only the last iteration
+  if (rep->group_begin)
+    return false;
+  if (rep->kind != NodeMatch && rep->kind != NodeNot &&
+      !(rep->kind == NodeOr && is_class_or(rep, rep->group)))
+    return false;
+
+  tpre_class_t bits;
+  if (!Node_class(rep, &bits))
+    return false;
+  int cls = tprec_re_addclass(out, bits);
+  if (cls < 0)
+    return false;
+
+  tpre_run_t run = { .lazy = node->kind == NodeLazyRepeatLeast0,
+                     .cls = (uint16_t) cls };
+  run_ranges(&run, &bits);
+  int idx = tprec_re_addrun(out, run);
+  if (idx < 0)
+    return false;
+
+  tpre_pattern_t pat = SP(SPECIAL_RUN);
+  pat.arg = (uint16_t) idx;
+  tprec_re_setnode(
+      out, this_id,
+      (tpre_re_node_t) { pat, on_ok, NODE_ERR, 0, rep->group });
+  return true;
+}
+
+/** a node that lower() still has to lower, with what it continues at */
+typedef struct
+{
+  Node* node;
+  tpre_nodeid_t this_id;
+  tpre_nodeid_t on_ok;
+  tpre_nodeid_t on_error;
+  tpre_backtrack_t bt;
+  // index of the task that counts the matches of this one, or -1
+  ptrdiff_t count_into;
+  // the matches in this one that consume a char, if something counts into it
+  size_t num_match;
+  // chains: chain.a is lowered, chain.b still has to be lowered at right
+  bool rest;
+  tpre_nodeid_t right;
+  // ors: known to be a class or
+  bool class_or;
+  // the group_begin of the node is lowered
+  bool group_begun;
+} LowerTask;
+
+typedef struct
+{
+  LowerTask* items;
+  size_t len;
+  size_t cap;
+} LowerTasks;
+
+/** false if out of memory */
+static bool push_task(LowerTasks* tasks, LowerTask task)
+{
+  if (tasks->len == tasks->cap)
+  {
+    size_t cap = tasks->cap ? tasks->cap * 2 : 32;
+    LowerTask* items = realloc(tasks->items, sizeof(LowerTask) * cap);
+    if (!items)
+      return false;
+    tasks->items = items;
+    tasks->cap = cap;
+  }
+  tasks->items[tasks->len++] = task;
+  return true;
+}
+
+/** the iteration of a loop that begins at this_id, and continues at on_ok,
+ * when the repeated node can match the empty string:
+ *   this: iter_begin(slot)
+ *   body: node(ok: end)
+ *   end: iter_end(slot, ok: on_ok, empty: on_empty)
+ * an empty iteration goes to on_empty, so that it is never repeated. the node
+ * is to be lowered into *body, continuing at *body_ok. false if there are too
+ * many slots, or if out of memory */
+static bool lower_iter(
+    tpre_re_t* out,
+    tpre_nodeid_t this_id,
+    tpre_nodeid_t on_ok,
+    tpre_nodeid_t on_empty,
+    tpre_nodeid_t* body,
+    tpre_nodeid_t* body_ok)
+{
+  int slot = tprec_re_addslot(out, false);
+  if (slot < 0)
+    return false;
+  tpre_pattern_t begin = SP(SPECIAL_ITER_BEGIN);
+  begin.arg = (uint16_t) slot;
+  tpre_pattern_t end = SP(SPECIAL_ITER_END);
+  end.arg = begin.arg;
+
+  *body = tprec_re_resvnode(out);
+  *body_ok = tprec_re_resvnode(out);
+  if (*body < 0 || *body_ok < 0)
+    return false;
+  out->wherePlus1[*body_ok] = out->wherePlus1[this_id];
+  tprec_re_setnode(
+      out, this_id, (tpre_re_node_t) { begin, *body, NODE_ERR, 0, 0 });
+  tprec_re_setnode(
+      out, *body_ok, (tpre_re_node_t) { end, on_ok, on_empty, 0, 0 });
+  return true;
+}
+
+/** lowers the node of the task, and pushes the tasks for its children. false
+ * if out of memory, or if there are too many loops or slots */
+static bool lower_one(tpre_re_t* out, LowerTasks* tasks, LowerTask t)
+{
+  Node* node = t.node;
+  tpre_nodeid_t this_id = t.this_id;
+  tpre_nodeid_t on_ok = t.on_ok;
+  tpre_nodeid_t on_error = t.on_error;
+  tpre_backtrack_t bt = t.bt;
+
+  assert(node);
+  // nodes lowered by the children overwrite this with a more precise location
+  if (node->wherePlus1)
+    out->wherePlus1[this_id] = (uint32_t) node->wherePlus1;
+
+  // this: group_begin(group), and then the node
+  if (node->group_begin && !t.group_begun)
+  {
+    tpre_nodeid_t inner = tprec_re_resvnode(out);
+    if (inner < 0)
+      return false;
+    tpre_pattern_t pat = SP(SPECIAL_GROUP_BEGIN);
+    pat.arg = node->group;
+    out->wherePlus1[inner] = out->wherePlus1[this_id];
+    tprec_re_setnode(
+        out, this_id, (tpre_re_node_t) { pat, inner, NODE_ERR, 0, 0 });
+    t.this_id = inner;
+    t.group_begun = true;
+    return push_task(tasks, t);
+  }
+
+  // the run pushes its own backtracks, so there must be nothing to go to
+  // when all of them failed
+  if (isRepeatLeast0(node->kind) && on_error == NODE_ERR &&
+      lower_run(out, this_id, on_ok, node))
+    return true;
+
+  switch (node->kind)
+  {
+    // removed/checked by fix_*() and verify()
+    case NodeLazyRepeatLeast1:
+    case NodeGreedyRepeatLeast1:
+#ifdef __GNUC__
+      __builtin_unreachable();
+#endif
+      break;
+
+    case NodeMatch: {
+      if (t.count_into >= 0)
+        tasks->items[t.count_into].num_match++;
+      tprec_re_setnode(
+          out, this_id,
+          (tpre_re_node_t) {
+            node->match, on_ok, on_error, bt, node->group });
+    }
+    break;
+
+    // parse everything, and backtrack until next pattern matches
+    case NodeGreedyRepeatLeast0: {
+      // this: bt_push(then: loop, onbt: on_error)
+      // loop: bt_push(then: step, onbt: next/on_ok)
+      // step: node(ok: loop, err: next/on_ok)
+      // or step: lower_iter(), if the node can match the empty string
+      tpre_nodeid_t step = tprec_re_resvnode(out);
+      if (step < 0)
+        return false;
+      tpre_nodeid_t loop;
+      if (on_error == -1)
+      {
+        loop = this_id;
+      }
+      else
+      {
+        loop = tprec_re_resvnode(out);
+        if (loop < 0)
+          return false;
+        out->wherePlus1[loop] = out->wherePlus1[this_id];
+        tprec_re_setnode(
+            out, this_id,
+            (tpre_re_node_t) {
+              SP(SPECIAL_BT_PUSH),
+              /* then: */ loop,
+              /* onbt: */ on_error, 0, 0 });
+      }
+
+      tprec_re_setnode(
+          out, loop,
+          (tpre_re_node_t) {
+            SP(SPECIAL_BT_PUSH),
+            /* then: */ step,
+            /* onbt: */ on_ok, 0, 0 });
+      tpre_nodeid_t body = step;
+      tpre_nodeid_t body_ok = loop;
+      if (can_be_empty(node->repeat))
+      {
+        out->wherePlus1[step] = out->wherePlus1[this_id];
+        if (!lower_iter(out, step, loop, on_ok, &body, &body_ok))
+          return false;
+      }
+      // loop already pushed a backtrack to on_ok for this position
+      return push_task(
+          tasks, (LowerTask) { .node = node->repeat,
+                               .this_id = body,
+                               .on_ok = body_ok,
+                               .on_error = NODE_ERR,
+                               .count_into = -1 });
+    }
+
+    // parse until next pattern matches
+    case NodeLazyRepeatLeast0: {
+      // this: bt_push(then: on_ok, onbt: step)
+      // step: node(ok: this, err: on_error), or lower_iter()
+      tpre_nodeid_t step = tprec_re_resvnode(out);
+      if (step < 0)
+        return false;
+      tprec_re_setnode(
+          out, this_id,
+          (tpre_re_node_t) {
+            SP(SPECIAL_BT_PUSH), /* then: */ on_ok,
+            /* onbt: */ step, 0, 0 });
+      tpre_nodeid_t body = step;
+      tpre_nodeid_t body_ok = this_id;
+      if (can_be_empty(node->repeat))
+      {
+        out->wherePlus1[step] = out->wherePlus1[this_id];
+        if (!lower_iter(out, step, this_id, on_ok, &body, &body_ok))
+          return false;
+      }
+      return push_task(
+          tasks, (LowerTask) { .node = node->repeat,
+                               .this_id = body,
+                               .on_ok = body_ok,
+                               .on_error = on_error,
+                               .count_into = -1 });
+    }
+
+    case NodeChain: {
+      // chain.b backtracks over what chain.a matched, so it is lowered once
+      // chain.a counted that
+      t.rest = true;
+      t.right = tprec_re_resvnode(out);
+      if (t.right < 0)
+        return false;
+      t.num_match = 0;
+      assert(t.right != this_id);
+      if (!push_task(tasks, t))
+        return false;
+      return push_task(
+          tasks, (LowerTask) { .node = node->chain.a,
+                               .this_id = this_id,
+                               .on_ok = t.right,
+                               .on_error = on_error,
+                               .bt = bt,
+                               .count_into = (ptrdiff_t) tasks->len - 1 });
+    }
+
+    case NodeOr: {
+      tpre_nodeid_t right = tprec_re_resvnode(out);
+      if (right < 0)
+        return false;
+      assert(right != this_id);
+      if (t.class_or || is_class_or(node, node->group))
+      {
+        // every case consumes exactly one char into the same group, so
+        // whichever case matches, the state afterwards is the same
+        Node* b = node->or.b;
+        return push_task(
+                   tasks,
+                   (LowerTask) { .node = b,
+                                 .this_id = right,
+                                 .on_ok = on_ok,
+                                 .on_error = on_error,
+                                 .bt = bt,
+                                 .count_into = -1,
+                                 .class_or = b->kind == NodeOr &&
+                                     b->group == node->group }) &&
+            push_task(
+                   tasks, (LowerTask) { .node = node->or.a,
+                                        .this_id = this_id,
+                                        .on_ok = on_ok,
+                                        .on_error = right,
+                                        .count_into = -1 });
+      }
+
+      // this: bt_push(then: a, onbt: b)
+      // both cases continue at the same on_ok, which is lowered only once
+      tpre_nodeid_t left = tprec_re_resvnode(out);
+      if (left < 0)
+        return false;
+      tprec_re_setnode(
+          out, this_id,
+          (tpre_re_node_t) {
+            SP(SPECIAL_BT_PUSH),
+            /* then: */ left,
+            /* onbt: */ right, 0, 0 });
+      return push_task(
+                 tasks, (LowerTask) { .node = node->or.b,
+                                      .this_id = right,
+                                      .on_ok = on_ok,
+                                      .on_error = on_error,
+                                      .bt = bt,
+                                      .count_into = -1 }) &&
+          push_task(
+                 tasks, (LowerTask) { .node = node->or.a,
+                                      .this_id = left,
+                                      .on_ok = on_ok,
+                                      .on_error = NODE_ERR,
+                                      .count_into = -1 });
+    }
+
+    case NodeMaybe: {
+      // this: bt_push(then: inner, onbt: on_ok)
+      tpre_nodeid_t inner = tprec_re_resvnode(out);
+      if (inner < 0)
+        return false;
+      tprec_re_setnode(
+          out, this_id,
+          (tpre_re_node_t) {
+            SP(SPECIAL_BT_PUSH),
+            /* then: */ inner,
+            /* onbt: */ on_ok, 0, 0 });
+      return push_task(
+          tasks, (LowerTask) { .node = node->maybe,
+                               .this_id = inner,
+                               .on_ok = on_ok,
+                               .on_error = NODE_ERR,
+                               .count_into = -1 });
+    }
+
+    case NodeLazyMaybe: {
+      // this: bt_push(then: on_ok, onbt: inner)
+      tpre_nodeid_t inner = tprec_re_resvnode(out);
+      if (inner < 0)
+        return false;
+      tprec_re_setnode(
+          out, this_id,
+          (tpre_re_node_t) {
+            SP(SPECIAL_BT_PUSH),
+            /* then: */ on_ok,
+            /* onbt: */ inner, 0, 0 });
+      return push_task(
+          tasks, (LowerTask) { .node = node->maybe,
+                               .this_id = inner,
+                               .on_ok = on_ok,
+                               .on_error = NODE_ERR,
+                               .count_into = -1 });
+    }
+
+    case NodeRepeat: {
+      // this: ctr_init(slot)
+      // loop: loop(then: body, exit: on_ok)
+      // body: node(ok: loop, err: NODE_ERR)
+      int slot = tprec_re_addslot(out, true);
+      int begin_slot = slot >= 0 && can_be_empty(node->counted.node)
+          ? tprec_re_addslot(out, false)
+          : TPRE_NO_SLOT;
+      if (slot < 0 || begin_slot < 0)
+        return false;
+      tpre_loop_t loop = {
+        .slot = (uint16_t) slot,
+        .begin_slot = (uint16_t) begin_slot,
+        .lazy = node->counted.lazy,
+        .min = node->counted.min,
+        .max = node->counted.max,
+      };
+      int loop_idx = tprec_re_addloop(out, loop);
+      if (loop_idx < 0)
+        return false;
+      tpre_pattern_t init = SP(SPECIAL_CTR_INIT);
+      init.arg = loop.slot;
+      tpre_pattern_t step = SP(SPECIAL_LOOP);
+      step.arg = (uint16_t) loop_idx;
+
+      tpre_nodeid_t loop_id = tprec_re_resvnode(out);
+      tpre_nodeid_t body = tprec_re_resvnode(out);
+      if (loop_id < 0 || body < 0)
+        return false;
+      out->wherePlus1[loop_id] = out->wherePlus1[this_id];
+      tprec_re_setnode(
+          out, this_id,
+          (tpre_re_node_t) { init, loop_id, NODE_ERR, 0, 0 });
+      tprec_re_setnode(
+          out, loop_id,
+          (tpre_re_node_t) { step, /* then: */ body,
+                             /* exit: */ on_ok, 0, 0 });
+      // the loop pushes its own backtracks
+      return push_task(
+          tasks, (LowerTask) { .node = node->counted.node,
+                               .this_id = body,
+                               .on_ok = loop_id,
+                               .on_error = NODE_ERR,
+                               .count_into = -1 });
+    }
+
+    case NodeBackref: {
+      tpre_pattern_t pat = SP(SPECIAL_BACKREF);
+      pat.arg = node->backref;
+      tprec_re_setnode(
+          out, this_id,
+          (tpre_re_node_t) { pat, on_ok, on_error, bt, node->group });
+      // so that the referenced group is always allocated
+      if (node->backref > out->max_group)
+        out->max_group = node->backref;
+      out->has_backrefs = true;
+    }
+    break;
+
+    case NodeNot: {
+      // verify() checked that it's a class
+      tpre_class_t bits;
+      tpre_pattern_t pat;
+      if (!Node_class(node, &bits) ||
+          tprec_class_pattern(out, &bits, &pat))
+        return false;
+      if (t.count_into >= 0)
+        tasks->items[t.count_into].num_match++;
+      tprec_re_setnode(
+          out, this_id,
+          (tpre_re_node_t) { pat, on_ok, on_error, bt, node->group });
+    }
+    break;
+
+    case NodeAtomic: {
+      // this: atomic_begin(slot)
+      // inner: node(ok: end, err: NODE_ERR)
+      // end: atomic_end(slot), drops the backtracks of inner
+      int slot = tprec_re_addslot(out, true);
+      if (slot < 0)
+        return false;
+      tpre_pattern_t begin = SP(SPECIAL_ATOMIC_BEGIN);
+      begin.arg = (uint16_t) slot;
+      tpre_pattern_t end_pat = SP(SPECIAL_ATOMIC_END);
+      end_pat.arg = begin.arg;
+
+      tpre_nodeid_t inner = tprec_re_resvnode(out);
+      tpre_nodeid_t end = tprec_re_resvnode(out);
+      if (inner < 0 || end < 0)
+        return false;
+      out->wherePlus1[end] = out->wherePlus1[this_id];
+      tprec_re_setnode(
+          out, this_id,
+          (tpre_re_node_t) { begin, inner, NODE_ERR, 0, 0 });
+      tprec_re_setnode(
+          out, end, (tpre_re_node_t) { end_pat, on_ok, NODE_ERR, 0, 0 });
+      return push_task(
+          tasks, (LowerTask) { .node = node->atomic,
+                               .this_id = inner,
+                               .on_ok = end,
+                               .on_error = NODE_ERR,
+                               .count_into = -1 });
+    }
+
+    default: assert(false && "bruh"); break;
+  }
+  return true;
+}
+
+/** lowers the tree into this_id and the nodes that it reserves. the tree is
+ * walked with an explicit list of tasks, because it can be very deep. 0 = ok
+ */
+static int lower(
+    tpre_re_t* out,
+    tpre_nodeid_t this_id,
+    tpre_nodeid_t on_ok,
+    tpre_nodeid_t on_error,
+    Node* node,
+    tpre_errs_t* errs)
+{
+  LowerTasks tasks = { 0 };
+  bool ok = push_task(
+      &tasks, (LowerTask) { .node = node,
+                            .this_id = this_id,
+                            .on_ok = on_ok,
+                            .on_error = on_error,
+                            .count_into = -1 });
+  while (ok && tasks.len)
+  {
+    LowerTask t = tasks.items[--tasks.len];
+    if (!t.rest)
+    {
+      ok = lower_one(out, &tasks, t);
+      if (!ok)
+        tprec_add_err(
+            errs, t.node->wherePlus1 ? t.node->wherePlus1 - 1 : 0,
+            "regex too large");
+      continue;
+    }
+
+    // chain.a is lowered
+    if (t.count_into >= 0)
+      tasks.items[t.count_into].num_match += t.num_match;
+    ok = push_task(
+        &tasks, (LowerTask) { .node = t.node->chain.b,
+                              .this_id = t.right,
+                              .on_ok = t.on_ok,
+                              .on_error = t.on_error,
+                              .bt = (tpre_backtrack_t) (t.bt + t.num_match),
+                              .count_into = t.count_into });
+  }
+  free(tasks.items);
+  return !ok;
+}
+
+static bool re_node_eq(tpre_re_node_t const* a, tpre_re_node_t const* b)
+{
+  return a->pat.is_special == b->pat.is_special &&
+      a->pat.val == b->pat.val && a->pat.invert == b->pat.invert &&
+      a->pat.arg == b->pat.arg &&
+      a->ok == b->ok && a->err == b->err &&
+      a->backtrack == b->backtrack && a->group == b->group;
+}
+
+static size_t re_node_hash(tpre_re_node_t const* nd)
+{
+  size_t h = nd->pat.is_special;
+  h = h * 31 + nd->pat.val;
+  h = h * 31 + nd->pat.invert;
+  h = h * 31 + nd->pat.arg;
+  h = h * 31 + (uint32_t) nd->ok;
+  h = h * 31 + (uint32_t) nd->err;
+  h = h * 31 + nd->backtrack;
+  h = h * 31 + nd->group;
+  return h ^ (h >> 16);
+}
+
+static tpre_nodeid_t remap_id(tpre_nodeid_t const* map, tpre_nodeid_t id)
+{
+  return id < 0 ? id : map[id];
+}
+
+/** hash-cons identical nodes in one pass, children before their parents, then
+ * remove all nodes that are not reachable from the first node */
+static int dedup_nodes(tpre_re_t* re)
+{
+  size_t n = (size_t) re->num_nodes;
+  size_t cap = 16;
+  while (cap < n * 2)
+    cap *= 2;
+
+  tpre_nodeid_t* map = malloc(sizeof(tpre_nodeid_t) * n);
+  tpre_nodeid_t* table = malloc(sizeof(tpre_nodeid_t) * cap);
+  bool* alive = malloc(sizeof(bool) * n);
+  // every node is expanded once and pushes at most two children
+  tpre_nodeid_t* order = malloc(sizeof(tpre_nodeid_t) * (n * 2 + 1));
+  uint8_t* state = malloc(n);
+  if (!map || !table || !alive || !order || !state)
+  {
+    free(map);
+    free(table);
+    free(alive);
+    free(order);
+    free(state);
     return 1;
-  if (li.oom)
+  }
+
+  size_t i;
+  for (i = 0; i < n; i++)
+  {
+    map[i] = (tpre_nodeid_t) i;
+    state[i] = 0;
+  }
+  for (i = 0; i < cap; i++)
+    table[i] = -1;
+
+  // post-order walk: state 0 = not seen, 1 = children pushed, 2 = done. a
+  // node is hashed after its children got their final ids, except for the
+  // back edges of loops, which are fixed up afterwards
+  size_t sp = 0;
+  order[sp++] = re->first_node;
+  while (sp)
+  {
+    tpre_nodeid_t cur = order[sp - 1];
+    tpre_re_node_t* nd = &re->i[cur];
+    if (state[cur] == 0)
+    {
+      state[cur] = 1;
+      if (nd->err >= 0 && state[nd->err] == 0)
+        order[sp++] = nd->err;
+      if (nd->ok >= 0 && state[nd->ok] == 0)
+        order[sp++] = nd->ok;
+      continue;
+    }
+    sp--;
+    if (state[cur] == 2)
+      continue;
+    state[cur] = 2;
+
+    nd->ok = remap_id(map, nd->ok);
+    nd->err = remap_id(map, nd->err);
+    size_t slot = re_node_hash(nd) & (cap - 1);
+    for (; table[slot] >= 0; slot = (slot + 1) & (cap - 1))
+    {
+      if (re_node_eq(&re->i[table[slot]], nd))
+      {
+        map[cur] = table[slot];
+        break;
+      }
+    }
+    if (map[cur] == cur)
+      table[slot] = cur;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    re->i[i].ok = remap_id(map, re->i[i].ok);
+    re->i[i].err = remap_id(map, re->i[i].err);
+  }
+  re->first_node = remap_id(map, re->first_node);
+  free(order);
+  free(state);
+
+  // compact: map[old] = new id of reachable nodes, -1 otherwise
+  tpre_nodeid_t* stack = table;
+  sp = 0;
+  for (i = 0; i < n; i++)
+  {
+    map[i] = -1;
+    alive[i] = false;
+  }
+  stack[sp++] = re->first_node;
+  alive[re->first_node] = true;
+  while (sp)
+  {
+    tpre_re_node_t nd = re->i[stack[--sp]];
+    tpre_nodeid_t next[2] = { nd.ok, nd.err };
+    for (int k = 0; k < 2; k++)
+    {
+      if (next[k] >= 0 && !alive[next[k]])
+      {
+        alive[next[k]] = true;
+        stack[sp++] = next[k];
+      }
+    }
+  }
+
+  tpre_nodeid_t num = 0;
+  for (i = 0; i < n; i++)
+    if (alive[i])
+      map[i] = num++;
+
+  for (i = 0; i < n; i++)
+  {
+    if (!alive[i])
+      continue;
+    tpre_re_node_t nd = re->i[i];
+    nd.ok = remap_id(map, nd.ok);
+    nd.err = remap_id(map, nd.err);
+    re->i[map[i]] = nd;
+    re->wherePlus1[map[i]] = re->wherePlus1[i];
+  }
+  re->first_node = map[re->first_node];
+  re->num_nodes = num;
+
+  free(map);
+  free(table);
+  free(alive);
+  return 0;
+}
+
+static bool is_literal(tpre_re_node_t const* nd)
+{
+  return !nd->pat.is_special;
+}
+
+/** whether the literal after can be matched together with the literal
+ * before it, which it is the only way to */
+static bool literal_continues(
+    tpre_re_node_t const* before,
+    tpre_re_node_t const* after,
+    size_t after_preds)
+{
+  // failing in after steps back over the byte of before, and then has to go
+  // where failing in before goes
+  return is_literal(before) && is_literal(after) && after_preds == 1 &&
+      before->group == after->group && before->err == after->err &&
+      (before->err == NODE_ERR ||
+       after->backtrack == before->backtrack + 1);
+}
+
+static size_t string_hash(uint8_t const* bytes, size_t len)
+{
+  size_t h = len;
+  for (size_t i = 0; i < len; i++)
+    h = h * 31 + bytes[i];
+  return h ^ (h >> 16);
+}
+
+/** collapses chains of literal nodes into SPECIAL_STRING nodes. the nodes of
+ * the chain after the first become unreachable. 0 = ok */
+static int merge_strings(tpre_re_t* re)
+{
+  size_t n = (size_t) re->num_nodes;
+  size_t* preds = calloc(n, sizeof(size_t));
+  // continues[id]: the ok of the literal id is merged into it
+  bool* continues = calloc(n, sizeof(bool));
+  bool* merged = calloc(n, sizeof(bool));
+  uint8_t* bytes = malloc(n);
+  if (!preds || !continues || !merged || !bytes)
+  {
+    free(preds);
+    free(continues);
+    free(merged);
+    free(bytes);
     return 1;
-  Node* nd = tprec_parse(li);
-  if (!nd)
+  }
+
+  size_t i;
+  preds[re->first_node]++;
+  for (i = 0; i < n; i++)
   {
-    if (li.len)
-      tprec_add_err(
-          errs_out, TkL_get(&li, 0).where, "unparsed tokens");
+    if (re->i[i].ok >= 0)
+      preds[re->i[i].ok]++;
+    if (re->i[i].err >= 0)
+      preds[re->i[i].err]++;
+  }
+  for (i = 0; i < n; i++)
+  {
+    tpre_nodeid_t next = re->i[i].ok;
+    if (next >= 0 &&
+        literal_continues(&re->i[i], &re->i[next], preds[next]))
+    {
+      continues[i] = true;
+      merged[next] = true;
+    }
+  }
+
+  // hash table of string indices, -1 = empty slot. there are at most as many
+  // strings as chains, and at most UINT16_MAX
+  size_t chains = 0;
+  for (i = 0; i < n; i++)
+    if (continues[i] && !merged[i])
+      chains++;
+  size_t cap = 16;
+  while (cap < chains * 2 && cap < (size_t) UINT16_MAX * 2)
+    cap *= 2;
+  int32_t* table = malloc(sizeof(int32_t) * cap);
+  if (!table)
+  {
+    free(preds);
+    free(continues);
+    free(merged);
+    free(bytes);
     return 1;
   }
-  if (verify(nd, errs_out))
+  for (i = 0; i < cap; i++)
+    table[i] = -1;
+
+  for (i = 0; i < n; i++)
+  {
+    // only from the first literal of each chain
+    if (!continues[i] || merged[i])
+      continue;
+
+    uint16_t len = 0;
+    tpre_nodeid_t last = (tpre_nodeid_t) i;
+    bytes[len++] = re->i[last].pat.val;
+    while (continues[last] && len < UINT16_MAX)
+    {
+      last = re->i[last].ok;
+      bytes[len++] = re->i[last].pat.val;
+    }
+
+    size_t slot = string_hash(bytes, len) & (cap - 1);
+    for (; table[slot] >= 0; slot = (slot + 1) & (cap - 1))
+    {
+      tpre_string_t str = re->strings[table[slot]];
+      if (str.len == len && !memcmp(re->string_bytes + str.off, bytes, len))
+        break;
+    }
+    int idx = table[slot];
+    // if there is no room for more strings, the chain is left as it is
+    if (idx < 0 && (idx = tprec_re_addstring(re, bytes, len)) < 0)
+      continue;
+    table[slot] = idx;
+
+    re->i[i].pat = SP(SPECIAL_STRING);
+    re->i[i].pat.arg = (uint16_t) idx;
+    re->i[i].ok = re->i[last].ok;
+  }
+
+  free(preds);
+  free(continues);
+  free(merged);
+  free(bytes);
+  free(table);
+  return 0;
+}
+
+/** builds the dfas that leftmost-longest matching needs from the tree, and
+ * frees it. 0 = ok */
+static int build_dfas(
+    tpre_re_t* out,
+    Node* nd,
+    tpre_errs_t* errs,
+    tpre_opts_t opts)
+{
+  tpre_fsm_t fsm;
+  if (!nd || tprec_node2fsm_dfa(&fsm, nd, errs, opts))
+    return 1;
+
+  out->dfa_forward = calloc(1, sizeof(tpre_dfa_t));
+  out->dfa_reverse = calloc(1, sizeof(tpre_dfa_t));
+  int status = !out->dfa_forward || !out->dfa_reverse;
+  if (!status &&
+      (tpre_fsm2dfa(out->dfa_forward, &fsm, false, false) ||
+       tpre_fsm2dfa(out->dfa_reverse, &fsm, true, opts.end_unanchored)))
+  {
+    tprec_add_err(errs, 0, "regex too complex for a dfa");
     status = 1;
+  }
+  tpre_fsm_free(&fsm);
+  return status;
+}
+
+/** builds the dfas that speed up start unanchored searches from the tree,
+ * and frees it. they are only an optimization, so failing is fine */
+static void build_search_dfas(tpre_re_t* out, Node* nd, tpre_opts_t opts)
+{
+  tpre_fsm_t fsm;
+  if (!nd || tprec_node2fsm_dfa(&fsm, nd, NULL, opts))
+    return;
+
+  out->dfa_search = calloc(1, sizeof(tpre_dfa_t));
+  out->dfa_reverse = calloc(1, sizeof(tpre_dfa_t));
+  // the reverse one is cheaper, and fails first for large alternations
+  if (!out->dfa_search || !out->dfa_reverse ||
+      tpre_fsm2dfa(out->dfa_reverse, &fsm, true, opts.end_unanchored) ||
+      tpre_fsm2dfa(out->dfa_search, &fsm, false, true))
+  {
+    // tpre_fsm2dfa() zeroes the dfa on failure
+    if (out->dfa_search)
+      tpre_dfa_free(*out->dfa_search);
+    free(out->dfa_search);
+    out->dfa_search = NULL;
+    if (out->dfa_reverse)
+      tpre_dfa_free(*out->dfa_reverse);
+    free(out->dfa_reverse);
+    out->dfa_reverse = NULL;
+  }
+  tpre_fsm_free(&fsm);
+}
+
+#ifdef TPREC_DEBUG
+static void tpre_dump(tpre_re_t out)
+{
+  printf("start = %i\n", out.first_node);
+  printf("nd\tok\terr\tv\tbt\tg\n");
+  size_t i;
+  for (i = 0; i < out.num_nodes; i++)
+  {
+    char s[3];
+    tpre_pattern_str(out.i[i].pat, s);
+    printf(
+        "%zu\t%i\t%i\t%s\t%u\t%u\n", i, out.i[i].ok,
+        out.i[i].err, s, out.i[i].backtrack, out.i[i].group);
+  }
+  fflush(stdout);
+}
+#endif
+
+/** the part of compiling after parsing, shared with tpre_compile_literals().
+ * patl is the length of the pattern that weights are for. frees nd */
+static int compile_tree(
+    tpre_re_t* out,
+    Node* nd,
+    tpre_errs_t* errs_out,
+    tpre_opts_t opts,
+    uint64_t const* weights,
+    size_t patl)
+{
+  int status = 0;
+
+  bool captures = !opts.no_captures;
+  Node* backref = find_backref(nd);
+  if (!captures && backref)
+  {
+    tprec_add_err(
+        errs_out, backref->wherePlus1 ? backref->wherePlus1 - 1 : 0,
+        "backreferences can't be used without captures");
+    Node_free(nd);
+    return 1;
+  }
+
+  // the dfas are built from the tree as it was parsed, before the rewrites
+  // below
+  Node* dfa_nd = NULL;
+  if (opts.longest || (opts.start_unanchored && !opts.no_dfa))
+    dfa_nd = Node_clone(nd);
 
   do
   {
-    size_t num_groups = count_groups(nd);
-    size_t num_named_groups = count_named_groups(nd);
+    GroupCount count = { 0 };
+    if (captures && count_groups(nd, &count))
+    {
+      status = 1;
+      break;
+    }
 
-    out->first_named_group = num_groups + 1;
-    out->num_named_groups = num_named_groups;
-    out->named_groups = malloc(sizeof(char*) * num_named_groups);
+    out->first_named_group = count.groups + 1;
+    out->num_named_groups = count.named_groups;
+    out->named_groups = calloc(count.named_groups, sizeof(char*));
+    out->free = true;
     char** named_groups_ptr = out->named_groups;
     if (!named_groups_ptr)
     {
       status = 1;
       break;
     }
-    named_groups(nd, &named_groups_ptr);
+    if (captures && named_groups(nd, &named_groups_ptr))
+    {
+      status = 1;
+      break;
+    }
 
-    tpre_groupid_t nextgr = 1;
-    tpre_groupid_t next_named_gr = out->first_named_group;
-    groups(nd, 0, &nextgr, &next_named_gr);
+    Groups g = { .next_group = 1,
+                 .next_named_group = out->first_named_group,
+                 .captures = captures,
+                 .backrefs = backref != NULL };
+    if (groups(nd, &g) || resolve_backrefs(nd, out, errs_out))
+      status = 1;
   } while (0);
 
-  if (opts.start_unanchored)
-  {
-    Node* any = Node_alloc();
-    any->kind = NodeMatch;
-    any->match = SP(SPECIAL_ANY);
-
-    Node* rep = Node_alloc();
-    rep->kind = NodeLazyRepeatLeast0;
-    rep->repeat = any;
-
-    nd = maybeChain(rep, nd);
-  }
+  // after groups(), so that capture groups are not in the way of finding
+  // the first bytes of the cases
+  if (!status && weights && reorder_cases(nd, weights, patl))
+    status = 1;
 
-  fix_0(nd);
-  fix_1(nd);
-  fix_2(nd);
-  fix_3(nd);
-  if (check_legal(errs_out, nd))
+  if (!status &&
+      (Node_walk(nd, NULL, fix_4, NULL) || Node_walk(nd, NULL, fix_0, NULL) ||
+       Node_walk(nd, NULL, fix_2, NULL) || Node_walk(nd, NULL, fix_3, NULL)))
     status = 1;
 
+#ifdef TPREC_DEBUG
   Node_print(nd, stdout, 0, true);
+#endif
 
   tpre_nodeid_t nd0 = tprec_re_resvnode(out);
   tpre_nodeid_t err = NODE_ERR;
+  if (nd0 < 0)
+    status = 1;
+
+  // the lazy `.*?` of start unanchored regexes, lowered by hand and not as a
+  // run, because the runtime needs to know where matching starts over:
+  // nd0: bt_push(then: body, onbt: step)
+  // step: any(ok: nd0)
+  tpre_nodeid_t body = nd0;
+  if (!status && opts.start_unanchored)
+  {
+    body = tprec_re_resvnode(out);
+    tpre_nodeid_t step = tprec_re_addnode(
+        out, (tpre_re_node_t) { SP(SPECIAL_ANY), nd0, NODE_ERR, 0, 0 });
+    if (body < 0 || step < 0)
+      status = 1;
+    else
+      tprec_re_setnode(
+          out, nd0,
+          (tpre_re_node_t) {
+            SP(SPECIAL_BT_PUSH), /* then: */ body, /* onbt: */ step, 0, 0 });
+  }
 
-  if (!opts.start_unanchored)
+  if (!status && !opts.start_unanchored)
   {
     tpre_nodeid_t anchor = tprec_re_addnode(
         out,
@@ -610,15 +1633,13 @@ int tpre_compile(
           .backtrack = 0,
           .group = 0,
         });
+    if (anchor < 0)
+      status = 1;
     out->first_node = anchor;
   }
 
-  tpre_nodeid_t last;
-  if (opts.end_unanchored)
-  {
-    last = NODE_DONE;
-  }
-  else
+  tpre_nodeid_t last = NODE_DONE;
+  if (!status && !opts.end_unanchored)
   {
     tpre_nodeid_t anchor = tprec_re_addnode(
         out,
@@ -629,12 +1650,31 @@ int tpre_compile(
           .backtrack = 0,
           .group = 0,
         });
+    if (anchor < 0)
+      status = 1;
     last = anchor;
   }
 
-  lower(out, nd0, last, err, 0, NULL, nd);
+  // deduplicating again drops the nodes that were merged into strings
+  if (!status &&
+      (lower(out, body, last, err, nd, errs_out) || dedup_nodes(out) ||
+       merge_strings(out) || dedup_nodes(out)))
+    status = 1;
 
+  if (!status && opts.longest)
+  {
+    out->longest = true;
+    if (build_dfas(out, dfa_nd, errs_out, opts))
+      status = 1;
+  }
+  else if (!status && opts.start_unanchored && !opts.no_dfa)
+    build_search_dfas(out, dfa_nd, opts);
+  else
+    Node_free(dfa_nd);
+
+#ifdef TPREC_DEBUG
   tpre_dump(*out);
+#endif
 
   Node_free(nd);
 
@@ -646,6 +1686,87 @@ int tpre_compile(
   return status;
 }
 
+int tpre_compile(
+    tpre_re_t* out,
+    char const* str,
+    tpre_errs_t* errs_out,
+    tpre_opts_t opts)
+{
+  return tpre_compile_weighted(out, str, errs_out, opts, NULL);
+}
+
+int tpre_compile_weighted(
+    tpre_re_t* out,
+    char const* str,
+    tpre_errs_t* errs_out,
+    tpre_opts_t opts,
+    uint64_t const* weights)
+{
+  memset(out, 0, sizeof(tpre_re_t));
+
+  if (errs_out)
+  {
+    errs_out->len = 0;
+    errs_out->items = NULL;
+  }
+
+  TkL li = { 0 };
+  if (tprec_lexe(&li, errs_out, str, &opts))
+    return 1;
+  if (li.oom)
+    return 1;
+  // tprec_parse() frees the tokens
+  bool has_tokens = li.len != 0;
+  size_t first_where = has_tokens ? TkL_get(&li, 0).where : 0;
+  Node* nd = tprec_parse(li);
+  // the empty regex matches the empty string
+  if (!nd && !has_tokens)
+    nd = emptyNode();
+  if (!nd)
+  {
+    if (has_tokens)
+      tprec_add_err(errs_out, first_where, "unparsed tokens");
+    return 1;
+  }
+  if (verify(nd, errs_out))
+  {
+    Node_free(nd);
+    return 1;
+  }
+
+  return compile_tree(out, nd, errs_out, opts, weights, strlen(str));
+}
+
+int tpre_compile_literals(
+    tpre_re_t* out,
+    char const* const* words,
+    size_t num,
+    tpre_errs_t* errs_out,
+    tpre_opts_t opts)
+{
+  memset(out, 0, sizeof(tpre_re_t));
+
+  if (errs_out)
+  {
+    errs_out->len = 0;
+    errs_out->items = NULL;
+  }
+
+  if (!num)
+  {
+    tprec_add_err(errs_out, 0, "no words");
+    return 1;
+  }
+
+  // unless the match has to go to the end, or is the longest one anyway, it
+  // stops at the first word that ends
+  bool first_only = opts.end_unanchored && !opts.longest;
+  Node* nd = tprec_literals(words, num, first_only);
+  if (!nd)
+    return 1;
+  return compile_tree(out, nd, errs_out, opts, NULL, 0);
+}
+
 void tpre_free(tpre_re_t re)
 {
   if (re.free)
@@ -654,8 +1775,20 @@ void tpre_free(tpre_re_t re)
       free(re.named_groups[i]);
     free(re.named_groups);
     free(re.i);
+    free(re.classes);
+    free(re.loops);
+    free(re.runs);
+    free(re.strings);
+    free(re.string_bytes);
+    free(re.wherePlus1);
+    if (re.dfa_forward)
+      tpre_dfa_free(*re.dfa_forward);
+    free(re.dfa_forward);
+    if (re.dfa_reverse)
+      tpre_dfa_free(*re.dfa_reverse);
+    free(re.dfa_reverse);
+    if (re.dfa_search)
+      tpre_dfa_free(*re.dfa_search);
+    free(re.dfa_search);
   }
 }
-
-// TODO: this will break the enine: a*?b|ac
-// TODO: this will break the engine (ab)*|(ac)*
@@ -0,0 +1,620 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../shared.h"
+#include "tpre_compiler.h"
+
+#define USING_TPREC
+#include "utils.h"
+
+/*
+ * subset construction. apart from the zero width START, END and EMPTY cases,
+ * every case of the fsm consumes one byte, so a dfa state is the set of fsm
+ * nodes that are active at some position, closed over the zero width cases
+ * that hold there.
+ *
+ * the order of the cases is lost, so a dfa can tell where matches end (or
+ * begin, if reversed), but not which of them the backtracking runtime would
+ * pick.
+ */
+
+// fsm nodes in all states together. building a state costs about as much
+// as it has nodes, so this keeps patterns with many thousand cases, whose
+// states are huge sets, from taking long to fail
+#ifndef TPRE_DFA_MAX_ITEMS
+# define TPRE_DFA_MAX_ITEMS (1 << 20)
+#endif
+
+// edges looked at while building, for fsms with few states but many edges
+#ifndef TPRE_DFA_MAX_WORK
+# define TPRE_DFA_MAX_WORK (1 << 26)
+#endif
+
+// zero width cases, in the direction the dfa reads the input
+#define ZW_EMPTY (1)
+// START forwards, END reversed
+#define ZW_BEGIN (2)
+// END forwards, START reversed
+#define ZW_FINISH (4)
+
+typedef struct
+{
+  uint32_t to;
+  // 0 if the edge consumes a byte
+  uint8_t zero_width;
+  tpre_class_t bits;
+} Edge;
+
+// sorted list of fsm node indices
+typedef struct
+{
+  uint32_t len;
+  uint32_t off;
+} Set;
+
+typedef struct
+{
+  size_t n;
+  uint32_t init, final;
+
+  // edges leaving node i are edges[edge_off[i] .. edge_off[i + 1]]
+  size_t* edge_off;
+  Edge* edges;
+
+  // node indices of all sets
+  uint32_t* items;
+  size_t items_len, items_cap;
+
+  Set* states;
+  size_t num_states;
+
+  // hash table of state ids, 0 = empty slot
+  uint16_t* table;
+  size_t table_cap;
+
+  // scratch, indexed by node
+  uint32_t* stamp;
+  uint32_t cur_stamp;
+  uint32_t* stack;
+  uint32_t* buf;
+
+  // closure of init, that gets added to every state if unanchored
+  uint32_t* inject;
+  size_t inject_len;
+
+  // edges looked at so far, see TPRE_DFA_MAX_WORK
+  size_t work;
+  bool oom;
+} Builder;
+
+static size_t fsm_idx(tpre_fsm_node_t const* nd)
+{
+  return nd->_idx;
+}
+
+/** 0 = ok */
+static int collect_edges(Builder* b, tpre_fsm_t const* fsm, bool reverse)
+{
+  size_t n = b->n;
+  size_t i, k;
+
+  size_t num = 0;
+  for (i = 0; i < n; i++)
+  {
+    tpre_fsm_node_t const* nd = fsm->_nodes.items[i];
+    if (nd->els && nd->els != fsm->nd_err)
+      return 1;
+    num += nd->cases.len;
+  }
+
+  size_t* count = calloc(n + 1, sizeof(size_t));
+  b->edge_off = calloc(n + 1, sizeof(size_t));
+  b->edges = malloc(sizeof(Edge) * (num ? num : 1));
+  if (!count || !b->edge_off || !b->edges)
+  {
+    free(count);
+    b->oom = true;
+    return 1;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    tpre_fsm_node_t const* nd = fsm->_nodes.items[i];
+    for (k = 0; k < nd->cases.len; k++)
+      count[reverse ? fsm_idx(nd->cases.items[k].then) : i]++;
+  }
+  for (i = 0; i < n; i++)
+    b->edge_off[i + 1] = b->edge_off[i] + count[i];
+  memset(count, 0, sizeof(size_t) * n);
+
+  int status = 0;
+  for (i = 0; i < n && !status; i++)
+  {
+    tpre_fsm_node_t const* nd = fsm->_nodes.items[i];
+    for (k = 0; k < nd->cases.len; k++)
+    {
+      tpre_fsm_case_t const* c = &nd->cases.items[k];
+      size_t to = fsm_idx(c->then);
+      size_t from = i;
+      if (reverse)
+      {
+        from = to;
+        to = i;
+      }
+
+      Edge e = { .to = (uint32_t) to };
+      switch (c->pat.kind)
+      {
+        case TPRE_FSM_PAT_EMPTY: e.zero_width = ZW_EMPTY; break;
+        case TPRE_FSM_PAT_START:
+          e.zero_width = reverse ? ZW_FINISH : ZW_BEGIN;
+          break;
+        case TPRE_FSM_PAT_END:
+          e.zero_width = reverse ? ZW_BEGIN : ZW_FINISH;
+          break;
+
+        default:
+          // the utf8 patterns look ahead
+          if (!tpre_fsm_pat_bits(&c->pat, &e.bits))
+            status = 1;
+          break;
+      }
+      b->edges[b->edge_off[from] + count[from]++] = e;
+    }
+  }
+
+  free(count);
+  return status;
+}
+
+/** splits the bytes into classes that no edge tells apart */
+static uint16_t byte_classes(Builder const* b, uint8_t classes[256])
+{
+  memset(classes, 0, 256);
+  uint16_t num = 1;
+  size_t total = b->edge_off[b->n];
+  for (size_t i = 0; i < total; i++)
+  {
+    Edge const* e = &b->edges[i];
+    if (e->zero_width)
+      continue;
+
+    uint16_t in[256] = { 0 };
+    uint16_t size[256] = { 0 };
+    unsigned c;
+    for (c = 0; c < 256; c++)
+    {
+      size[classes[c]]++;
+      if (tprec_class_has(&e->bits, (uint8_t) c))
+        in[classes[c]]++;
+    }
+
+    // the bytes of a class that are only partly in the edge get a new class
+    int16_t split[256];
+    uint16_t old_num = num;
+    for (c = 0; c < old_num; c++)
+      split[c] = in[c] && in[c] < size[c] ? (int16_t) num++ : -1;
+    for (c = 0; c < 256; c++)
+      if (split[classes[c]] >= 0 && tprec_class_has(&e->bits, (uint8_t) c))
+        classes[c] = (uint8_t) split[classes[c]];
+  }
+  return num;
+}
+
+/** adds everything reachable from the nodes in buf[0..len) with the given
+ * zero width cases to buf, returns the new length */
+static size_t closure(Builder* b, size_t len, uint8_t zero_width)
+{
+  size_t sp = 0;
+  for (size_t i = 0; i < len; i++)
+    b->stack[sp++] = b->buf[i];
+
+  while (sp)
+  {
+    uint32_t cur = b->stack[--sp];
+    b->work += b->edge_off[cur + 1] - b->edge_off[cur];
+    for (size_t k = b->edge_off[cur]; k < b->edge_off[cur + 1]; k++)
+    {
+      Edge const* e = &b->edges[k];
+      if (!(e->zero_width & zero_width) || b->stamp[e->to] == b->cur_stamp)
+        continue;
+      b->stamp[e->to] = b->cur_stamp;
+      b->buf[len++] = e->to;
+      b->stack[sp++] = e->to;
+    }
+  }
+  return len;
+}
+
+static int cmp_u32(void const* a, void const* b)
+{
+  uint32_t x = *(uint32_t const*) a;
+  uint32_t y = *(uint32_t const*) b;
+  return x < y ? -1 : x > y;
+}
+
+static size_t set_hash(uint32_t const* items, size_t len)
+{
+  size_t h = len;
+  for (size_t i = 0; i < len; i++)
+    h = h * 31 + items[i];
+  return h ^ (h >> 16);
+}
+
+static bool set_has(Builder const* b, Set s, uint32_t node)
+{
+  return bsearch(&node, b->items + s.off, s.len, sizeof(uint32_t), cmp_u32) !=
+      NULL;
+}
+
+/** state for the nodes in buf[0..len), which are sorted and unique. added if
+ * there is none yet. 0 on failure */
+static uint16_t intern(Builder* b, size_t len, bool lookup)
+{
+  size_t slot = set_hash(b->buf, len) & (b->table_cap - 1);
+  if (lookup)
+  {
+    for (; b->table[slot]; slot = (slot + 1) & (b->table_cap - 1))
+    {
+      Set s = b->states[b->table[slot]];
+      if (s.len == len &&
+          !memcmp(b->items + s.off, b->buf, sizeof(uint32_t) * len))
+        return b->table[slot];
+    }
+  }
+
+  if (b->num_states >= TPRE_DFA_MAX_STATES ||
+      b->items_len + len > TPRE_DFA_MAX_ITEMS)
+    return 0;
+
+  if (b->items_len + len > b->items_cap)
+  {
+    size_t cap = b->items_cap ? b->items_cap : 64;
+    while (cap < b->items_len + len)
+      cap *= 2;
+    uint32_t* items = realloc(b->items, sizeof(uint32_t) * cap);
+    if (!items)
+    {
+      b->oom = true;
+      return 0;
+    }
+    b->items = items;
+    b->items_cap = cap;
+  }
+  memcpy(b->items + b->items_len, b->buf, sizeof(uint32_t) * len);
+
+  uint16_t id = (uint16_t) b->num_states++;
+  b->states[id] = (Set) { .len = (uint32_t) len,
+                          .off = (uint32_t) b->items_len };
+  b->items_len += len;
+
+  if (lookup)
+  {
+    for (slot = set_hash(b->buf, len) & (b->table_cap - 1); b->table[slot];
+         slot = (slot + 1) & (b->table_cap - 1))
+      ;
+    b->table[slot] = id;
+  }
+  return id;
+}
+
+/** closes buf[0..len) over the zero width cases, adds the injected nodes, and
+ * returns the state. 0 on failure, or if the set is empty */
+static uint16_t make_state(Builder* b, size_t len, uint8_t zero_width, bool lookup)
+{
+  len = closure(b, len, zero_width);
+  for (size_t i = 0; i < b->inject_len; i++)
+  {
+    if (b->stamp[b->inject[i]] == b->cur_stamp)
+      continue;
+    b->stamp[b->inject[i]] = b->cur_stamp;
+    b->buf[len++] = b->inject[i];
+  }
+  if (len == 0)
+    return 0;
+  qsort(b->buf, len, sizeof(uint32_t), cmp_u32);
+  return intern(b, len, lookup);
+}
+
+static uint8_t state_accept(Builder* b, uint16_t id, uint8_t zero_width)
+{
+  Set s = b->states[id];
+  uint8_t flags = 0;
+  if (set_has(b, s, b->final))
+    flags |= TPRE_DFA_ACCEPT | TPRE_DFA_ACCEPT_AT_END;
+  else
+  {
+    b->cur_stamp++;
+    for (size_t i = 0; i < s.len; i++)
+    {
+      b->buf[i] = b->items[s.off + i];
+      b->stamp[b->buf[i]] = b->cur_stamp;
+    }
+    size_t len = closure(b, s.len, zero_width | ZW_FINISH);
+    for (size_t i = 0; i < len; i++)
+      if (b->buf[i] == b->final)
+        flags |= TPRE_DFA_ACCEPT_AT_END;
+  }
+  return flags;
+}
+
+/** longest path from init to final, in consumed bytes. UINT32_MAX if there
+ * is a loop */
+static uint32_t max_len(Builder* b)
+{
+  enum { WHITE, GREY, BLACK };
+  uint8_t* color = calloc(b->n, 1);
+  size_t* cursor = calloc(b->n, sizeof(size_t));
+  // longest path from the node to final, or -1 if final can't be reached
+  int64_t* len = malloc(sizeof(int64_t) * b->n);
+  if (!color || !cursor || !len)
+  {
+    b->oom = true;
+    free(color);
+    free(cursor);
+    free(len);
+    return UINT32_MAX;
+  }
+
+  bool loop = false;
+  size_t sp = 0;
+  b->stack[sp++] = b->init;
+  color[b->init] = GREY;
+  cursor[b->init] = b->edge_off[b->init];
+  len[b->init] = b->init == b->final ? 0 : -1;
+  while (sp && !loop)
+  {
+    uint32_t cur = b->stack[sp - 1];
+    if (cursor[cur] == b->edge_off[cur + 1])
+    {
+      color[cur] = BLACK;
+      sp--;
+      if (sp)
+      {
+        uint32_t parent = b->stack[sp - 1];
+        Edge const* e = &b->edges[cursor[parent] - 1];
+        if (len[cur] >= 0 && len[cur] + !e->zero_width > len[parent])
+          len[parent] = len[cur] + !e->zero_width;
+      }
+      continue;
+    }
+
+    Edge const* e = &b->edges[cursor[cur]++];
+    if (color[e->to] == GREY)
+      loop = true;
+    else if (color[e->to] == BLACK)
+    {
+      if (len[e->to] >= 0 && len[e->to] + !e->zero_width > len[cur])
+        len[cur] = len[e->to] + !e->zero_width;
+    }
+    else
+    {
+      color[e->to] = GREY;
+      cursor[e->to] = b->edge_off[e->to];
+      len[e->to] = e->to == b->final ? 0 : -1;
+      b->stack[sp++] = e->to;
+    }
+  }
+
+  uint32_t result = UINT32_MAX;
+  if (!loop && len[b->init] >= 0 && len[b->init] < UINT32_MAX)
+    result = (uint32_t) len[b->init];
+  free(color);
+  free(cursor);
+  free(len);
+  return result;
+}
+
+static void builder_free(Builder* b)
+{
+  free(b->edge_off);
+  free(b->edges);
+  free(b->items);
+  free(b->states);
+  free(b->table);
+  free(b->stamp);
+  free(b->stack);
+  free(b->buf);
+  free(b->inject);
+}
+
+/** see [tpre_dfa_t.skip_state]. only start_mid is tried, because that is
+ * where unanchored searches wait for a match to begin */
+static void find_skip(tpre_dfa_t* dfa)
+{
+  uint16_t s = dfa->start_mid;
+  if (!s || dfa->accept[s])
+    return;
+  int leave = -1;
+  for (unsigned c = 0; c < 256; c++)
+  {
+    if (dfa->next[s * dfa->num_classes + dfa->classes[c]] == s)
+      continue;
+    if (leave >= 0)
+      return;
+    leave = (int) c;
+  }
+  if (leave < 0)
+    return;
+  dfa->skip_state = s;
+  dfa->skip_byte = (uint8_t) leave;
+}
+
+void tpre_dfa_free(tpre_dfa_t dfa)
+{
+  free(dfa.next);
+  free(dfa.accept);
+}
+
+int tpre_fsm2dfa(
+    tpre_dfa_t* out, tpre_fsm_t const* fsm, bool reverse, bool unanchored)
+{
+  memset(out, 0, sizeof(tpre_dfa_t));
+  if (!fsm->first || !fsm->nd_ok)
+    return 1;
+
+  Builder b = { 0 };
+  b.n = fsm->_nodes.len;
+  for (size_t i = 0; i < b.n; i++)
+    fsm->_nodes.items[i]->_idx = i;
+  b.init = (uint32_t) fsm_idx(reverse ? fsm->nd_ok : fsm->first);
+  b.final = (uint32_t) fsm_idx(reverse ? fsm->first : fsm->nd_ok);
+
+  if (collect_edges(&b, fsm, reverse) ||
+      b.edge_off[b.n] > TPRE_DFA_MAX_WORK / 256)
+  {
+    builder_free(&b);
+    return 1;
+  }
+
+  b.table_cap = 16;
+  while (b.table_cap < TPRE_DFA_MAX_STATES * 2)
+    b.table_cap *= 2;
+  b.table = calloc(b.table_cap, sizeof(uint16_t));
+  b.states = malloc(sizeof(Set) * TPRE_DFA_MAX_STATES);
+  b.stamp = calloc(b.n, sizeof(uint32_t));
+  b.stack = malloc(sizeof(uint32_t) * (b.n + 1));
+  b.buf = malloc(sizeof(uint32_t) * (b.n + 1));
+  b.inject = malloc(sizeof(uint32_t) * (b.n + 1));
+  if (!b.table || !b.states || !b.stamp || !b.stack || !b.buf || !b.inject)
+  {
+    builder_free(&b);
+    return 1;
+  }
+
+  // byte_classes() looks at every byte of every edge
+  b.work = b.edge_off[b.n] * 256;
+  out->num_classes = byte_classes(&b, out->classes);
+  out->max_len = max_len(&b);
+
+  // dead state
+  b.num_states = 1;
+  b.states[0] = (Set) { 0 };
+
+  // nodes that are active at every position
+  if (unanchored)
+  {
+    b.cur_stamp++;
+    b.buf[0] = b.init;
+    b.stamp[b.init] = b.cur_stamp;
+    b.inject_len = closure(&b, 1, ZW_EMPTY);
+    memcpy(b.inject, b.buf, sizeof(uint32_t) * b.inject_len);
+  }
+
+  // not looked up in the table, because only it has the BEGIN cases
+  b.cur_stamp++;
+  b.buf[0] = b.init;
+  b.stamp[b.init] = b.cur_stamp;
+  out->start = make_state(&b, 1, ZW_EMPTY | ZW_BEGIN, false);
+
+  b.cur_stamp++;
+  b.buf[0] = b.init;
+  b.stamp[b.init] = b.cur_stamp;
+  out->start_mid = make_state(&b, 1, ZW_EMPTY, true);
+
+  int status = b.oom || !out->start;
+
+  // one representative byte per class
+  uint8_t rep[256];
+  bool seen[256] = { 0 };
+  for (unsigned c = 0; c < 256; c++)
+  {
+    if (!seen[out->classes[c]])
+      rep[out->classes[c]] = (uint8_t) c;
+    seen[out->classes[c]] = true;
+  }
+
+  size_t cap = 64;
+  out->next = malloc(sizeof(uint16_t) * cap * out->num_classes);
+  if (!out->next)
+    status = 1;
+
+  // the table only grows while this runs, so new states are processed too
+  for (size_t s = 0; !status && s < b.num_states; s++)
+  {
+    if (b.num_states > cap)
+    {
+      while (cap < b.num_states)
+        cap *= 2;
+      uint16_t* next =
+          realloc(out->next, sizeof(uint16_t) * cap * out->num_classes);
+      if (!next)
+      {
+        status = 1;
+        break;
+      }
+      out->next = next;
+    }
+
+    for (uint16_t c = 0; c < out->num_classes; c++)
+    {
+      Set set = b.states[s];
+      b.cur_stamp++;
+      size_t len = 0;
+      for (size_t i = 0; i < set.len; i++)
+      {
+        uint32_t nd = b.items[set.off + i];
+        b.work += b.edge_off[nd + 1] - b.edge_off[nd];
+        for (size_t k = b.edge_off[nd]; k < b.edge_off[nd + 1]; k++)
+        {
+          Edge const* e = &b.edges[k];
+          if (e->zero_width || !tprec_class_has(&e->bits, rep[c]) ||
+              b.stamp[e->to] == b.cur_stamp)
+            continue;
+          b.stamp[e->to] = b.cur_stamp;
+          b.buf[len++] = e->to;
+        }
+      }
+
+      if (b.work > TPRE_DFA_MAX_WORK)
+      {
+        status = 1;
+        break;
+      }
+
+      uint16_t to = 0;
+      if (len || b.inject_len)
+      {
+        to = make_state(&b, len, ZW_EMPTY, true);
+        if (!to)
+        {
+          // too many states
+          status = 1;
+          break;
+        }
+      }
+      out->next[s * out->num_classes + c] = to;
+    }
+  }
+
+  if (!status)
+  {
+    out->num_states = (uint16_t) b.num_states;
+    out->accept = calloc(b.num_states, 1);
+    if (!out->accept)
+      status = 1;
+    for (size_t s = 1; !status && s < b.num_states; s++)
+      out->accept[s] = state_accept(
+          &b, (uint16_t) s, s == out->start ? ZW_EMPTY | ZW_BEGIN : ZW_EMPTY);
+  }
+
+  if (!status && !out->accept[out->start_mid])
+  {
+    // nothing can be matched from the middle of the input, like with `^a`
+    bool dead = true;
+    for (uint16_t c = 0; c < out->num_classes; c++)
+      if (out->next[out->start_mid * out->num_classes + c])
+        dead = false;
+    if (dead)
+      out->start_mid = 0;
+  }
+  if (!status)
+    find_skip(out);
+
+  builder_free(&b);
+  if (status)
+  {
+    tpre_dfa_free(*out);
+    memset(out, 0, sizeof(tpre_dfa_t));
+  }
+  return status;
+}
@@ -6,23 +6,192 @@ void tpre_fsm_pat_free(tpre_fsm_pat_t pat)
 {
   switch (pat.kind)
   {
-    case TPRE_FSM_PAT_ONEOF: free(pat.v.ascii.items); break;
-    default:                 break;
+    case TPRE_FSM_PAT_ONEOF:
+    case TPRE_FSM_PAT_ANY_ASCII_EXCEPT: free(pat.v.ascii.items); break;
+    default:                            break;
   }
 }
 
+bool tpre_fsm_pat_bits(tpre_fsm_pat_t const* pat, tpre_class_t* out)
+{
+  bool except;
+  switch (pat->kind)
+  {
+    case TPRE_FSM_PAT_ONEOF:            except = false; break;
+    case TPRE_FSM_PAT_ANY_ASCII_EXCEPT: except = true; break;
+    default:                            return false;
+  }
+
+  memset(out->bits, except ? 0xFF : 0, sizeof(out->bits));
+  for (size_t i = 0; i < pat->v.ascii.len; i++)
+  {
+    uint8_t c = pat->v.ascii.items[i];
+    if (except)
+      out->bits[c >> 3] &= (uint8_t) ~(1 << (c & 7));
+    else
+      out->bits[c >> 3] |= (uint8_t) (1 << (c & 7));
+  }
+  return true;
+}
+
+int tpre_fsm_pat_from_bits(tpre_fsm_pat_t* out, tpre_class_t const* bits)
+{
+  size_t count = 0;
+  unsigned c;
+  for (c = 0; c < 256; c++)
+    count += (bits->bits[c >> 3] >> (c & 7)) & 1;
+
+  bool except = count > 128;
+  out->kind =
+      except ? TPRE_FSM_PAT_ANY_ASCII_EXCEPT : TPRE_FSM_PAT_ONEOF;
+  out->v.ascii.len = 0;
+  out->v.ascii.items = malloc(except ? 256 - count : count);
+  if (!out->v.ascii.items && (except ? 256 - count : count))
+    return 1;
+
+  for (c = 0; c < 256; c++)
+    if ((bool) ((bits->bits[c >> 3] >> (c & 7)) & 1) != except)
+      out->v.ascii.items[out->v.ascii.len++] = (uint8_t) c;
+  return 0;
+}
+
+static bool pat_consumes(tpre_fsm_pat_t const* pat)
+{
+  switch (pat->kind)
+  {
+    case TPRE_FSM_PAT_START:
+    case TPRE_FSM_PAT_END:
+    case TPRE_FSM_PAT_EMPTY: return false;
+
+    default: return true;
+  }
+}
+
+static bool pat_eq(tpre_fsm_pat_t const* a, tpre_fsm_pat_t const* b)
+{
+  if (a->kind != b->kind)
+    return false;
+  switch (a->kind)
+  {
+    case TPRE_FSM_PAT_ONEOF:
+    case TPRE_FSM_PAT_ANY_ASCII_EXCEPT:
+      return a->v.ascii.len == b->v.ascii.len &&
+          !memcmp(a->v.ascii.items, b->v.ascii.items, a->v.ascii.len);
+
+    default: return true;
+  }
+}
+
+static size_t pat_hash(tpre_fsm_pat_t const* pat)
+{
+  size_t h = pat->kind;
+  switch (pat->kind)
+  {
+    case TPRE_FSM_PAT_ONEOF:
+    case TPRE_FSM_PAT_ANY_ASCII_EXCEPT:
+      for (size_t i = 0; i < pat->v.ascii.len; i++)
+        h = h * 31 + pat->v.ascii.items[i];
+      break;
+
+    default: break;
+  }
+  return h;
+}
+
+static void node_free(tpre_fsm_node_t* nd)
+{
+  for (size_t i = 0; i < nd->cases.len; i++)
+    tpre_fsm_pat_free(nd->cases.items[i].pat);
+  free(nd->cases.items);
+  free(nd);
+}
+
+static int register_node(tpre_fsm_t* fsm, tpre_fsm_node_t* nd)
+{
+  if (fsm->_nodes.len == fsm->_nodes.cap)
+  {
+    size_t cap = fsm->_nodes.cap ? fsm->_nodes.cap * 2 : 16;
+    void* items =
+        realloc(fsm->_nodes.items, sizeof(tpre_fsm_node_t*) * cap);
+    if (!items)
+      return 1;
+    fsm->_nodes.items = items;
+    fsm->_nodes.cap = cap;
+  }
+  fsm->_nodes.items[fsm->_nodes.len++] = nd;
+  return 0;
+}
+
+/** sets _gc_flag on all reachable nodes. 0 = ok */
+static int mark(tpre_fsm_t* fsm)
+{
+  size_t i;
+  for (i = 0; i < fsm->_nodes.len; i++)
+    fsm->_nodes.items[i]->_gc_flag = false;
+
+  // every node gets pushed at most once
+  tpre_fsm_node_t** stack =
+      malloc(sizeof(tpre_fsm_node_t*) * (fsm->_nodes.len + 1));
+  if (!stack)
+    return 1;
+  size_t sp = 0;
+
+  tpre_fsm_node_t* roots[3] = { fsm->first, fsm->nd_ok, fsm->nd_err };
+  for (i = 0; i < 3; i++)
+  {
+    if (roots[i] && !roots[i]->_gc_flag)
+    {
+      roots[i]->_gc_flag = true;
+      stack[sp++] = roots[i];
+    }
+  }
+
+  while (sp)
+  {
+    tpre_fsm_node_t* nd = stack[--sp];
+    for (i = 0; i <= nd->cases.len; i++)
+    {
+      tpre_fsm_node_t* next =
+          i < nd->cases.len ? nd->cases.items[i].then : nd->els;
+      if (next && !next->_gc_flag)
+      {
+        next->_gc_flag = true;
+        stack[sp++] = next;
+      }
+    }
+  }
+
+  free(stack);
+  return 0;
+}
+
 void tpre_fsm_gc(tpre_fsm_t* fsm)
 {
-  // TODO
+  if (mark(fsm))
+    return;
+
+  size_t keep = 0;
+  for (size_t i = 0; i < fsm->_nodes.len; i++)
+  {
+    tpre_fsm_node_t* nd = fsm->_nodes.items[i];
+    if (nd->_gc_flag)
+      fsm->_nodes.items[keep++] = nd;
+    else
+      node_free(nd);
+  }
+  fsm->_nodes.len = keep;
 }
 
 void tpre_fsm_free(tpre_fsm_t* fsm)
 {
-  // TODO
+  for (size_t i = 0; i < fsm->_nodes.len; i++)
+    node_free(fsm->_nodes.items[i]);
+  free(fsm->_nodes.items);
 
   for (size_t i = 0; i < (size_t) fsm->num_named_groups; i++)
     free((char*) fsm->named_groups[i]);
   free(fsm->named_groups);
+  memset(fsm, 0, sizeof(tpre_fsm_t));
 }
 
 tpre_fsm_node_t* tpre_fsm_mknd(tpre_fsm_t* fsm)
@@ -31,12 +200,489 @@ tpre_fsm_node_t* tpre_fsm_mknd(tpre_fsm_t* fsm)
   if (!out)
     return 0;
   out->els = fsm->nd_err;
+  if (register_node(fsm, out))
+  {
+    free(out);
+    return 0;
+  }
   return out;
 }
 
+int tpre_fsm_addcase(tpre_fsm_node_t* node, tpre_fsm_case_t cas)
+{
+  void* items = realloc(
+      node->cases.items, sizeof(tpre_fsm_case_t) * (node->cases.len + 1));
+  if (!items)
+  {
+    tpre_fsm_pat_free(cas.pat);
+    return 1;
+  }
+  node->cases.items = items;
+  node->cases.items[node->cases.len++] = cas;
+  return 0;
+}
+
 void tpre_fsm_init(tpre_fsm_t* fsm)
 {
   memset(fsm, 0, sizeof(tpre_fsm_t));
-  fsm->nd_err = calloc(1, sizeof(tpre_fsm_node_t));
-  fsm->nd_ok = calloc(1, sizeof(tpre_fsm_node_t));
+  fsm->nd_err = tpre_fsm_mknd(fsm);
+  fsm->nd_ok = tpre_fsm_mknd(fsm);
+  if (fsm->nd_ok)
+    fsm->nd_ok->els = 0;
+}
+
+typedef struct
+{
+  tpre_fsm_t const* fsm;
+  size_t const* part;
+} partition_t;
+
+static size_t node_hash(partition_t const* p, size_t i)
+{
+  tpre_fsm_node_t const* nd = p->fsm->_nodes.items[i];
+  size_t h = p->part[i];
+  h = h * 31 + (nd == p->fsm->nd_ok) * 2 + (nd == p->fsm->nd_err);
+  h = h * 31 + nd->backtrack.known;
+  h = h * 31 + nd->backtrack.by;
+  h = h * 31 + nd->cases.len;
+  for (size_t k = 0; k < nd->cases.len; k++)
+  {
+    tpre_fsm_case_t const* c = &nd->cases.items[k];
+    h = h * 31 + pat_hash(&c->pat);
+    h = h * 31 + c->group;
+    h = h * 31 + (c->then ? p->part[c->then->_idx] : (size_t) -1);
+  }
+  h = h * 31 + (nd->els ? p->part[nd->els->_idx] : (size_t) -1);
+  return h ^ (h >> 17);
+}
+
+static bool node_eq(partition_t const* p, size_t i, size_t j)
+{
+  tpre_fsm_node_t const* a = p->fsm->_nodes.items[i];
+  tpre_fsm_node_t const* b = p->fsm->_nodes.items[j];
+  if (p->part[i] != p->part[j])
+    return false;
+  if (a == p->fsm->nd_ok || a == p->fsm->nd_err || b == p->fsm->nd_ok ||
+      b == p->fsm->nd_err)
+    return a == b;
+  if (a->backtrack.known != b->backtrack.known ||
+      a->backtrack.by != b->backtrack.by ||
+      a->cases.len != b->cases.len)
+    return false;
+  for (size_t k = 0; k < a->cases.len; k++)
+  {
+    tpre_fsm_case_t const* ca = &a->cases.items[k];
+    tpre_fsm_case_t const* cb = &b->cases.items[k];
+    if (ca->group != cb->group || !pat_eq(&ca->pat, &cb->pat))
+      return false;
+    size_t ta = ca->then ? p->part[ca->then->_idx] : (size_t) -1;
+    size_t tb = cb->then ? p->part[cb->then->_idx] : (size_t) -1;
+    if (ta != tb)
+      return false;
+  }
+  size_t ea = a->els ? p->part[a->els->_idx] : (size_t) -1;
+  size_t eb = b->els ? p->part[b->els->_idx] : (size_t) -1;
+  return ea == eb;
+}
+
+/** an edge into a node: case index, or NO_CASE for the else edge */
+typedef struct
+{
+  size_t label;
+  size_t from;
+} in_edge_t;
+
+#define NO_CASE ((size_t) -1)
+
+static int in_edge_cmp(void const* pa, void const* pb)
+{
+  in_edge_t const* a = pa;
+  in_edge_t const* b = pb;
+  return (a->label > b->label) - (a->label < b->label);
+}
+
+/** the blocks of the partition. the nodes of block b are
+ * elems[first[b] .. end[b]), and the ones marked while splitting are at
+ * elems[first[b] .. mid[b]) */
+typedef struct
+{
+  size_t* part;
+  size_t* elems;
+  size_t* loc;
+  size_t* first;
+  size_t* mid;
+  size_t* end;
+  bool* queued;
+  size_t* work;
+  size_t num_work;
+  size_t num;
+} blocks_t;
+
+static void blocks_free(blocks_t* b)
+{
+  free(b->elems);
+  free(b->loc);
+  free(b->first);
+  free(b->mid);
+  free(b->end);
+  free(b->queued);
+  free(b->work);
+}
+
+static void queue_block(blocks_t* b, size_t blk)
+{
+  b->queued[blk] = true;
+  b->work[b->num_work++] = blk;
+}
+
+static void mark_node(blocks_t* b, size_t nd, size_t* touched, size_t* num)
+{
+  size_t blk = b->part[nd];
+  if (b->mid[blk] == b->first[blk])
+    touched[(*num)++] = blk;
+  size_t pos = b->loc[nd];
+  size_t other = b->elems[b->mid[blk]];
+  b->elems[pos] = other;
+  b->loc[other] = pos;
+  b->elems[b->mid[blk]] = nd;
+  b->loc[nd] = b->mid[blk];
+  b->mid[blk]++;
+}
+
+/** split the marked nodes off of every touched block */
+static void split_marked(blocks_t* b, size_t const* touched, size_t num)
+{
+  for (size_t t = 0; t < num; t++)
+  {
+    size_t blk = touched[t];
+    if (b->mid[blk] == b->end[blk])
+    {
+      b->mid[blk] = b->first[blk];
+      continue;
+    }
+
+    size_t nb = b->num++;
+    b->first[nb] = b->first[blk];
+    b->end[nb] = b->mid[blk];
+    b->mid[nb] = b->first[nb];
+    b->first[blk] = b->mid[blk];
+    for (size_t k = b->first[nb]; k < b->end[nb]; k++)
+      b->part[b->elems[k]] = nb;
+
+    // a block that is still queued gets split by both halves anyways,
+    // otherwise the smaller half is enough
+    if (b->queued[blk])
+      queue_block(b, nb);
+    else if (b->end[nb] - b->first[nb] < b->end[blk] - b->first[blk])
+      queue_block(b, nb);
+    else
+      queue_block(b, blk);
+  }
+}
+
+int tpre_fsm_minimize(tpre_fsm_t* fsm)
+{
+  tpre_fsm_gc(fsm);
+
+  size_t n = fsm->_nodes.len;
+  if (n == 0)
+    return 0;
+  size_t cap = 16;
+  while (cap < n * 2)
+    cap *= 2;
+
+  size_t i;
+  size_t num_edges = 0;
+  for (i = 0; i < n; i++)
+  {
+    fsm->_nodes.items[i]->_idx = i;
+    num_edges += fsm->_nodes.items[i]->cases.len + 1;
+  }
+
+  size_t* part = calloc(n, sizeof(size_t));
+  size_t* next = malloc(n * sizeof(size_t));
+  size_t* table = malloc(cap * sizeof(size_t));
+  size_t* in_begin = calloc(n + 1, sizeof(size_t));
+  in_edge_t* in = malloc(num_edges * sizeof(in_edge_t));
+  in_edge_t* gathered = malloc(num_edges * sizeof(in_edge_t));
+  size_t* touched = malloc(n * sizeof(size_t));
+  blocks_t b = { .part = part,
+                 .elems = malloc(n * sizeof(size_t)),
+                 .loc = malloc(n * sizeof(size_t)),
+                 .first = malloc(n * sizeof(size_t)),
+                 .mid = malloc(n * sizeof(size_t)),
+                 .end = malloc(n * sizeof(size_t)),
+                 .queued = calloc(n, sizeof(bool)),
+                 .work = malloc(n * 2 * sizeof(size_t)) };
+  if (!part || !next || !table || !in_begin || !in || !gathered ||
+      !touched || !b.elems || !b.loc || !b.first || !b.mid || !b.end ||
+      !b.queued || !b.work)
+  {
+    free(part);
+    free(next);
+    free(table);
+    free(in_begin);
+    free(in);
+    free(gathered);
+    free(touched);
+    blocks_free(&b);
+    return 1;
+  }
+
+  // the edges into every node, grouped by their target
+#define EACH_EDGE(nd, k, to)                                        \
+  for (size_t k = 0; k <= (nd)->cases.len; k++)                     \
+    for (tpre_fsm_node_t* to = k < (nd)->cases.len                  \
+                                   ? (nd)->cases.items[k].then      \
+                                   : (nd)->els;                     \
+         to; to = NULL)
+  for (i = 0; i < n; i++)
+  {
+    EACH_EDGE(fsm->_nodes.items[i], k, to)
+    in_begin[to->_idx + 1]++;
+  }
+  for (i = 0; i < n; i++)
+    in_begin[i + 1] += in_begin[i];
+  memcpy(next, in_begin, n * sizeof(size_t));
+  for (i = 0; i < n; i++)
+  {
+    tpre_fsm_node_t* nd = fsm->_nodes.items[i];
+    EACH_EDGE(nd, k, to)
+    in[next[to->_idx]++] = (in_edge_t) {
+      .label = k < nd->cases.len ? k : NO_CASE,
+      .from = i,
+    };
+  }
+#undef EACH_EDGE
+
+  // the first partition is by the structure of the nodes only, with all
+  // targets in the same partition
+  partition_t p = { fsm, part };
+  for (i = 0; i < cap; i++)
+    table[i] = (size_t) -1;
+  for (i = 0; i < n; i++)
+  {
+    size_t slot = node_hash(&p, i) & (cap - 1);
+    for (; table[slot] != (size_t) -1; slot = (slot + 1) & (cap - 1))
+      if (node_eq(&p, table[slot], i))
+        break;
+    if (table[slot] == (size_t) -1)
+    {
+      table[slot] = i;
+      next[i] = b.num++;
+    }
+    else
+    {
+      next[i] = next[table[slot]];
+    }
+  }
+  memcpy(part, next, n * sizeof(size_t));
+
+  // counting sort of the nodes by block
+  size_t blk;
+  for (blk = 0; blk < b.num; blk++)
+    b.end[blk] = 0;
+  for (i = 0; i < n; i++)
+    b.end[part[i]]++;
+  size_t pos = 0;
+  for (blk = 0; blk < b.num; blk++)
+  {
+    b.first[blk] = b.mid[blk] = pos;
+    pos += b.end[blk];
+    b.end[blk] = b.first[blk];
+  }
+  for (i = 0; i < n; i++)
+  {
+    b.loc[i] = b.end[part[i]]++;
+    b.elems[b.loc[i]] = i;
+  }
+  for (blk = 0; blk < b.num; blk++)
+    queue_block(&b, blk);
+
+  // Hopcroft: the nodes whose k-th edge goes into a splitter block are split
+  // off of the ones whose k-th edge doesn't, for every k
+  while (b.num_work)
+  {
+    size_t splitter = b.work[--b.num_work];
+    b.queued[splitter] = false;
+
+    size_t num_gathered = 0;
+    for (pos = b.first[splitter]; pos < b.end[splitter]; pos++)
+    {
+      size_t to = b.elems[pos];
+      for (size_t e = in_begin[to]; e < in_begin[to + 1]; e++)
+        gathered[num_gathered++] = in[e];
+    }
+    qsort(gathered, num_gathered, sizeof(in_edge_t), in_edge_cmp);
+
+    for (size_t e = 0; e < num_gathered;)
+    {
+      size_t label = gathered[e].label;
+      size_t num_touched = 0;
+      for (; e < num_gathered && gathered[e].label == label; e++)
+        mark_node(&b, gathered[e].from, touched, &num_touched);
+      split_marked(&b, touched, num_touched);
+    }
+  }
+
+  // next = representative node of each partition
+  for (i = 0; i < n; i++)
+    next[i] = (size_t) -1;
+  for (i = 0; i < n; i++)
+    if (next[part[i]] == (size_t) -1)
+      next[part[i]] = i;
+
+#define REPR(nd) \
+  ((nd) ? fsm->_nodes.items[next[part[(nd)->_idx]]] : (nd))
+
+  for (i = 0; i < n; i++)
+  {
+    tpre_fsm_node_t* nd = fsm->_nodes.items[i];
+    for (size_t k = 0; k < nd->cases.len; k++)
+      nd->cases.items[k].then = REPR(nd->cases.items[k].then);
+    nd->els = REPR(nd->els);
+  }
+  fsm->first = REPR(fsm->first);
+
+#undef REPR
+
+  free(part);
+  free(next);
+  free(table);
+  free(in_begin);
+  free(in);
+  free(gathered);
+  free(touched);
+  blocks_free(&b);
+
+  tpre_fsm_gc(fsm);
+  return 0;
+}
+
+#define AT_START (1)
+#define NOT_AT_START (2)
+
+int tpre_fsm_fold_start(tpre_fsm_t* fsm)
+{
+  tpre_fsm_gc(fsm);
+
+  size_t n = fsm->_nodes.len;
+  if (n == 0 || !fsm->first)
+    return 0;
+
+  uint8_t* reach = calloc(n, 1);
+  // a node gets pushed at most once per flag
+  size_t* stack = malloc(sizeof(size_t) * (n * 2 + 1));
+  if (!reach || !stack)
+  {
+    free(reach);
+    free(stack);
+    return 1;
+  }
+  size_t sp = 0;
+
+  size_t i;
+  for (i = 0; i < n; i++)
+    fsm->_nodes.items[i]->_idx = i;
+
+  reach[fsm->first->_idx] =
+      fsm->start_unanchored ? (AT_START | NOT_AT_START) : AT_START;
+  stack[sp++] = fsm->first->_idx;
+  while (sp)
+  {
+    size_t cur = stack[--sp];
+    tpre_fsm_node_t* nd = fsm->_nodes.items[cur];
+    for (size_t k = 0; k <= nd->cases.len; k++)
+    {
+      tpre_fsm_node_t* to;
+      uint8_t flags;
+      if (k < nd->cases.len)
+      {
+        to = nd->cases.items[k].then;
+        flags = pat_consumes(&nd->cases.items[k].pat) ? NOT_AT_START
+                                                      : reach[cur];
+      }
+      else
+      {
+        to = nd->els;
+        flags = (nd->backtrack.known && nd->backtrack.by == 0)
+            ? reach[cur]
+            : (AT_START | NOT_AT_START);
+      }
+
+      if (!to || (reach[to->_idx] | flags) == reach[to->_idx])
+        continue;
+      reach[to->_idx] |= flags;
+      stack[sp++] = to->_idx;
+    }
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    tpre_fsm_node_t* nd = fsm->_nodes.items[i];
+    size_t keep = 0;
+    for (size_t k = 0; k < nd->cases.len; k++)
+    {
+      tpre_fsm_case_t c = nd->cases.items[k];
+      if (c.pat.kind == TPRE_FSM_PAT_START && reach[i] == AT_START)
+        c.pat.kind = TPRE_FSM_PAT_EMPTY;
+      else if (c.pat.kind == TPRE_FSM_PAT_START &&
+               reach[i] == NOT_AT_START)
+        continue;
+      nd->cases.items[keep++] = c;
+    }
+    nd->cases.len = keep;
+  }
+
+  free(reach);
+  free(stack);
+
+  tpre_fsm_gc(fsm);
+  return 0;
+}
+
+int tpre_fsm_known_backtracks(tpre_fsm_t* fsm)
+{
+  for (size_t i = 0; i < fsm->_nodes.len; i++)
+  {
+    tpre_fsm_node_t* nd = fsm->_nodes.items[i];
+    if (nd->backtrack.known || (nd->els && nd->els != fsm->nd_err))
+      continue;
+
+    tpre_class_t seen = { 0 };
+    bool seen_end = false;
+    bool disjoint = true;
+    for (size_t k = 0; disjoint && k < nd->cases.len; k++)
+    {
+      tpre_fsm_pat_t const* pat = &nd->cases.items[k].pat;
+      tpre_class_t bits;
+      if (pat->kind == TPRE_FSM_PAT_END)
+      {
+        // END only matches after the last byte
+        disjoint = !seen_end;
+        seen_end = true;
+      }
+      else if (tpre_fsm_pat_bits(pat, &bits))
+      {
+        for (size_t j = 0; j < sizeof(bits.bits); j++)
+        {
+          if (seen.bits[j] & bits.bits[j])
+            disjoint = false;
+          seen.bits[j] |= bits.bits[j];
+        }
+      }
+      else
+      {
+        // EMPTY and START can always overlap with other cases
+        disjoint = false;
+      }
+    }
+
+    if (disjoint)
+    {
+      nd->backtrack.known = true;
+      nd->backtrack.by = 0;
+    }
+  }
+  return 0;
 }
@@ -0,0 +1,284 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../shared.h"
+#include "tpre_compiler.h"
+
+#define USING_TPREC
+#include "utils.h"
+
+// no runtime node assigned yet
+#define ENTRY_NONE ((tpre_nodeid_t) - 3)
+// currently resolving what this node is an alias of
+#define ENTRY_BUSY ((tpre_nodeid_t) - 4)
+
+typedef struct
+{
+  tpre_re_t* out;
+  tpre_fsm_t const* fsm;
+
+  // runtime node where each fsm node starts, indexed by _idx
+  tpre_nodeid_t* entry;
+
+  // fsm nodes that got an entry, but were not lowered yet
+  tpre_fsm_node_t** todo;
+  size_t todo_len;
+
+  int status;
+} Lowering;
+
+static bool fails_to_err(Lowering const* l, tpre_fsm_node_t const* nd)
+{
+  return !nd->els || nd->els == l->fsm->nd_err;
+}
+
+/** a new runtime node, or NODE_ERR if out of memory */
+static tpre_nodeid_t resv(Lowering* l)
+{
+  tpre_nodeid_t id = tprec_re_resvnode(l->out);
+  if (id >= 0)
+    return id;
+  l->status = 1;
+  return NODE_ERR;
+}
+
+static tpre_nodeid_t entry(Lowering* l, tpre_fsm_node_t* nd)
+{
+  if (!nd || nd == l->fsm->nd_err)
+    return NODE_ERR;
+  if (nd == l->fsm->nd_ok)
+    return NODE_DONE;
+
+  tpre_nodeid_t* e = &l->entry[nd->_idx];
+  if (*e == ENTRY_BUSY)
+  {
+    // loop of nodes that don't do anything
+    l->status = 1;
+    return NODE_ERR;
+  }
+  if (*e != ENTRY_NONE)
+    return *e;
+
+  // nodes that only forward to another node don't need runtime nodes
+  bool is_alias = true;
+  tpre_fsm_node_t* alias = NULL;
+  if (nd->cases.len == 0)
+  {
+    // stepping back needs a runtime node that fails
+    if (nd->backtrack.by)
+      l->status = 1;
+    alias = nd->els;
+  }
+  else if (
+      nd->cases.len == 1 &&
+      nd->cases.items[0].pat.kind == TPRE_FSM_PAT_EMPTY &&
+      fails_to_err(l, nd))
+    alias = nd->cases.items[0].then;
+  else
+    is_alias = false;
+
+  if (is_alias)
+  {
+    *e = ENTRY_BUSY;
+    tpre_nodeid_t id = entry(l, alias);
+    l->entry[nd->_idx] = id;
+    return id;
+  }
+
+  *e = resv(l);
+  if (!l->status)
+    l->todo[l->todo_len++] = nd;
+  return *e;
+}
+
+/** 0 = ok */
+static int lower_pat(
+    Lowering* l, tpre_fsm_pat_t const* pat, tpre_pattern_t* out)
+{
+  switch (pat->kind)
+  {
+    case TPRE_FSM_PAT_START: *out = SP(SPECIAL_START); return 0;
+    case TPRE_FSM_PAT_END:   *out = SP(SPECIAL_END); return 0;
+    default:                 break;
+  }
+
+  tpre_class_t bits;
+  if (!tpre_fsm_pat_bits(pat, &bits))
+    return 1;
+  return tprec_class_pattern(l->out, &bits, out);
+}
+
+static void lower_node(Lowering* l, tpre_fsm_node_t* nd)
+{
+  tpre_nodeid_t id = l->entry[nd->_idx];
+  tpre_nodeid_t fail = entry(l, nd->els);
+  size_t n = nd->cases.len;
+
+  if (nd->backtrack.by > 255)
+  {
+    l->status = 1;
+    return;
+  }
+
+  if (nd->backtrack.known)
+  {
+    // at most one case can match, so it's just a chain of tests
+    for (size_t k = 0; k < n && !l->status; k++)
+    {
+      tpre_fsm_case_t const* c = &nd->cases.items[k];
+      bool last = k + 1 == n;
+      tpre_re_node_t r = { 0 };
+      if (c->pat.kind == TPRE_FSM_PAT_EMPTY ||
+          lower_pat(l, &c->pat, &r.pat))
+      {
+        l->status = 1;
+        return;
+      }
+      r.ok = entry(l, c->then);
+      r.err = last ? fail : resv(l);
+      r.backtrack = last ? nd->backtrack.by : 0;
+      r.group = c->group;
+      tprec_re_setnode(l->out, id, r);
+      id = r.err;
+    }
+    return;
+  }
+
+  // the backtrack stack restores the position, so can't step back
+  if (nd->backtrack.by && fail != NODE_ERR)
+  {
+    l->status = 1;
+    return;
+  }
+
+  // id: bt_push(then: test case k, onbt: remaining cases)
+  for (size_t k = 0; k < n && !l->status; k++)
+  {
+    tpre_fsm_case_t const* c = &nd->cases.items[k];
+    bool last = k + 1 == n;
+    tpre_nodeid_t then = entry(l, c->then);
+
+    tpre_re_node_t test = { 0 };
+    if (c->pat.kind != TPRE_FSM_PAT_EMPTY &&
+        lower_pat(l, &c->pat, &test.pat))
+    {
+      l->status = 1;
+      return;
+    }
+    test.ok = then;
+    test.err = NODE_ERR;
+    test.group = c->group;
+
+    if (last && fail == NODE_ERR)
+    {
+      // nothing left to try
+      tprec_re_setnode(l->out, id, test);
+      return;
+    }
+
+    // last case is empty, and nothing after it
+    tpre_fsm_case_t const* nc = last ? NULL : &nd->cases.items[k + 1];
+    bool next_is_jump = nc && k + 2 == n &&
+        nc->pat.kind == TPRE_FSM_PAT_EMPTY && fail == NODE_ERR;
+
+    tpre_nodeid_t rest = last ? fail
+        : next_is_jump        ? entry(l, nc->then)
+                              : resv(l);
+
+    tpre_nodeid_t x = then;
+    if (c->pat.kind != TPRE_FSM_PAT_EMPTY)
+    {
+      x = resv(l);
+      if (l->status)
+        return;
+      tprec_re_setnode(l->out, x, test);
+    }
+    tprec_re_setnode(
+        l->out, id,
+        (tpre_re_node_t) {
+          SP(SPECIAL_BT_PUSH),
+          /* then: */ x,
+          /* onbt: */ rest, 0, 0 });
+
+    if (next_is_jump)
+      return;
+    id = rest;
+  }
+}
+
+int tpre_fsm2re(tpre_re_t* out, tpre_fsm_t const* fsm)
+{
+  memset(out, 0, sizeof(tpre_re_t));
+
+  Lowering l = { 0 };
+  l.out = out;
+  l.fsm = fsm;
+
+  size_t n = fsm->_nodes.len;
+  l.entry = malloc(sizeof(tpre_nodeid_t) * (n + 1));
+  l.todo = malloc(sizeof(tpre_fsm_node_t*) * (n + 1));
+  if (!l.entry || !l.todo)
+    l.status = 1;
+
+  size_t i;
+  for (i = 0; !l.status && i < n; i++)
+  {
+    fsm->_nodes.items[i]->_idx = i;
+    l.entry[i] = ENTRY_NONE;
+  }
+
+  // the lazy `.*?` of start unanchored fsms, in the shape that the runtime
+  // knows as where the search starts over:
+  // first: bt_push(then: fsm->first, onbt: step)
+  // step: any(ok: first)
+  if (!l.status && fsm->start_unanchored)
+  {
+    tpre_nodeid_t first = resv(&l);
+    tpre_nodeid_t step = resv(&l);
+    tpre_nodeid_t body = entry(&l, fsm->first);
+    if (!l.status)
+    {
+      tprec_re_setnode(
+          out, first,
+          (tpre_re_node_t) {
+            SP(SPECIAL_BT_PUSH), /* then: */ body, /* onbt: */ step, 0, 0 });
+      tprec_re_setnode(
+          out, step,
+          (tpre_re_node_t) { SP(SPECIAL_ANY), first, NODE_ERR, 0, 0 });
+      out->first_node = first;
+    }
+  }
+  else if (!l.status)
+    out->first_node = entry(&l, fsm->first);
+
+  // every node is put into todo at most once
+  for (i = 0; !l.status && i < l.todo_len; i++)
+    lower_node(&l, l.todo[i]);
+
+  free(l.entry);
+  free(l.todo);
+
+  if (!l.status && fsm->num_named_groups)
+  {
+    out->named_groups = calloc(fsm->num_named_groups, sizeof(char*));
+    if (!out->named_groups)
+      l.status = 1;
+    out->free = true;
+    for (i = 0; !l.status && i < fsm->num_named_groups; i++)
+    {
+      out->named_groups[i] = tprec_strdup(fsm->named_groups[i]);
+      out->num_named_groups = i + 1;
+      if (!out->named_groups[i])
+        l.status = 1;
+    }
+  }
+  out->first_named_group = fsm->first_named_group;
+  if (fsm->total_num_groups > out->max_group + 1)
+    out->max_group = fsm->total_num_groups - 1;
+
+  if (l.status)
+  {
+    tpre_free(*out);
+    memset(out, 0, sizeof(tpre_re_t));
+  }
+  return l.status;
+}
@@ -13,6 +13,15 @@
 //  backref to group 39:   \g{39}
 //  backref to group hey:  \g{hey}
 
+/** a `+` after a greedy quantifier makes it possessive */
+static bool lex_possessive(char const** reader)
+{
+  if (**reader != '+')
+    return false;
+  (*reader)++;
+  return true;
+}
+
 static bool
 lex(ReTk* tkOut,
     bool isOneOf,
@@ -22,13 +31,19 @@ lex(ReTk* tkOut,
   if (!**reader)
     return false;
 
+  tkOut->possessive = false;
+
   if (opts->ignore_whitespace_in_pat && isspace(**reader))
   {
     (*reader)++;
     return true;
   }
 
-  if ((*reader)[1] == '-')
+  // outside of one-ofs, only for things like `0-9`, so that `(a)-(b)` still
+  // works
+  if ((*reader)[1] == '-' && (*reader)[2] &&
+      (isOneOf ? (*reader)[2] != ']'
+               : isalnum(**reader) && isalnum((*reader)[2])))
   {
     tkOut->range.from = **reader;
     (*reader) += 2;
@@ -153,6 +168,7 @@ lex(ReTk* tkOut,
     else
     {
       tkOut->ty = GreedyRepeatLeast0;
+      tkOut->possessive = lex_possessive(reader);
     }
     return true;
   }
@@ -168,14 +184,64 @@ lex(ReTk* tkOut,
     else
     {
       tkOut->ty = GreedyRepeatLeast1;
+      tkOut->possessive = lex_possessive(reader);
     }
     return true;
   }
 
+  // {n}, {n,} or {n,m}. if it's not one of those, it's just the char
+  if (!isOneOf && **reader == '{' && isdigit((*reader)[1]))
+  {
+    char* end;
+    unsigned long min = strtoul(*reader + 1, &end, 10);
+    unsigned long max = min;
+    if (*end == ',')
+    {
+      end++;
+      if (isdigit(*end))
+        max = strtoul(end, &end, 10);
+      else
+        max = TPREC_REPEAT_INF;
+    }
+
+    if (*end == '}')
+    {
+      if (min > TPREC_REPEAT_MAX || min > max ||
+          (max != TPREC_REPEAT_INF && max > TPREC_REPEAT_MAX))
+        return false;
+      *reader = end + 1;
+      tkOut->ty = RepeatRange;
+      tkOut->repeat.min = (uint32_t) min;
+      tkOut->repeat.max = (uint32_t) max;
+      tkOut->repeat.lazy = false;
+      if (**reader == '?')
+      {
+        (*reader)++;
+        tkOut->repeat.lazy = true;
+      }
+      else
+      {
+        tkOut->possessive = lex_possessive(reader);
+      }
+      return true;
+    }
+  }
+
   if (!isOneOf && **reader == '?')
   {
     (*reader)++;
+    if (**reader == '?')
+    {
+      // x?? is x{0,1}?
+      (*reader)++;
+      tkOut->ty = RepeatRange;
+      tkOut->repeat.min = 0;
+      tkOut->repeat.max = 1;
+      tkOut->repeat.lazy = true;
+      return true;
+    }
     tkOut->ty = OrNot;
+    tkOut->possessive = lex_possessive(reader);
     return true;
   }
 
@@ -191,6 +257,12 @@ lex(ReTk* tkOut,
         tkOut->ty = CaptureGroupOpenNoCapture;
         return true;
       }
+      else if (**reader == '>')
+      {
+        (*reader)++;
+        tkOut->ty = CaptureGroupOpenAtomic;
+        return true;
+      }
       else if (**reader == '#')
       {
         while (**reader && **reader != ')')
@@ -297,15 +369,40 @@ int tprec_lexe(
 
   ReTk tok;
   const char* reader = src;
+  // where the token starts
+  const char* begin = reader;
   bool isOneOf = false;
+  size_t nesting = 0;
   while (lex(&tok, isOneOf, &reader, opts))
   {
-    tok.where = reader - src;
+    tok.where = begin - src;
+    if (tk_isCaptureGroupOpen(tok.ty) && ++nesting > TPREC_NESTING_MAX)
+    {
+      tprec_add_err(errs, tok.where, "groups are nested too deeply");
+      free(out->tokens);
+      memset(out, 0, sizeof(TkL));
+      return 1;
+    }
+    if (tok.ty == CaptureGroupClose && nesting > 0)
+      nesting--;
     tprec_TkL_add(out, tok);
     if (tk_isOneOfOpen(tok.ty))
+    {
       isOneOf = true;
+      // `]` right after `[` or `[^` is a literal
+      if (*reader == ']')
+      {
+        tok = (ReTk) { 0 };
+        tok.ty = Match;
+        tok.match = NO(']');
+        tok.where = reader - src;
+        reader++;
+        tprec_TkL_add(out, tok);
+      }
+    }
     else if (tok.ty == OneOfClose)
       isOneOf = false;
+    begin = reader;
   }
 
   if (*reader)
@@ -351,7 +448,8 @@ bool tprec_TkL_take(ReTk* out, TkL* li)
 
 void tprec_TkL_free(TkL* li)
 {
-  if (li->allocptr && li->cap)
+  // take() counts cap down, so it can be 0 when everything was taken
+  if (li->allocptr)
     free(li->allocptr);
   li->allocptr = 0;
   li->cap = 0;
@@ -360,12 +458,18 @@ void tprec_TkL_free(TkL* li)
 TkL tprec_TkL_copy_range(TkL const* li, size_t first, size_t num)
 {
   TkL out = { 0 };
+  if (num == 0)
+    return out;
+  out.allocptr = malloc(num * sizeof(ReTk));
+  if (!out.allocptr)
+  {
+    out.oom = 1;
+    return out;
+  }
   out.len = num;
   out.cap = num;
-  out.allocptr = malloc(li->cap * sizeof(ReTk));
   out.tokens = out.allocptr;
-  if (out.allocptr)
-    memcpy(out.tokens, li->tokens + first, num * sizeof(ReTk));
+  memcpy(out.tokens, li->tokens + first, num * sizeof(ReTk));
   return out;
 }
 
@@ -373,7 +477,7 @@ void tprec_TkL_add(TkL* li, ReTk tk)
 {
   if (li->len + 1 > li->cap)
   {
-    size_t newCap = li->cap + 16;
+    size_t newCap = li->cap ? li->cap * 2 : 16;
     ReTk* new = realloc(li->allocptr, newCap * sizeof(ReTk));
     if (!new)
     {
@@ -17,6 +17,7 @@ typedef enum
   CaptureGroupOpen,
   CaptureGroupOpenNoCapture,
   CaptureGroupOpenNamed,
+  CaptureGroupOpenAtomic,
   CaptureGroupClose,
   OneOfOpen,
   OneOfOpenInvert,
@@ -24,12 +25,23 @@ typedef enum
   OrElse,
   BackrefId,
   BackrefName,
+  RepeatRange,
 } ReTkTy;
 
+// max of RepeatRange if there is no upper bound
+#define TPREC_REPEAT_INF (UINT32_MAX)
+// bounds of RepeatRange can not be larger than this
+#define TPREC_REPEAT_MAX (65535)
+// groups can not be nested deeper than this, because the parser recurses
+// into them
+#define TPREC_NESTING_MAX (1000)
+
 typedef struct
 {
   ReTkTy ty;
   size_t where;
+  // postfix operators: never give back what was matched
+  bool possessive;
   union
   {
     tpre_pattern_t match;
@@ -39,13 +51,18 @@ typedef struct
     {
       char from, to;
     } range;
+    struct
+    {
+      uint32_t min, max;
+      bool lazy;
+    } repeat;
   };
 } ReTk;
 
 static inline bool tk_isCaptureGroupOpen(ReTkTy ty)
 {
   return ty == CaptureGroupOpen || ty == CaptureGroupOpenNamed ||
-      ty == CaptureGroupOpenNoCapture;
+      ty == CaptureGroupOpenNoCapture || ty == CaptureGroupOpenAtomic;
 }
 
 static inline bool tk_isOneOfOpen(ReTkTy ty)
@@ -57,7 +74,7 @@ static inline bool tk_isPostfix(ReTkTy ty)
 {
   return ty == OrNot || ty == GreedyRepeatLeast0 ||
       ty == GreedyRepeatLeast1 || ty == LazyRepeatLeast0 ||
-      ty == LazyRepeatLeast1;
+      ty == LazyRepeatLeast1 || ty == RepeatRange;
 }
 
 
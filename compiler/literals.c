@@ -0,0 +1,207 @@
+#include <stdint.h>
+#include <string.h>
+#include "../shared.h"
+
+#define USING_TPREC
+#include "compiler/parser.h"
+#include "compiler/utils.h"
+
+typedef struct
+{
+  uint8_t const* bytes;
+  size_t len;
+  size_t index;
+} Word;
+
+/** by bytes, so that words with a common prefix are next to each other and
+ * a word comes before the ones it is a prefix of. equal words by index */
+static int word_cmp(void const* pa, void const* pb)
+{
+  Word const* a = pa;
+  Word const* b = pb;
+  size_t len = a->len < b->len ? a->len : b->len;
+  int c = memcmp(a->bytes, b->bytes, len);
+  if (c)
+    return c;
+  if (a->len != b->len)
+    return a->len < b->len ? -1 : 1;
+  return (a->index > b->index) - (a->index < b->index);
+}
+
+/** the words in [begin, end) share their first depth bytes. the tree that
+ * matches the rest of them, after the last of these bytes if byte, goes to
+ * node */
+typedef struct
+{
+  size_t begin, end;
+  size_t depth;
+  // with first_only, the words from this index on are left out
+  size_t limit;
+  bool byte;
+  Node** node;
+} Task;
+
+typedef struct
+{
+  Task* items;
+  size_t len;
+  size_t cap;
+} Tasks;
+
+static bool push_task(Tasks* tasks, Task task)
+{
+  if (tasks->len == tasks->cap)
+  {
+    size_t cap = tasks->cap ? tasks->cap * 2 : 32;
+    Task* items = realloc(tasks->items, sizeof(Task) * cap);
+    if (!items)
+      return false;
+    tasks->items = items;
+    tasks->cap = cap;
+  }
+  tasks->items[tasks->len++] = task;
+  return true;
+}
+
+static Node* alloc_kind(NodeKind kind)
+{
+  Node* nd = Node_alloc();
+  if (nd)
+    nd->kind = kind;
+  return nd;
+}
+
+/** the new nodes are put into the tree right away, so that freeing the tree
+ * frees them too. false if out of memory */
+static bool trie_node(
+    Word const* words, Task t, bool first_only, Tasks* todo)
+{
+  size_t i = t.begin;
+  bool ends = false;
+  for (; i < t.end && words[i].len == t.depth; i++)
+  {
+    if (words[i].index >= t.limit)
+      continue;
+    ends = true;
+    // the tree stops here, so the longer words after it can't match first
+    if (first_only)
+      t.limit = words[i].index;
+  }
+
+  // the words that continue, split by the byte that follows
+  size_t runs[256 * 2];
+  size_t num_runs = 0;
+  while (i < t.end)
+  {
+    uint8_t c = words[i].bytes[t.depth];
+    size_t j = i;
+    bool keep = false;
+    for (; j < t.end && words[j].bytes[t.depth] == c; j++)
+      keep |= words[j].index < t.limit;
+    if (keep)
+    {
+      runs[num_runs * 2] = i;
+      runs[num_runs * 2 + 1] = j;
+      num_runs++;
+    }
+    i = j;
+  }
+
+  Node** rest = t.node;
+  if (t.byte)
+  {
+    Node* match = alloc_kind(NodeMatch);
+    if (!match)
+      return false;
+    match->match = NO(words[t.begin].bytes[t.depth - 1]);
+    *t.node = match;
+    if (num_runs)
+    {
+      Node* chain = alloc_kind(NodeChain);
+      if (!chain)
+        return false;
+      chain->chain.a = match;
+      *t.node = chain;
+      rest = &chain->chain.b;
+    }
+  }
+  else if (!num_runs)
+  {
+    // the only word is empty
+    *t.node = emptyNode();
+    return *t.node != NULL;
+  }
+
+  if (num_runs && ends)
+  {
+    Node* maybe = alloc_kind(NodeMaybe);
+    if (!maybe)
+      return false;
+    *rest = maybe;
+    rest = &maybe->maybe;
+  }
+
+  // the cases begin with different bytes, so their order doesn't matter
+  for (size_t r = 0; r < num_runs; r++)
+  {
+    Node** slot = rest;
+    if (r + 1 < num_runs)
+    {
+      Node* alt = alloc_kind(NodeOr);
+      if (!alt)
+        return false;
+      *rest = alt;
+      slot = &alt->or.a;
+      rest = &alt->or.b;
+    }
+    Task next = { .begin = runs[r * 2],
+                  .end = runs[r * 2 + 1],
+                  .depth = t.depth + 1,
+                  .limit = t.limit,
+                  .byte = true,
+                  .node = slot };
+    if (!push_task(todo, next))
+      return false;
+  }
+  return true;
+}
+
+Node* tprec_literals(char const* const* words, size_t num, bool first_only)
+{
+  Word* sorted = malloc(sizeof(Word) * num);
+  if (!sorted)
+    return NULL;
+  for (size_t i = 0; i < num; i++)
+  {
+    sorted[i].bytes = (uint8_t const*) words[i];
+    sorted[i].len = strlen(words[i]);
+    sorted[i].index = i;
+  }
+  qsort(sorted, num, sizeof(Word), word_cmp);
+
+  // words can be long, so the trie is built with a list of tasks
+  Node* root = NULL;
+  Tasks todo = { 0 };
+  bool ok = push_task(
+      &todo,
+      (Task) { .begin = 0,
+               .end = num,
+               .depth = 0,
+               .limit = SIZE_MAX,
+               .byte = false,
+               .node = &root });
+  while (ok && todo.len)
+  {
+    Task t = todo.items[--todo.len];
+    ok = trie_node(sorted, t, first_only, &todo);
+  }
+  free(todo.items);
+  free(sorted);
+
+  if (!ok)
+  {
+    Node_free(root);
+    return NULL;
+  }
+  return root;
+}
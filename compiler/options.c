@@ -16,6 +16,9 @@ bool tpre_opt_getb(tpre_opts_t const* opts, tpre_opt_key_t key)
     case TPRE_OPT_UTF8:        return opts->utf8;
     case TPRE_OPT_UNGREEDY:    return opts->ungreedy;
     case TPRE_OPT_SINGLE_LINE: return opts->single_line;
+    case TPRE_OPT_NO_CAPTURES: return opts->no_captures;
+    case TPRE_OPT_LONGEST:     return opts->longest;
+    case TPRE_OPT_NO_DFA:      return opts->no_dfa;
   }
 }
 
@@ -43,6 +46,9 @@ void tpre_opt_setb(tpre_opts_t* opts, tpre_opt_key_t key, bool val)
     case TPRE_OPT_UTF8:        opts->utf8 = val; break;
     case TPRE_OPT_UNGREEDY:    opts->ungreedy = val; break;
     case TPRE_OPT_SINGLE_LINE: opts->single_line = val; break;
+    case TPRE_OPT_NO_CAPTURES: opts->no_captures = val; break;
+    case TPRE_OPT_LONGEST:     opts->longest = val; break;
+    case TPRE_OPT_NO_DFA:      opts->no_dfa = val; break;
   }
 }
 
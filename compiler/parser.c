@@ -4,11 +4,14 @@
 
 #define USING_TPREC
 #include "compiler/lexer.h"
+#include "compiler/utils.h"
 
-void tprec_Node_children(Node* nd, Node* childrenOut[2])
+/** where the children of the node are stored, NULL for the ones it doesn't
+ * have */
+static void child_slots(Node* nd, Node** slotsOut[2])
 {
-  childrenOut[0] = NULL;
-  childrenOut[1] = NULL;
+  slotsOut[0] = NULL;
+  slotsOut[1] = NULL;
 
   switch (nd->kind)
   {
@@ -17,105 +20,134 @@ void tprec_Node_children(Node* nd, Node* childrenOut[2])
     case NodeNamedBackref: break;
 
     case NodeChain:
-      childrenOut[0] = nd->chain.a;
-      childrenOut[1] = nd->chain.b;
+      slotsOut[0] = &nd->chain.a;
+      slotsOut[1] = &nd->chain.b;
       break;
 
-    case NodeNot: childrenOut[0] = nd->not; break;
+    case NodeNot: slotsOut[0] = &nd->not; break;
 
     case NodeOr:
-      childrenOut[0] = nd->or.a;
-      childrenOut[1] = nd->or.b;
+      slotsOut[0] = &nd->or.a;
+      slotsOut[1] = &nd->or.b;
       break;
 
-    case NodeMaybe: childrenOut[0] = nd->maybe; break;
+    case NodeMaybe:
+    case NodeLazyMaybe: slotsOut[0] = &nd->maybe; break;
 
     case NodeGreedyRepeatLeast0:
     case NodeGreedyRepeatLeast1:
     case NodeLazyRepeatLeast0:
     case NodeLazyRepeatLeast1:
-      childrenOut[0] = nd->repeat;
+      slotsOut[0] = &nd->repeat;
       break;
 
-    case NodeJustGroup: childrenOut[0] = nd->just_group; break;
+    case NodeJustGroup: slotsOut[0] = &nd->just_group; break;
 
-    case NodeCaptureGroup: childrenOut[0] = nd->capture; break;
+    case NodeCaptureGroup: slotsOut[0] = &nd->capture; break;
 
     case NodeNamedCaptureGroup:
-      childrenOut[0] = nd->named_capture.group;
+      slotsOut[0] = &nd->named_capture.group;
       break;
+
+    case NodeRepeat: slotsOut[0] = &nd->counted.node; break;
+
+    case NodeAtomic: slotsOut[0] = &nd->atomic; break;
   }
 }
 
-void tprec_Node_free(Node* node)
+void tprec_Node_children(Node* nd, Node* childrenOut[2])
 {
-  if (!node)
-    return;
-  Node* children[2];
-  tprec_Node_children(node, children);
-  tprec_Node_free(children[0]);
-  tprec_Node_free(children[1]);
-  free(node);
+  Node** slots[2];
+  child_slots(nd, slots);
+  childrenOut[0] = slots[0] ? *slots[0] : NULL;
+  childrenOut[1] = slots[1] ? *slots[1] : NULL;
 }
 
-Node* tprec_Node_clone(Node* node)
+int tprec_Node_walk(
+    Node* root,
+    void (*pre)(Node* nd, void* ctx),
+    void (*post)(Node* nd, void* ctx),
+    void* ctx)
 {
-  Node* copy = Node_alloc();
-  copy->kind = node->kind;
-  copy->group = node->group;
-  copy->wherePlus1 = node->wherePlus1;
-
-  switch (node->kind)
+  tprec_stack_t todo = { 0 };
+  bool ok = root == NULL || tprec_stack_push(&todo, root);
+  while (ok && todo.len)
   {
-    case NodeMatch: copy->match = node->match; break;
-
-    case NodeChain:
-      copy->chain.a = tprec_Node_clone(node->chain.a);
-      copy->chain.b = tprec_Node_clone(node->chain.b);
-      break;
-
-    case NodeOr:
-      copy->or.a = tprec_Node_clone(node->or.a);
-      copy->or.b = tprec_Node_clone(node->or.b);
-      break;
-
-    case NodeMaybe:
-      copy->maybe = tprec_Node_clone(node->maybe);
-      break;
-
-    case NodeNot: copy->not= tprec_Node_clone(node->not); break;
-
-    case NodeGreedyRepeatLeast0:
-    case NodeGreedyRepeatLeast1:
-    case NodeLazyRepeatLeast0:
-    case NodeLazyRepeatLeast1:
-      copy->repeat = tprec_Node_clone(node->repeat);
-      break;
+    Node* nd = tprec_stack_pop(&todo);
+    // NULL is pushed above a node whose children are on top of it
+    if (nd == NULL)
+    {
+      post(tprec_stack_pop(&todo), ctx);
+      continue;
+    }
 
-    case NodeJustGroup:
-      copy->just_group = tprec_Node_clone(node->just_group);
-      break;
+    if (pre)
+      pre(nd, ctx);
+    Node* children[2];
+    tprec_Node_children(nd, children);
+    if (post)
+      ok = tprec_stack_push(&todo, nd) && tprec_stack_push(&todo, NULL);
+    if (ok && children[1])
+      ok = tprec_stack_push(&todo, children[1]);
+    if (ok && children[0])
+      ok = tprec_stack_push(&todo, children[0]);
+  }
+  free(todo.items);
+  return !ok;
+}
 
-    case NodeCaptureGroup:
-      copy->capture = tprec_Node_clone(node->capture);
-      break;
+static void free_one(Node* nd, void* ctx)
+{
+  (void) ctx;
+  free(nd);
+}
 
-    case NodeNamedCaptureGroup:
-      copy->named_capture.group =
-          tprec_Node_clone(node->named_capture.group);
-      memcpy(
-          copy->named_capture.name, node->named_capture.name, 20);
-      break;
+void tprec_Node_free(Node* node)
+{
+  tprec_Node_walk(node, NULL, free_one, NULL);
+}
 
-    case NodeNamedBackref:
-      memcpy(
-          copy->named_backref.name, node->named_backref.name, 20);
+Node* tprec_Node_clone(Node* node)
+{
+  Node* root = NULL;
+  // pairs of a node, and where its copy goes
+  tprec_stack_t todo = { 0 };
+  bool ok = tprec_stack_push(&todo, node) && tprec_stack_push(&todo, &root);
+  while (ok && todo.len)
+  {
+    Node** dest = tprec_stack_pop(&todo);
+    Node* src = tprec_stack_pop(&todo);
+    Node* copy = Node_alloc();
+    if (!copy)
+    {
+      ok = false;
       break;
-
-    case NodeBackref: copy->backref = node->backref; break;
+    }
+    memcpy(copy, src, sizeof(Node));
+    *dest = copy;
+
+    // the children of the copy are NULL until they are copied too, so that
+    // a partial copy can be freed
+    Node** slots[2];
+    child_slots(copy, slots);
+    for (int i = 1; ok && i >= 0; i--)
+    {
+      if (!slots[i] || !*slots[i])
+        continue;
+      Node* child = *slots[i];
+      *slots[i] = NULL;
+      ok = tprec_stack_push(&todo, child) &&
+          tprec_stack_push(&todo, slots[i]);
+    }
   }
+  free(todo.items);
 
-  return copy;
+  if (!ok)
+  {
+    tprec_Node_free(root);
+    return NULL;
+  }
+  return root;
 }
 
 static const char* NodeKind_str[] = {
@@ -123,6 +155,7 @@ static const char* NodeKind_str[] = {
   [NodeChain] = "Chain",
   [NodeOr] = "Or",
   [NodeMaybe] = "Maybe",
+  [NodeLazyMaybe] = "LazyMaybe",
   [NodeNot] = "Not",
   [NodeGreedyRepeatLeast0] = "GreedyRepeatLeast0",
   [NodeGreedyRepeatLeast1] = "GreedyRepeatLeast1",
@@ -133,13 +166,13 @@ static const char* NodeKind_str[] = {
   [NodeNamedCaptureGroup] = "NamedCaptureGroup",
   [NodeBackref] = "Backref",
   [NodeNamedBackref] = "NamedBackref",
+  [NodeRepeat] = "Repeat",
+  [NodeAtomic] = "Atomic",
 };
 
-void tprec_Node_print(
+static void print_one(
     Node* node, FILE* file, size_t indent, bool print_grps)
 {
-  if (!node)
-    return;
   size_t i;
   for (i = 0; i < indent * 2; i++)
     fputc(' ', file);
@@ -172,68 +205,108 @@ void tprec_Node_print(
     }
     break;
 
+    case NodeRepeat: {
+      fprintf(
+          file, "(%u, %u%s)", node->counted.min, node->counted.max,
+          node->counted.lazy ? ", lazy" : "");
+    }
+    break;
+
     default: break;
   }
   fputc('\n', file);
-  Node* children[2];
-  tprec_Node_children(node, children);
-  tprec_Node_print(children[0], file, indent + 1, print_grps);
-  tprec_Node_print(children[1], file, indent + 1, print_grps);
 }
 
-bool tprec_Node_eq(Node* a, Node* b)
+void tprec_Node_print(
+    Node* node, FILE* file, size_t indent, bool print_grps)
+{
+  // pairs of a node and its indent
+  tprec_stack_t todo = { 0 };
+  bool ok = !node ||
+      (tprec_stack_push(&todo, node) &&
+       tprec_stack_push(&todo, (void*) (uintptr_t) indent));
+  while (ok && todo.len)
+  {
+    indent = (size_t) (uintptr_t) tprec_stack_pop(&todo);
+    node = tprec_stack_pop(&todo);
+    print_one(node, file, indent, print_grps);
+
+    Node* children[2];
+    tprec_Node_children(node, children);
+    for (int i = 1; ok && i >= 0; i--)
+      if (children[i])
+        ok = tprec_stack_push(&todo, children[i]) &&
+            tprec_stack_push(&todo, (void*) (uintptr_t) (indent + 1));
+  }
+  free(todo.items);
+}
+
+/** compares everything but the children */
+static bool eq_one(Node* a, Node* b)
 {
   if (a->kind != b->kind)
     return false;
-  if (a->group != b->group)
+  if (a->group != b->group || a->group_begin != b->group_begin)
     return false;
 
   switch (a->kind)
   {
     case NodeMatch:
       return a->match.is_special == b->match.is_special &&
-          a->match.val == b->match.val;
-
-    case NodeChain:
-      return tprec_Node_eq(a->chain.a, b->chain.a) &&
-          tprec_Node_eq(a->chain.b, b->chain.b);
-
-    case NodeOr:
-      return tprec_Node_eq(a->or.a, b->or.a) &&
-          tprec_Node_eq(a->or.b, b->or.b);
-
-    case NodeMaybe: return tprec_Node_eq(a->maybe, b->maybe);
-
-    case NodeNot: return tprec_Node_eq(a->not, b->not);
-
-    case NodeGreedyRepeatLeast0:
-    case NodeGreedyRepeatLeast1:
-    case NodeLazyRepeatLeast0:
-    case NodeLazyRepeatLeast1:
-      return tprec_Node_eq(a->repeat, b->repeat);
-
-    case NodeJustGroup:
-      return tprec_Node_eq(a->just_group, b->just_group);
-
-    case NodeCaptureGroup:
-      return tprec_Node_eq(a->capture, b->capture);
+          a->match.val == b->match.val &&
+          a->match.invert == b->match.invert &&
+          a->match.arg == b->match.arg;
 
     case NodeNamedCaptureGroup:
-      return tprec_Node_eq(
-                 a->named_capture.group, b->named_capture.group) &&
-          !strcmp(a->named_capture.name, b->named_capture.name);
+      return !strcmp(a->named_capture.name, b->named_capture.name);
 
     case NodeNamedBackref:
       return !strcmp(a->named_backref.name, b->named_backref.name);
 
     case NodeBackref: return a->backref == b->backref;
+
+    case NodeRepeat:
+      return a->counted.min == b->counted.min &&
+          a->counted.max == b->counted.max &&
+          a->counted.lazy == b->counted.lazy;
+
+    default: return true;
   }
 }
 
+bool tprec_Node_eq(Node* a, Node* b)
+{
+  // pairs of nodes that still have to be compared
+  tprec_stack_t todo = { 0 };
+  bool eq = tprec_stack_push(&todo, a) && tprec_stack_push(&todo, b);
+  while (eq && todo.len)
+  {
+    b = tprec_stack_pop(&todo);
+    a = tprec_stack_pop(&todo);
+    if (!a || !b)
+    {
+      eq = a == b;
+      continue;
+    }
+    eq = eq_one(a, b);
+
+    Node* ca[2];
+    Node* cb[2];
+    tprec_Node_children(a, ca);
+    tprec_Node_children(b, cb);
+    for (int i = 0; eq && i < 2; i++)
+      eq = tprec_stack_push(&todo, ca[i]) && tprec_stack_push(&todo, cb[i]);
+  }
+  free(todo.items);
+  return eq;
+}
+
 Node* tprec_maybeChain(Node* a, Node* b)
 {
   if (b == NULL)
     return a;
+  if (a == NULL)
+    return b;
 
   Node* n = Node_alloc();
   n->wherePlus1 = a->wherePlus1;
@@ -247,15 +320,18 @@ Node* tprec_oneOf(Node** nodes, size_t len)
 {
   if (len == 0)
     return NULL;
-  if (len == 1)
-    return nodes[0];
-  Node* rhs = tprec_oneOf(nodes + 1, len - 1);
-  Node* self = Node_alloc();
-  self->wherePlus1 = nodes[0]->wherePlus1;
-  self->kind = NodeOr;
-  self->or.a = nodes[0];
-  self->or.b = rhs;
-  return self;
+  // a|(b|(c|d)), built from the end
+  Node* rhs = nodes[len - 1];
+  for (size_t i = len - 1; i-- > 0;)
+  {
+    Node* self = Node_alloc();
+    self->wherePlus1 = nodes[i]->wherePlus1;
+    self->kind = NodeOr;
+    self->or.a = nodes[i];
+    self->or.b = rhs;
+    rhs = self;
+  }
+  return rhs;
 }
 
 Node* tprec_genMatch(size_t where, tpre_pattern_t pat)
@@ -267,20 +343,85 @@ Node* tprec_genMatch(size_t where, tpre_pattern_t pat)
   return self;
 }
 
-#define Node_children tprec_Node_children
-
-static void handle_postfix(Node* node, ReTk op)
+Node* tprec_emptyNode(void)
 {
-  if (node->kind == NodeChain)
+  Node* self = Node_alloc();
+  if (!self)
+    return NULL;
+  self->kind = NodeRepeat;
+  self->counted.node = Node_alloc();
+  if (!self->counted.node)
   {
-    Node* children[2];
-    Node_children(node, children);
+    free(self);
+    return NULL;
+  }
+  self->counted.node->kind = NodeMatch;
+  self->counted.node->match = SP(SPECIAL_ANY);
+  return self;
+}
+
+size_t tprec_unrollSize(Node* node)
+{
+  if (node->counted.max == TPREC_REPEAT_INF)
+    return (size_t) node->counted.min + 1;
+  return node->counted.max;
+}
+
+bool tprec_unroll(Node* node)
+{
+  uint32_t min = node->counted.min;
+  uint32_t max = node->counted.max;
+  bool lazy = node->counted.lazy;
+  Node* inner = node->counted.node;
 
-    if (children[1] != NULL)
-      return handle_postfix(children[1], op);
-    if (children[0] != NULL)
-      return handle_postfix(children[0], op);
+  if (max == 0)
+    return false;
+
+  // x{2,4} = xx(x(x)?)?, and x{2,4}? = xx(x(x)??)??
+  Node* tail = NULL;
+  if (max == TPREC_REPEAT_INF)
+  {
+    tail = Node_alloc();
+    tail->kind = lazy ? NodeLazyRepeatLeast0 : NodeGreedyRepeatLeast0;
+    tail->repeat = tprec_Node_clone(inner);
+    tail->group = node->group;
+    tail->wherePlus1 = node->wherePlus1;
   }
+  for (uint32_t i = min; i < max && max != TPREC_REPEAT_INF; i++)
+  {
+    Node* opt = Node_alloc();
+    opt->kind = lazy ? NodeLazyMaybe : NodeMaybe;
+    opt->maybe = tprec_maybeChain(tprec_Node_clone(inner), tail);
+    if (tail)
+      opt->maybe->group = node->group;
+    opt->group = node->group;
+    opt->wherePlus1 = node->wherePlus1;
+    tail = opt;
+  }
+  for (uint32_t i = 0; i < min; i++)
+  {
+    bool chained = tail != NULL;
+    tail = tprec_maybeChain(tprec_Node_clone(inner), tail);
+    if (chained)
+      tail->group = node->group;
+  }
+  tprec_Node_free(inner);
+
+  // the group begins before the first copy
+  bool group_begin = node->group_begin;
+  memcpy(node, tail, sizeof(Node));
+  node->group_begin |= group_begin;
+  free(tail);
+  return true;
+}
+
+#define Node_children tprec_Node_children
+
+static void handle_postfix(Node* node, ReTk op)
+{
+  // applies to the last node of a chain
+  while (node->kind == NodeChain)
+    node = node->chain.b;
 
   Node* copy = Node_alloc();
   memcpy(copy, node, sizeof(Node));
@@ -310,33 +451,234 @@ static void handle_postfix(Node* node, ReTk op)
     node->kind = NodeLazyRepeatLeast1;
     node->repeat = copy;
   }
+  else if (op.ty == RepeatRange)
+  {
+    node->kind = NodeRepeat;
+    node->counted.node = copy;
+    node->counted.min = op.repeat.min;
+    node->counted.max = op.repeat.max;
+    node->counted.lazy = op.repeat.lazy;
+  }
+
+  // x*+ is (?>x*)
+  if (op.possessive)
+  {
+    Node* inner = Node_alloc();
+    memcpy(inner, node, sizeof(Node));
+    node->kind = NodeAtomic;
+    node->atomic = inner;
+  }
 }
 
 static void replaceChainsWithOrs(Node* node)
+{
+  // the chain of a one-of leans right, and only its last node is not a
+  // match
+  while (node != NULL && node->kind == NodeChain)
+  {
+    Node tmp = *node;
+    node->kind = NodeOr;
+    node->or.a = tmp.chain.a;
+    node->or.b = tmp.chain.b;
+    replaceChainsWithOrs(node->or.a);
+    node = node->or.b;
+  }
+}
+
+/** appends node to the chain that ends at *tail, and returns where the chain
+ * ends now. chains built like this lean right, like maybeChain(a, rest) */
+static Node** append(Node** tail, Node* node)
 {
   if (node == NULL)
-    return;
-  if (node->kind != NodeChain)
-    return;
-  Node tmp = *node;
-  node->kind = NodeOr;
-  node->or.a = tmp.chain.a;
-  node->or.b = tmp.chain.b;
-  Node* children[2];
-  Node_children(node, children);
-  replaceChainsWithOrs(children[0]);
-  replaceChainsWithOrs(children[1]);
+    return tail;
+  if (*tail == NULL)
+  {
+    *tail = node;
+    return tail;
+  }
+  *tail = tprec_maybeChain(*tail, node);
+  return &(*tail)->chain.b;
+}
+
+/** parses the single node that starts at toks[pos], and sets *end to the
+ * index after it. NULL if there is none */
+static Node* parse_atom(TkL const* toks, size_t pos, size_t* end)
+{
+  ReTkTy firstTy = TkL_get(toks, pos).ty;
+  size_t firstPos = TkL_get(toks, pos).where;
+  *end = pos + 1;
+
+  if (tk_isCaptureGroupOpen(firstTy))
+  {
+    size_t nesting = 0;
+    size_t close = pos;
+    for (; close < TkL_len(toks); close++)
+    {
+      ReTkTy t = TkL_get(toks, close).ty;
+      if (tk_isCaptureGroupOpen(t))
+        nesting++;
+      else if (t == CaptureGroupClose)
+      {
+        nesting--;
+        if (nesting == 0)
+          break;
+      }
+    }
+
+    // not closed
+    if (close == TkL_len(toks))
+      return NULL;
+
+    // () matches the empty string
+    Node* inner = close == pos + 1
+        ? tprec_emptyNode()
+        : tprec_parse(TkL_copy_range(toks, pos + 1, close - pos - 1));
+    *end = close + 1;
+
+    Node* self = Node_alloc();
+    self->wherePlus1 = firstPos + 1;
+    if (firstTy == CaptureGroupOpen)
+    {
+      self->kind = NodeCaptureGroup;
+      self->capture = inner;
+    }
+    else if (firstTy == CaptureGroupOpenNoCapture)
+    {
+      self->kind = NodeJustGroup;
+      self->just_group = inner;
+    }
+    else if (firstTy == CaptureGroupOpenAtomic)
+    {
+      self->kind = NodeAtomic;
+      self->atomic = inner;
+    }
+    else
+    {
+      self->kind = NodeNamedCaptureGroup;
+      self->named_capture.group = inner;
+      ReTk t = TkL_get(toks, pos);
+      char const* name = t.group_name;
+      memcpy(self->named_capture.name, name, 20);
+    }
+    return self;
+  }
+
+  if (firstTy == Match)
+    return tprec_genMatch(firstPos, TkL_get(toks, pos).match);
+
+  if (firstTy == MatchRange)
+  {
+    char from = TkL_get(toks, pos).range.from;
+    char to = TkL_get(toks, pos).range.to;
+    if (from > to)
+    {
+      char t = from;
+      from = to;
+      to = t;
+    }
+
+    size_t len = to - from + 1;
+    Node* nodes[len];
+    size_t i;
+    for (i = 0; i < len; i++)
+      nodes[i] = tprec_genMatch(firstPos, NO(from + i));
+    return tprec_oneOf(nodes, len);
+  }
+
+  if (firstTy == BackrefId)
+  {
+    Node* self = Node_alloc();
+    self->wherePlus1 = firstPos + 1;
+    self->kind = NodeBackref;
+    self->backref = TkL_get(toks, pos).group_id;
+    return self;
+  }
+
+  if (firstTy == BackrefName)
+  {
+    Node* self = Node_alloc();
+    self->wherePlus1 = firstPos + 1;
+    self->kind = NodeNamedBackref;
+    memcpy(
+        self->named_backref.name, TkL_get(toks, pos).group_name, 20);
+    return self;
+  }
+
+  if (tk_isOneOfOpen(firstTy))
+  {
+    size_t nesting = 0;
+    size_t i = pos;
+    for (; i < TkL_len(toks); i++)
+    {
+      ReTkTy t = TkL_get(toks, i).ty;
+      if (tk_isOneOfOpen(t))
+        nesting++;
+      else if (t == OneOfClose)
+      {
+        nesting--;
+        if (nesting == 0)
+          break;
+      }
+    }
+
+    // not closed
+    if (i == TkL_len(toks))
+      return NULL;
+
+    Node* self = tprec_parse(TkL_copy_range(toks, pos + 1, i - pos - 1));
+    *end = i + 1;
+
+    replaceChainsWithOrs(self);
+    if (firstTy == OneOfOpenInvert)
+    {
+      Node* new = Node_alloc();
+      new->wherePlus1 = firstPos + 1;
+      new->kind = NodeNot;
+      new->not= self;
+      self = new;
+    }
+    return self;
+  }
+
+  return NULL;
+}
+
+/** appends the tokens [begin, end) as a new case to the or cases. false on
+ * failure */
+static bool add_segment(
+    TkL** seg, size_t* len, size_t* cap, TkL const* toks, size_t begin,
+    size_t end)
+{
+  if (*len == *cap)
+  {
+    size_t new_cap = *cap ? *cap * 2 : 8;
+    TkL* new = realloc(*seg, sizeof(TkL) * new_cap);
+    if (!new)
+      return false;
+    *seg = new;
+    *cap = new_cap;
+  }
+  TkL tokl = TkL_copy_range(toks, begin, end - begin);
+  if (tokl.oom)
+    return false;
+  (*seg)[(*len)++] = tokl;
+  return true;
 }
 
 Node* tprec_parse(TkL toks)
 {
   if (TkL_len(&toks) == 0)
+  {
+    TkL_free(&toks);
     return NULL;
+  }
 
   // weird code for ors
   {
     TkL* seg = NULL;
     size_t seglen = 0;
+    size_t segcap = 0;
+    bool oom = false;
 
     // split with nesting at ors
 
@@ -355,40 +697,57 @@ Node* tprec_parse(TkL toks)
           nesting++;
         else if (t == OneOfClose)
           nesting--;
-        if (nesting == 0 && t == OrElse)
+        if (nesting == 0 && t == OrElse && !oom)
         {
-          TkL tokl = TkL_copy_range(&toks, begin, i - begin);
-          seg = realloc(seg, sizeof(*seg) * (seglen + 1));
-          seg[seglen++] = tokl;
+          oom = !add_segment(&seg, &seglen, &segcap, &toks, begin, i);
           begin = i + 1;
         }
       }
-      if (TkL_len(&toks) - begin > 0)
-      {
-        TkL tokl =
-            TkL_copy_range(&toks, begin, TkL_len(&toks) - begin);
-        seg = realloc(seg, sizeof(*seg) * (seglen + 1));
-        seg[seglen++] = tokl;
-      }
+      // without an or, there is nothing to split
+      if (seglen && !oom)
+        oom = !add_segment(&seg, &seglen, &segcap, &toks, begin, i);
+    }
+
+    if (oom)
+    {
+      for (size_t i = 0; i < seglen; i++)
+        TkL_free(&seg[i]);
+      free(seg);
+      TkL_free(&toks);
+      return NULL;
     }
 
     if (seglen >= 2)
     {
-      Node* fold = NULL;
+      // empty cases match the empty string. cases that fail to parse are
+      // left out
+      Node** cases = malloc(sizeof(Node*) * seglen);
+      size_t num = 0;
       size_t i;
       for (i = 0; i < seglen; i++)
       {
-        Node* nd = tprec_parse(seg[i]);
-        if (fold == NULL)
-          fold = nd;
+        Node* nd;
+        if (TkL_len(&seg[i]))
+          nd = tprec_parse(seg[i]);
         else
-          fold = tprec_oneOf((Node*[]) { fold, nd }, 2);
+        {
+          TkL_free(&seg[i]);
+          nd = tprec_emptyNode();
+        }
+        if (nd && cases)
+          cases[num++] = nd;
+        else
+          tprec_Node_free(nd);
       }
+      Node* fold = cases ? tprec_oneOf(cases, num) : NULL;
+      free(cases);
       free(seg);
       TkL_free(&toks);
       return fold;
     }
 
+    for (size_t i = 0; i < seglen; i++)
+      TkL_free(&seg[i]);
     free(seg);
   }
 
@@ -439,6 +798,14 @@ Node* tprec_parse(TkL toks)
         lhs = tprec_maybeChain(fold, lhs);
       fold = lhs;
 
+      // nothing to repeat
+      if (fold == NULL)
+      {
+        free(is_postfix_alloc);
+        TkL_free(&toks);
+        return NULL;
+      }
+
       handle_postfix(fold, op);
     }
 
@@ -448,155 +815,101 @@ Node* tprec_parse(TkL toks)
       return tprec_maybeChain(fold, tprec_parse(toks));
   }
 
-  ReTkTy firstTy = TkL_get(&toks, 0).ty;
-  size_t firstPos = TkL_get(&toks, 0).where;
-
-  if (tk_isCaptureGroupOpen(firstTy))
+  // a sequence of single nodes, up to the first one that doesn't parse
+  Node* fold = NULL;
+  Node** tail = &fold;
+  size_t pos = 0;
+  while (pos < TkL_len(&toks))
   {
-    size_t nesting = 0;
-    size_t close = 0;
-    for (; close < TkL_len(&toks); close++)
-    {
-      ReTkTy t = TkL_get(&toks, close).ty;
-      if (tk_isCaptureGroupOpen(t))
-        nesting++;
-      else if (t == CaptureGroupClose)
-      {
-        nesting--;
-        if (nesting == 0)
-          break;
-      }
-    }
-
-    Node* inner =
-        tprec_parse(TkL_copy_range(&toks, 1, close - 1));
-    Node* rem = tprec_parse(TkL_copy_range(
-        &toks, close + 1, TkL_len(&toks) - close - 1));
-
-    Node* self = Node_alloc();
-    self->wherePlus1 = firstPos + 1;
-    if (firstTy == CaptureGroupOpen)
-    {
-      self->kind = NodeCaptureGroup;
-      self->capture = inner;
-    }
-    else if (firstTy == CaptureGroupOpenNoCapture)
-    {
-      self->kind = NodeJustGroup;
-      self->just_group = inner;
-    }
-    else
-    {
-      self->kind = NodeNamedCaptureGroup;
-      self->named_capture.group = inner;
-      ReTk t = TkL_get(&toks, 0);
-      char const* name = t.group_name;
-      memcpy(self->named_capture.name, name, 20);
-    }
-
-    TkL_free(&toks);
-    return tprec_maybeChain(self, rem);
+    Node* self = parse_atom(&toks, pos, &pos);
+    if (self == NULL)
+      break;
+    tail = append(tail, self);
   }
 
-  if (firstTy == Match)
-  {
-    Node* rem =
-        tprec_parse(TkL_copy_range(&toks, 1, TkL_len(&toks) - 1));
-    Node* self =
-        tprec_genMatch(firstPos + 1, TkL_get(&toks, 0).match);
-
-    TkL_free(&toks);
-    return tprec_maybeChain(self, rem);
-  }
+  TkL_free(&toks);
+  return fold;
+}
 
-  if (firstTy == MatchRange)
+bool tprec_Node_class(Node* nd, tpre_class_t* out)
+{
+  switch (nd->kind)
   {
-    Node* rem =
-        tprec_parse(TkL_copy_range(&toks, 1, TkL_len(&toks) - 1));
-
-    char from = TkL_get(&toks, 0).range.from;
-    char to = TkL_get(&toks, 0).range.to;
-    if (from > to)
-    {
-      char t = from;
-      from = to;
-      to = t;
+    case NodeMatch: return tprec_pattern_class(nd->match, out);
+
+    case NodeOr: {
+      // one-ofs lean right, so this only has to remember few cases
+      tprec_stack_t todo = { 0 };
+      bool ok = true;
+      memset(out, 0, sizeof(*out));
+      while (ok && nd)
+      {
+        if (nd->kind == NodeOr)
+        {
+          ok = tprec_stack_push(&todo, nd->or.b);
+          nd = nd->or.a;
+          continue;
+        }
+        tpre_class_t b;
+        ok = tprec_Node_class(nd, &b);
+        for (size_t i = 0; ok && i < sizeof(b.bits); i++)
+          out->bits[i] |= b.bits[i];
+        nd = todo.len ? tprec_stack_pop(&todo) : NULL;
+      }
+      free(todo.items);
+      return ok;
     }
 
-    size_t len = to - from + 1;
-    Node* nodes[len];
-    size_t i;
-    for (i = 0; i < len; i++)
-      nodes[i] = tprec_genMatch(firstPos, NO(from + i));
-    Node* self = tprec_oneOf(nodes, len);
+    case NodeNot: {
+      if (!tprec_Node_class(nd->not, out))
+        return false;
+      for (size_t i = 0; i < sizeof(out->bits); i++)
+        out->bits[i] = ~out->bits[i];
+      return true;
+    }
 
-    TkL_free(&toks);
-    return tprec_maybeChain(self, rem);
+    default: return false;
   }
+}
 
-  if (firstTy == BackrefId)
-  {
-    Node* rem =
-        tprec_parse(TkL_copy_range(&toks, 1, TkL_len(&toks) - 1));
-    Node* self = Node_alloc();
-    self->wherePlus1 = firstPos + 1;
-    self->kind = NodeBackref;
-    self->backref = TkL_get(&toks, 0).group_id;
+typedef struct
+{
+  tpre_errs_t* errs;
+  int status;
+} Verify;
 
-    TkL_free(&toks);
-    return tprec_maybeChain(self, rem);
-  }
+static void verify_one(Node* nd, void* ctx)
+{
+  Verify* v = ctx;
+  Node* children[2];
+  Node_children(nd, children);
 
-  if (firstTy == BackrefName)
+  // the inside of the group failed to parse
+  bool is_group = nd->kind == NodeJustGroup ||
+      nd->kind == NodeCaptureGroup ||
+      nd->kind == NodeNamedCaptureGroup || nd->kind == NodeAtomic;
+  if (is_group && children[0] == NULL)
   {
-    Node* rem =
-        tprec_parse(TkL_copy_range(&toks, 1, TkL_len(&toks) - 1));
-    Node* self = Node_alloc();
-    self->wherePlus1 = firstPos + 1;
-    self->kind = NodeNamedBackref;
-    memcpy(
-        self->named_backref.name, TkL_get(&toks, 0).group_name,
-        20);
-
-    TkL_free(&toks);
-    return tprec_maybeChain(self, rem);
+    tprec_add_err(
+        v->errs, nd->wherePlus1 ? nd->wherePlus1 - 1 : 0,
+        "group could not be parsed");
+    v->status = 1;
   }
 
-  if (tk_isOneOfOpen(firstTy))
+  tpre_class_t cls;
+  if (nd->kind == NodeNot && !tprec_Node_class(nd, &cls))
   {
-    size_t nesting = 0;
-    size_t i = 0;
-    for (; i < TkL_len(&toks); i++)
-    {
-      ReTkTy t = TkL_get(&toks, i).ty;
-      if (tk_isOneOfOpen(t))
-        nesting++;
-      else if (t == OneOfClose)
-      {
-        nesting--;
-        if (nesting == 0)
-          break;
-      }
-    }
-
-    Node* self = tprec_parse(TkL_copy_range(&toks, 1, i - 1));
-    Node* rem = tprec_parse(
-        TkL_copy_range(&toks, i + 1, TkL_len(&toks) - i - 1));
-    TkL_free(&toks);
-
-    replaceChainsWithOrs(self);
-    if (firstTy == OneOfOpenInvert)
-    {
-      Node* new = Node_alloc();
-      new->wherePlus1 = firstPos + 1;
-      new->kind = NodeNot;
-      new->not= self;
-      self = new;
-    }
-
-    return tprec_maybeChain(self, rem);
+    tprec_add_err(
+        v->errs, nd->wherePlus1 ? nd->wherePlus1 - 1 : 0,
+        "only characters can be used in a character class");
+    v->status = 1;
   }
+}
 
-  TkL_free(&toks);
-  return NULL;
+int tprec_verify(Node* nd, tpre_errs_t* errs)
+{
+  Verify v = { errs, 0 };
+  if (tprec_Node_walk(nd, NULL, verify_one, &v))
+    return 1;
+  return v.status;
 }
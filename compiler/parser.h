@@ -13,6 +13,7 @@ typedef enum
   NodeChain,
   NodeOr,
   NodeMaybe,
+  NodeLazyMaybe,
   NodeNot,
   NodeGreedyRepeatLeast0,
   NodeGreedyRepeatLeast1,
@@ -23,6 +24,8 @@ typedef enum
   NodeNamedCaptureGroup,
   NodeBackref,
   NodeNamedBackref,
+  NodeRepeat,
+  NodeAtomic,
 } NodeKind;
 
 typedef struct Node Node;
@@ -30,6 +33,9 @@ struct Node
 {
   NodeKind kind;
   tpre_groupid_t group;
+  // the node is where its capture group begins, and the group is captured
+  // again from here on. only set if the regex has backrefs
+  bool group_begin;
   size_t wherePlus1;
   union
   {
@@ -51,6 +57,7 @@ struct Node
     Node* maybe;
     Node* repeat;
     Node* capture;
+    Node* atomic;
     Node * not;
 
     struct
@@ -65,6 +72,14 @@ struct Node
     {
       char name[20];
     } named_backref;
+
+    // max is TPREC_REPEAT_INF if unbounded
+    struct
+    {
+      Node* node;
+      uint32_t min, max;
+      bool lazy;
+    } counted;
   };
 };
 
@@ -77,6 +92,15 @@ void tprec_Node_free(Node* node);
 Node* tprec_Node_clone(Node* node);
 
 void tprec_Node_children(Node* nd, Node* childrenOut[2]);
+/** visits every node of the tree with an explicit stack, so that deep trees
+ * don't overflow the call stack. pre is called before the children of a node
+ * are visited, and can replace the node, post after them. either can be
+ * NULL. 0 = ok */
+int tprec_Node_walk(
+    Node* root,
+    void (*pre)(Node* nd, void* ctx),
+    void (*post)(Node* nd, void* ctx),
+    void* ctx);
 bool tprec_Node_eq(Node* a, Node* b);
 void tprec_Node_print(
     Node* node, FILE* file, size_t indent, bool print_grps);
@@ -84,18 +108,54 @@ void tprec_Node_print(
 Node* tprec_maybeChain(Node* a, Node* b);
 Node* tprec_oneOf(Node** nodes, size_t len);
 Node* tprec_genMatch(size_t where, tpre_pattern_t pat);
+/** a{0}, which only matches the empty string. NULL if out of memory */
+Node* tprec_emptyNode(void);
+/** how many copies of the inner node unrolling a NodeRepeat needs */
+size_t tprec_unrollSize(Node* node);
+/** replaces a NodeRepeat with copies of the inner node. false if that is not
+ * possible ({0}) */
+bool tprec_unroll(Node* node);
 
 Node* tprec_parse(TkL toks);
 
+/** bytes that a NodeMatch, or an Or / Not of those, matches. false for
+ * other nodes */
+bool tprec_Node_class(Node* nd, tpre_class_t* out);
+
+/** checks for trees that can be parsed, but not compiled. 0 = ok */
+int tprec_verify(Node* nd, tpre_errs_t* errs);
+
+/** tree that matches any of the words, taken as bytes, with the common
+ * prefixes matched only once. if first_only, the words that can never be the
+ * first to match are left out: the ones that an earlier word is a prefix of.
+ * num must not be 0. NULL if out of memory */
+Node* tprec_literals(char const* const* words, size_t num, bool first_only);
+
+/** like tpre2fsm, but from a tree that was checked with tprec_verify(), and
+ * for tpre_fsm2dfa: START is not folded away, and start_unanchored is not
+ * set, because the dfa decides where it starts itself. fails for trees with
+ * more than TPRE_DFA_MAX_STATES positions. frees nd. 0 = ok */
+int tprec_node2fsm_dfa(
+    tpre_fsm_t* out,
+    Node* nd,
+    tpre_errs_t* errs_out,
+    tpre_opts_t opts);
+
 #endif
 
 #if defined(USING_TPREC) && !defined(Node_free)
 #define Node_free tprec_Node_free
 #define Node_clone tprec_Node_clone
 #define Node_children tprec_Node_children
+#define Node_walk tprec_Node_walk
 #define Node_eq tprec_Node_eq
 #define Node_print tprec_Node_print
 #define maybeChain tprec_maybeChain
 #define oneOf tprec_oneOf
 #define genMatch tprec_genMatch
+#define emptyNode tprec_emptyNode
+#define unrollSize tprec_unrollSize
+#define unroll tprec_unroll
+#define verify tprec_verify
+#define Node_class tprec_Node_class
 #endif
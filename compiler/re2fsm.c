@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include <string.h>
 #include "../shared.h"
 #include "tpre_compiler.h"
@@ -12,112 +13,78 @@ static bool isRepeatLeast0(NodeKind k)
   return k == NodeLazyRepeatLeast0 || k == NodeGreedyRepeatLeast0;
 }
 
-static size_t count_groups(Node* nd)
+typedef struct
 {
-  if (nd == NULL)
-    return 0;
-
-  Node* children[2];
-  Node_children(nd, children);
-
-  size_t count = 0;
-
-  if (nd->kind == NodeCaptureGroup)
-    count += 1;
-
-  count += count_groups(children[0]);
-  count += count_groups(children[1]);
+  size_t groups;
+  size_t named_groups;
+} GroupCount;
 
-  return count;
-}
-
-static size_t count_named_groups(Node* nd)
+static void count_group(Node* nd, void* ctx)
 {
-  if (nd == NULL)
-    return 0;
-
-  Node* children[2];
-  Node_children(nd, children);
-
-  size_t count = 0;
-
-  if (nd->kind == NodeNamedCaptureGroup)
-    count += 1;
-
-  count += count_named_groups(children[0]);
-  count += count_named_groups(children[1]);
-
-  return count;
+  GroupCount* count = ctx;
+  if (nd->kind == NodeCaptureGroup)
+    count->groups++;
+  else if (nd->kind == NodeNamedCaptureGroup)
+    count->named_groups++;
 }
 
-static void named_groups(Node* nd, char*** out)
+static void named_group(Node* nd, void* ctx)
 {
-  if (nd == NULL)
-    return;
-  Node* children[2];
-  Node_children(nd, children);
-
+  char*** out = ctx;
   if (nd->kind == NodeNamedCaptureGroup)
   {
     **out = tprec_strdup(nd->named_capture.name);
     (*out)++;
   }
-
-  named_groups(children[0], out);
-  named_groups(children[1], out);
 }
 
-static void groups(
-    Node* nd,
-    tpre_groupid_t group,
-    tpre_groupid_t* global_next_group_id,
-    tpre_groupid_t* next_named_gr)
+typedef struct
 {
-  if (nd == NULL)
-    return;
-  Node* children[2];
-  Node_children(nd, children);
+  tpre_groupid_t next_group;
+  tpre_groupid_t next_named_group;
+} Groups;
 
-  if (nd->kind == NodeJustGroup)
-  {
-    memcpy(nd, nd->just_group, sizeof(Node));
-    groups(nd, group, global_next_group_id, next_named_gr);
-    return;
-  }
-
-  if (nd->kind == NodeCaptureGroup)
-  {
-    memcpy(nd, nd->capture, sizeof(Node));
-    groups(
-        nd, (*global_next_group_id)++, global_next_group_id,
-        next_named_gr);
-    return;
-  }
-
-  if (nd->kind == NodeNamedCaptureGroup)
+/** removes the group nodes at nd, and gives nd and its children the group
+ * they are in. the parent already set the group of nd */
+static void group_one(Node* nd, void* ctx)
+{
+  Groups* g = ctx;
+  tpre_groupid_t group = nd->group;
+  for (;;)
   {
-    memcpy(nd, nd->named_capture.group, sizeof(Node));
-    groups(
-        nd, (*next_named_gr)++, global_next_group_id,
-        next_named_gr);
-    return;
+    Node* inner;
+    if (nd->kind == NodeJustGroup)
+      inner = nd->just_group;
+    else if (nd->kind == NodeCaptureGroup)
+    {
+      inner = nd->capture;
+      group = g->next_group++;
+    }
+    else if (nd->kind == NodeNamedCaptureGroup)
+    {
+      inner = nd->named_capture.group;
+      group = g->next_named_group++;
+    }
+    else
+      break;
+    memcpy(nd, inner, sizeof(Node));
+    free(inner);
   }
 
   nd->group = group;
-  groups(children[0], group, global_next_group_id, next_named_gr);
-  groups(children[1], group, global_next_group_id, next_named_gr);
-}
-
-static void rewr_repleast1_to_repleast0(Node* node)
-{
-  if (node == NULL)
-    return;
   Node* children[2];
-  Node_children(node, children);
+  Node_children(nd, children);
+  for (int i = 0; i < 2; i++)
+    if (children[i])
+      children[i]->group = group;
+}
 
-  rewr_repleast1_to_repleast0(children[0]);
-  rewr_repleast1_to_repleast0(children[1]);
+// the rewr_*() are rewrites of a single node, done after its children with
+// Node_walk()
 
+static void rewr_repleast1_to_repleast0(Node* node, void* ctx)
+{
+  (void) ctx;
   if (node->kind == NodeLazyRepeatLeast1)
   {
     Node* first = Node_clone(node->repeat);
@@ -145,19 +112,104 @@ static void rewr_repleast1_to_repleast0(Node* node)
   }
 }
 
-static void rewr_nested_repleast0(Node* node)
+/** results of the children of the nodes that count_positions() visited */
+typedef struct
 {
-  if (node == NULL)
+  tprec_stack_t results;
+  bool oom;
+} Positions;
+
+static bool isClassCase(Node* nd)
+{
+  return nd->kind == NodeMatch || nd->kind == NodeNot || nd->kind == NodeOr;
+}
+
+static void positions_one(Node* nd, void* ctx)
+{
+  Positions* p = ctx;
+  if (p->oom)
     return;
   Node* children[2];
-  Node_children(node, children);
+  Node_children(nd, children);
+  uint64_t b = children[1] ? (uintptr_t) tprec_stack_pop(&p->results) : 0;
+  uint64_t a = children[0] ? (uintptr_t) tprec_stack_pop(&p->results) : 0;
 
-  rewr_nested_repleast0(children[0]);
-  rewr_nested_repleast0(children[1]);
+  uint64_t r;
+  switch (nd->kind)
+  {
+    case NodeMatch:
+    case NodeNot:   r = 1; break;
+
+    // the cases of a class are followed by the same positions, so
+    // minimizing the fsm merges them into one node
+    case NodeOr:
+      r = a + b;
+      if (a == 1 && b == 1 && isClassCase(children[0]) &&
+          isClassCase(children[1]))
+        r = 1;
+      break;
+
+    // the rewrites below clone the node
+    case NodeGreedyRepeatLeast1:
+    case NodeLazyRepeatLeast1:   r = a * 2; break;
+    case NodeRepeat:             r = a * unrollSize(nd); break;
+
+    default: r = a + b; break;
+  }
+  // only compared with the limit, so this can't overflow
+  if (r > TPRE_DFA_MAX_STATES)
+    r = TPRE_DFA_MAX_STATES + 1;
+  if (!tprec_stack_push(&p->results, (void*) (uintptr_t) r))
+    p->oom = true;
+}
 
+/** how many nodes the fsm of the node will have after minimizing, about.
+ * more than TPRE_DFA_MAX_STATES if it's more than that. without unrolling
+ * anything */
+static uint64_t count_positions(Node* nd)
+{
+  Positions p = { 0 };
+  uint64_t r = Node_walk(nd, NULL, positions_one, &p) || p.oom
+      ? TPRE_DFA_MAX_STATES + 1
+      : (uintptr_t) tprec_stack_pop(&p.results);
+  free(p.results.items);
+  return r;
+}
+
+// the fsm can't count, so counted repeats get unrolled, up to this many copies
+#define TPREC_FSM_UNROLL_MAX (1024)
+
+typedef struct
+{
+  tpre_errs_t* errs;
+  int status;
+} Unroll;
+
+static void rewr_unroll(Node* node, void* ctx)
+{
+  Unroll* u = ctx;
+  // {0} is handled by the fsm construction directly
+  if (u->status || node->kind != NodeRepeat || node->counted.max == 0)
+    return;
+  if (unrollSize(node) > TPREC_FSM_UNROLL_MAX || !unroll(node))
+  {
+    tprec_add_err(
+        u->errs, node->wherePlus1 ? node->wherePlus1 - 1 : 0,
+        "counted repetition not supported in the fsm");
+    u->status = 1;
+  }
+}
+
+static void rewr_nested_repleast0(Node* node, void* ctx)
+{
+  (void) ctx;
+  // same as fix_3() of the backtracking compiler, (x*)*? is left alone
   if (isRepeatLeast0(node->kind) &&
-      isRepeatLeast0(node->repeat->kind))
+      isRepeatLeast0(node->repeat->kind) &&
+      !(node->kind == NodeLazyRepeatLeast0 &&
+        node->repeat->kind == NodeGreedyRepeatLeast0))
   {
+    node->kind = node->repeat->kind;
     node->wherePlus1 = node->repeat->wherePlus1;
     node->group = node->repeat->group;
     Node* old = node->repeat;
@@ -166,49 +218,496 @@ static void rewr_nested_repleast0(Node* node)
   }
 }
 
-int tpre2fsm(
-    tpre_fsm_t* out,
-    char const* str,
-    tpre_errs_t* errs_out,
-    tpre_opts_t opts)
+/*
+ * the fsm is built as prioritized position automaton: every Match and Not
+ * node is a position and gets one fsm node, for the state after matching it.
+ * the cases of that fsm node are the positions that can follow, in the order
+ * in which the backtracking runtime would try them. this way no empty
+ * transitions are needed.
+ */
+
+// ordered list of positions. NULL is the empty match
+typedef struct
 {
-  tpre_fsm_init(out);
+  size_t len, cap;
+  Node** items;
+} PosLi;
 
-  if (errs_out)
+// end of the pattern
+static Node accept_pos;
+#define ACCEPT (&accept_pos)
+
+typedef struct
+{
+  tpre_errs_t* errs;
+  bool oom;
+  bool err;
+
+  // sorted by address
+  Node** pos;
+  size_t npos;
+
+  // indexed like pos
+  PosLi* follow;
+  tpre_fsm_node_t** nodes;
+
+  // indexed like pos, + 1 for ACCEPT
+  uint32_t* stamp;
+  uint32_t cur_stamp;
+} Glushkov;
+
+static void PosLi_add(Glushkov* g, PosLi* li, Node* p)
+{
+  if (li->len == li->cap)
   {
-    errs_out->len = 0;
-    errs_out->items = NULL;
+    size_t cap = li->cap ? li->cap * 2 : 4;
+    void* items = realloc(li->items, sizeof(Node*) * cap);
+    if (!items)
+    {
+      g->oom = true;
+      return;
+    }
+    li->items = items;
+    li->cap = cap;
+  }
+  li->items[li->len++] = p;
+}
+
+static bool isPosition(Node* nd)
+{
+  return nd->kind == NodeMatch || nd->kind == NodeNot;
+}
+
+static void collect_positions(Glushkov* g, Node* nd, PosLi* out)
+{
+  tprec_stack_t todo = { 0 };
+  while (nd)
+  {
+    Node* next = NULL;
+    if (isPosition(nd))
+      PosLi_add(g, out, nd);
+    // never matched
+    else if (nd->kind != NodeRepeat)
+    {
+      Node* children[2];
+      Node_children(nd, children);
+      if (children[1] && !tprec_stack_push(&todo, children[1]))
+        g->oom = true;
+      next = children[0];
+    }
+    nd = next || !todo.len ? next : tprec_stack_pop(&todo);
   }
+  free(todo.items);
+}
 
-  TkL li = { 0 };
-  if (tprec_lexe(&li, errs_out, str, &opts))
-    return 1;
-  if (li.oom)
-    return 1;
-  Node* nd = tprec_parse(li);
-  if (!nd)
+static int cmp_ptr(void const* a, void const* b)
+{
+  uintptr_t x = (uintptr_t) * (Node* const*) a;
+  uintptr_t y = (uintptr_t) * (Node* const*) b;
+  return x < y ? -1 : x > y;
+}
+
+static size_t pos_idx(Glushkov const* g, Node* p)
+{
+  if (p == ACCEPT)
+    return g->npos;
+  Node** found = bsearch(&p, g->pos, g->npos, sizeof(Node*), cmp_ptr);
+  return (size_t) (found - g->pos);
+}
+
+/** removes everything but the first occurrence of each position */
+static void dedup(Glushkov* g, PosLi* li)
+{
+  g->cur_stamp++;
+  bool eps = false;
+  size_t keep = 0;
+  for (size_t i = 0; i < li->len; i++)
   {
-    if (li.len)
-      tprec_add_err(
-          errs_out, TkL_get(&li, 0).where, "unparsed tokens");
+    Node* p = li->items[i];
+    if (p == NULL)
+    {
+      if (eps)
+        continue;
+      eps = true;
+    }
+    else
+    {
+      size_t idx = pos_idx(g, p);
+      if (g->stamp[idx] == g->cur_stamp)
+        continue;
+      g->stamp[idx] = g->cur_stamp;
+    }
+    li->items[keep++] = p;
+  }
+  li->len = keep;
+}
+
+static void glushkov_err(Glushkov* g, Node* nd, char const* msg)
+{
+  g->err = true;
+  tprec_add_err(g->errs, nd->wherePlus1 ? nd->wherePlus1 - 1 : 0, msg);
+}
+
+/** appends the positions that can be matched first, in priority order.
+ * only recurses into groups, the rests of chains and ors are looped over */
+static void first(Glushkov* g, Node* nd, PosLi* out)
+{
+  // the positions after the empty match of the first part of a chain come
+  // after the ones of the rest of the chain. they wait in rest, from the
+  // offsets in starts
+  PosLi rest = { 0 };
+  tprec_stack_t starts = { 0 };
+  while (nd)
+  {
+    Node* next = NULL;
+    switch (nd->kind)
+    {
+      case NodeMatch:
+      case NodeNot:   PosLi_add(g, out, nd); break;
+
+      case NodeChain: {
+        PosLi fa = { 0 };
+        first(g, nd->chain.a, &fa);
+        size_t num_empty = 0;
+        for (size_t i = 0; i < fa.len; i++)
+          num_empty += fa.items[i] == NULL;
+
+        if (num_empty == 1)
+        {
+          size_t i = 0;
+          for (; fa.items[i]; i++)
+            PosLi_add(g, out, fa.items[i]);
+          if (!tprec_stack_push(&starts, (void*) (uintptr_t) rest.len))
+            g->oom = true;
+          for (i++; i < fa.len; i++)
+            PosLi_add(g, &rest, fa.items[i]);
+          next = nd->chain.b;
+        }
+        else
+        {
+          for (size_t i = 0; i < fa.len; i++)
+          {
+            if (fa.items[i])
+              PosLi_add(g, out, fa.items[i]);
+            else
+              first(g, nd->chain.b, out);
+          }
+        }
+        free(fa.items);
+      }
+      break;
+
+      case NodeOr:
+        first(g, nd->or.a, out);
+        next = nd->or.b;
+        break;
+
+      case NodeMaybe:
+        first(g, nd->maybe, out);
+        PosLi_add(g, out, NULL);
+        break;
+
+      case NodeLazyMaybe:
+        PosLi_add(g, out, NULL);
+        first(g, nd->maybe, out);
+        break;
+
+      case NodeGreedyRepeatLeast0:
+        first(g, nd->repeat, out);
+        PosLi_add(g, out, NULL);
+        break;
+
+      case NodeLazyRepeatLeast0:
+        PosLi_add(g, out, NULL);
+        first(g, nd->repeat, out);
+        break;
+
+      // only {0} is left after rewr_unroll()
+      case NodeRepeat: PosLi_add(g, out, NULL); break;
+
+      default: break;
+    }
+    nd = next;
+  }
+
+  while (starts.len)
+  {
+    size_t start = (size_t) (uintptr_t) tprec_stack_pop(&starts);
+    for (size_t i = start; i < rest.len; i++)
+      PosLi_add(g, out, rest.items[i]);
+    rest.len = start;
+  }
+  free(rest.items);
+  free(starts.items);
+}
+
+/** first(nd), with the empty match replaced by next */
+static void first_then(Glushkov* g, Node* nd, PosLi const* next, PosLi* out)
+{
+  PosLi fst = { 0 };
+  first(g, nd, &fst);
+  for (size_t i = 0; i < fst.len; i++)
+  {
+    if (fst.items[i])
+      PosLi_add(g, out, fst.items[i]);
+    else
+      for (size_t j = 0; j < next->len; j++)
+        PosLi_add(g, out, next->items[j]);
+  }
+  free(fst.items);
+  if (!g->oom)
+    dedup(g, out);
+}
+
+/** computes follow() of all positions in nd, if nd is followed by next.
+ * only recurses into groups, like first() */
+static void build(Glushkov* g, Node* nd, PosLi const* next)
+{
+  // the rest of a chain is followed by next too, so it is built first. the
+  // first parts are followed by the rest, and are built after, from the
+  // last chain back
+  tprec_stack_t chains = { 0 };
+  while (nd && !g->oom && !g->err)
+  {
+    Node* tail = NULL;
+    switch (nd->kind)
+    {
+      case NodeMatch:
+      case NodeNot:   {
+        PosLi* li = &g->follow[pos_idx(g, nd)];
+        for (size_t i = 0; i < next->len; i++)
+          PosLi_add(g, li, next->items[i]);
+      }
+      break;
+
+      case NodeChain:
+        if (!tprec_stack_push(&chains, nd))
+          g->oom = true;
+        tail = nd->chain.b;
+        break;
+
+      case NodeOr:
+        build(g, nd->or.a, next);
+        tail = nd->or.b;
+        break;
+
+      case NodeMaybe:
+      case NodeLazyMaybe: build(g, nd->maybe, next); break;
+
+      case NodeRepeat: break;
+
+      case NodeGreedyRepeatLeast0:
+      case NodeLazyRepeatLeast0:   {
+        // empty iterations are never repeated
+        bool lazy = nd->kind == NodeLazyRepeatLeast0;
+        PosLi loop = { 0 };
+        if (lazy)
+          for (size_t i = 0; i < next->len; i++)
+            PosLi_add(g, &loop, next->items[i]);
+        first(g, nd->repeat, &loop);
+        if (!lazy)
+          for (size_t i = 0; i < next->len; i++)
+            PosLi_add(g, &loop, next->items[i]);
+
+        size_t keep = 0;
+        for (size_t i = 0; i < loop.len; i++)
+          if (loop.items[i])
+            loop.items[keep++] = loop.items[i];
+        loop.len = keep;
+
+        if (!g->oom)
+          dedup(g, &loop);
+        build(g, nd->repeat, &loop);
+        free(loop.items);
+      }
+      break;
+
+      case NodeBackref:
+      case NodeNamedBackref:
+        glushkov_err(g, nd, "backreferences are not supported in the fsm");
+        break;
+
+      case NodeAtomic:
+        glushkov_err(
+            g, nd,
+            "atomic groups and possessive quantifiers are not supported in "
+            "the fsm");
+        break;
+
+      default: glushkov_err(g, nd, "unexpected node"); break;
+    }
+    nd = tail;
+  }
+
+  while (chains.len && !g->oom && !g->err)
+  {
+    Node* chain = tprec_stack_pop(&chains);
+    PosLi na = { 0 };
+    first_then(g, chain->chain.b, next, &na);
+    build(g, chain->chain.a, &na);
+    free(na.items);
+  }
+  free(chains.items);
+}
+
+/** bytes matched by a position. 0 = ok */
+static int position_class(Glushkov* g, Node* nd, tpre_class_t* out)
+{
+  if (nd->kind == NodeMatch)
+  {
+    if (tprec_pattern_class(nd->match, out))
+      return 0;
+    glushkov_err(g, nd, "pattern can not be used here");
     return 1;
   }
 
-  if (opts.start_unanchored)
+  if (nd->kind == NodeOr)
+  {
+    tpre_class_t b;
+    if (position_class(g, nd->or.a, out) ||
+        position_class(g, nd->or.b, &b))
+      return 1;
+    for (size_t i = 0; i < sizeof(b.bits); i++)
+      out->bits[i] |= b.bits[i];
+    return 0;
+  }
+
+  if (nd->kind == NodeNot)
   {
-    Node* any = Node_alloc();
-    any->kind = NodeMatch;
-    any->match = SP(SPECIAL_ANY);
+    if (position_class(g, nd->not, out))
+      return 1;
+    for (size_t i = 0; i < sizeof(out->bits); i++)
+      out->bits[i] = ~out->bits[i];
+    return 0;
+  }
 
-    Node* rep = Node_alloc();
-    rep->kind = NodeLazyRepeatLeast0;
-    rep->repeat = any;
+  glushkov_err(g, nd, "only characters can be used in a character class");
+  return 1;
+}
 
-    nd = maybeChain(rep, nd);
+static int add_case(Glushkov* g, tpre_fsm_t* fsm, tpre_fsm_node_t* from, Node* to)
+{
+  tpre_fsm_case_t cas = { 0 };
+  if (to == ACCEPT)
+  {
+    cas.pat.kind = TPRE_FSM_PAT_EMPTY;
+    cas.then = fsm->nd_ok;
   }
   else
   {
-    // TODO: opt pass to remove all pat_start if know we are at start (on fsm level)
+    cas.then = g->nodes[pos_idx(g, to)];
+    cas.group = to->group;
+    if (to->kind == NodeMatch && to->match.is_special &&
+        to->match.val == SPECIAL_START)
+      cas.pat.kind = TPRE_FSM_PAT_START;
+    else if (to->kind == NodeMatch && to->match.is_special &&
+             to->match.val == SPECIAL_END)
+      cas.pat.kind = TPRE_FSM_PAT_END;
+    else
+    {
+      tpre_class_t bits;
+      if (position_class(g, to, &bits))
+        return 1;
+      if (tpre_fsm_pat_from_bits(&cas.pat, &bits))
+      {
+        g->oom = true;
+        return 1;
+      }
+    }
+  }
+
+  if (tpre_fsm_addcase(from, cas))
+  {
+    g->oom = true;
+    return 1;
+  }
+  return 0;
+}
+
+static int add_cases(
+    Glushkov* g, tpre_fsm_t* fsm, tpre_fsm_node_t* from, PosLi const* li)
+{
+  for (size_t i = 0; i < li->len; i++)
+    if (add_case(g, fsm, from, li->items[i]))
+      return 1;
+  return 0;
+}
+
+static int glushkov(tpre_fsm_t* fsm, Node* nd, tpre_errs_t* errs)
+{
+  Glushkov g = { 0 };
+  g.errs = errs;
+
+  PosLi all = { 0 };
+  collect_positions(&g, nd, &all);
+  g.pos = all.items;
+  g.npos = all.len;
+  if (g.npos)
+    qsort(g.pos, g.npos, sizeof(Node*), cmp_ptr);
+
+  g.follow = calloc(g.npos + 1, sizeof(PosLi));
+  g.nodes = calloc(g.npos + 1, sizeof(tpre_fsm_node_t*));
+  g.stamp = calloc(g.npos + 1, sizeof(uint32_t));
+  if (!g.follow || !g.nodes || !g.stamp)
+    g.oom = true;
+
+  size_t i;
+  for (i = 0; !g.oom && i < g.npos; i++)
+  {
+    g.nodes[i] = tpre_fsm_mknd(fsm);
+    if (!g.nodes[i])
+      g.oom = true;
+  }
+
+  PosLi accept = { 0 };
+  PosLi start = { 0 };
+  if (!g.oom)
+  {
+    PosLi_add(&g, &accept, ACCEPT);
+    build(&g, nd, &accept);
+    first_then(&g, nd, &accept, &start);
+  }
+
+  if (!g.oom && !g.err)
+  {
+    fsm->first = tpre_fsm_mknd(fsm);
+    if (!fsm->first)
+      g.oom = true;
+  }
+
+  if (!g.oom && !g.err)
+    add_cases(&g, fsm, fsm->first, &start);
+  for (i = 0; !g.oom && !g.err && i < g.npos; i++)
+    add_cases(&g, fsm, g.nodes[i], &g.follow[i]);
+
+  int status = g.oom || g.err;
+  if (g.follow)
+    for (i = 0; i < g.npos; i++)
+      free(g.follow[i].items);
+  free(g.follow);
+  free(g.nodes);
+  free(g.stamp);
+  free(g.pos);
+  free(accept.items);
+  free(start.items);
+  return status;
+}
+
+/** the part of re2fsm() after parsing. frees nd, and out on failure */
+static int node2fsm(
+    tpre_fsm_t* out,
+    Node* nd,
+    tpre_errs_t* errs_out,
+    tpre_opts_t opts,
+    bool for_dfa)
+{
+  // the loop that starts over is added by tpre_fsm2re(), so that the
+  // runtime knows where matches begin
+  if (opts.start_unanchored && !for_dfa)
+    out->start_unanchored = true;
+  else if (!opts.start_unanchored)
+  {
+    // removed by tpre_fsm_fold_start() if we know that we are at the start
     Node* start = Node_alloc();
     start->kind = NodeMatch;
     start->match = SP(SPECIAL_START);
@@ -225,36 +724,121 @@ int tpre2fsm(
     nd = maybeChain(nd, end);
   }
 
-  // rewrites:
-  rewr_repleast1_to_repleast0(nd);
-  rewr_nested_repleast0(nd);
+  // dfas rarely have fewer states than the fsm has nodes, and finding out
+  // that there are too many takes long
+  if (for_dfa && count_positions(nd) > TPRE_DFA_MAX_STATES)
+  {
+    tprec_add_err(errs_out, 0, "regex too complex for a dfa");
+    Node_free(nd);
+    tpre_fsm_free(out);
+    return 1;
+  }
 
-  Node_print(nd, stdout, 0, true);
+  GroupCount count = { 0 };
+  char** named_groupsp = NULL;
+  if (!Node_walk(nd, count_group, NULL, &count))
+    named_groupsp = calloc(count.named_groups, sizeof(char*));
+  if (!named_groupsp)
+  {
+    Node_free(nd);
+    tpre_fsm_free(out);
+    return 1;
+  }
+  out->first_named_group = count.groups + 1;
+  out->named_groups = (char const**) named_groupsp;
+  out->num_named_groups = count.named_groups;
+
+  Groups g = { .next_group = 1,
+               .next_named_group = out->first_named_group };
+  nd->group = 0;
+  int status = Node_walk(nd, named_group, NULL, &named_groupsp) ||
+      Node_walk(nd, group_one, NULL, &g);
+  out->total_num_groups = g.next_named_group;
+
+  // rewrites (after assigning groups, because these clone nodes):
+  Unroll u = { errs_out, 0 };
+  if (!status)
+    status = Node_walk(nd, NULL, rewr_unroll, &u) || u.status ||
+        Node_walk(nd, NULL, rewr_repleast1_to_repleast0, NULL) ||
+        Node_walk(nd, NULL, rewr_nested_repleast0, NULL);
+
+  // first lower to fsm without backtrack info, and then figure out known
+  // backtracks
+  if (!status)
+    status = !out->nd_ok || !out->nd_err || glushkov(out, nd, errs_out);
+  Node_free(nd);
+
+  if (!status && for_dfa)
+    status = tpre_fsm_minimize(out);
+  else if (!status)
+    status = tpre_fsm_fold_start(out) || tpre_fsm_minimize(out) ||
+        tpre_fsm_known_backtracks(out);
+
+  if (status)
+    tpre_fsm_free(out);
+  return status;
+}
 
-  if (1)
+static int re2fsm(
+    tpre_fsm_t* out,
+    char const* str,
+    tpre_errs_t* errs_out,
+    tpre_opts_t opts,
+    bool for_dfa)
+{
+  tpre_fsm_init(out);
+
+  if (errs_out)
   {
-    size_t num_groups = count_groups(nd);
-    size_t num_named_groups = count_named_groups(nd);
+    errs_out->len = 0;
+    errs_out->items = NULL;
+  }
 
-    out->first_named_group = num_groups + 1;
-    out->num_named_groups = num_named_groups;
-    char** named_groupsp =
-        malloc(sizeof(char*) * num_named_groups);
-    if (!named_groupsp)
-    {
-      Node_free(nd);
-      return 1;
-    }
-    named_groups(nd, &named_groupsp);
-    out->named_groups = (char const**) named_groupsp;
+  TkL li = { 0 };
+  if (tprec_lexe(&li, errs_out, str, &opts) || li.oom)
+  {
+    tpre_fsm_free(out);
+    return 1;
+  }
+  // tprec_parse() frees the tokens
+  bool has_tokens = li.len != 0;
+  size_t first_where = has_tokens ? TkL_get(&li, 0).where : 0;
+  Node* nd = tprec_parse(li);
+  // the empty regex matches the empty string
+  if (!nd && !has_tokens)
+    nd = emptyNode();
+  if (!nd)
+  {
+    if (has_tokens)
+      tprec_add_err(errs_out, first_where, "unparsed tokens");
+    tpre_fsm_free(out);
+    return 1;
+  }
+  if (verify(nd, errs_out))
+  {
+    Node_free(nd);
+    tpre_fsm_free(out);
+    return 1;
+  }
 
-    tpre_groupid_t nextgr = 1;
-    tpre_groupid_t next_named_gr = out->first_named_group;
-    groups(nd, 0, &nextgr, &next_named_gr);
-  };
+  return node2fsm(out, nd, errs_out, opts, for_dfa);
+}
 
-  // TODO: first lower to fsm without backtrack info, and then figure out known backtracks?
+int tpre2fsm(
+    tpre_fsm_t* out,
+    char const* str,
+    tpre_errs_t* errs_out,
+    tpre_opts_t opts)
+{
+  return re2fsm(out, str, errs_out, opts, false);
+}
 
-  Node_free(nd);
-  return 0;
+int tprec_node2fsm_dfa(
+    tpre_fsm_t* out,
+    Node* nd,
+    tpre_errs_t* errs_out,
+    tpre_opts_t opts)
+{
+  tpre_fsm_init(out);
+  return node2fsm(out, nd, errs_out, opts, true);
 }
@@ -1,8 +1,8 @@
 #include "utils.h"
-#include <assert.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include "../shared.h"
 
 char* tprec_strdup(char const* s)
 {
@@ -58,13 +58,43 @@ void tprec_re_setnode(
     re->max_group = nd.group;
 }
 
+/** tpre_re_t doesn't store capacities: arrays that grow one by one are
+ * allocated to the next power of two of their length */
+static size_t grown_cap(size_t len)
+{
+  size_t cap = 16;
+  while (cap < len)
+    cap *= 2;
+  return cap;
+}
+
+/** whether an array of len items, allocated with grown_cap(), has to be
+ * reallocated to hold len + add items */
+static bool needs_grow(void const* items, size_t len, size_t add)
+{
+  return !items || grown_cap(len) < len + add;
+}
+
 tpre_nodeid_t tprec_re_addnode(tpre_re_t* re, tpre_re_node_t nd)
 {
-  re->i = realloc(re->i, sizeof(*re->i) * (re->num_nodes + 1));
-  assert(re->i); // TODO: no
-  re->i[re->num_nodes] = nd;
+  size_t n = (size_t) re->num_nodes;
+  if (re->num_nodes == INT32_MAX)
+    return NODE_ERR;
+  if (needs_grow(re->i, n, 1))
+  {
+    void* i = realloc(re->i, sizeof(*re->i) * grown_cap(n + 1));
+    if (!i)
+      return NODE_ERR;
+    re->i = i;
+    re->free = true;
+    void* wherePlus1 =
+        realloc(re->wherePlus1, sizeof(*re->wherePlus1) * grown_cap(n + 1));
+    if (!wherePlus1)
+      return NODE_ERR;
+    re->wherePlus1 = wherePlus1;
+  }
+  re->wherePlus1[re->num_nodes] = 0;
   tprec_re_setnode(re, re->num_nodes, nd);
-  re->free = true;
   return re->num_nodes++;
 }
 
@@ -72,3 +102,189 @@ tpre_nodeid_t tprec_re_resvnode(tpre_re_t* re)
 {
   return tprec_re_addnode(re, (tpre_re_node_t) { 0 });
 }
+
+int tprec_re_addloop(tpre_re_t* re, tpre_loop_t loop)
+{
+  if (re->num_loops == UINT16_MAX)
+    return -1;
+  void* loops =
+      realloc(re->loops, sizeof(*re->loops) * (re->num_loops + 1));
+  if (!loops)
+    return -1;
+  re->loops = loops;
+  re->loops[re->num_loops] = loop;
+  re->free = true;
+  return re->num_loops++;
+}
+
+int tprec_re_addrun(tpre_re_t* re, tpre_run_t run)
+{
+  for (uint16_t i = 0; i < re->num_runs; i++)
+    if (re->runs[i].lazy == run.lazy && re->runs[i].cls == run.cls)
+      return i;
+
+  if (re->num_runs == UINT16_MAX)
+    return -1;
+  void* runs = realloc(re->runs, sizeof(*re->runs) * (re->num_runs + 1));
+  if (!runs)
+    return -1;
+  re->runs = runs;
+  re->runs[re->num_runs] = run;
+  re->free = true;
+  return re->num_runs++;
+}
+
+int tprec_re_addstring(tpre_re_t* re, uint8_t const* bytes, uint16_t len)
+{
+  if (re->num_strings == UINT16_MAX ||
+      re->num_string_bytes > UINT32_MAX - len)
+    return -1;
+  if (needs_grow(re->strings, re->num_strings, 1))
+  {
+    void* strings = realloc(
+        re->strings, sizeof(*re->strings) * grown_cap(re->num_strings + 1));
+    if (!strings)
+      return -1;
+    re->strings = strings;
+  }
+  if (needs_grow(re->string_bytes, re->num_string_bytes, len))
+  {
+    void* string_bytes = realloc(
+        re->string_bytes, grown_cap((size_t) re->num_string_bytes + len));
+    if (!string_bytes)
+      return -1;
+    re->string_bytes = string_bytes;
+  }
+
+  memcpy(re->string_bytes + re->num_string_bytes, bytes, len);
+  re->strings[re->num_strings] =
+      (tpre_string_t) { .off = re->num_string_bytes, .len = len };
+  re->num_string_bytes += len;
+  re->free = true;
+  return re->num_strings++;
+}
+
+int tprec_re_addslot(tpre_re_t* re, bool counter)
+{
+  // UINT16_MAX is TPRE_NO_SLOT
+  if (re->num_slots == UINT16_MAX)
+    return -1;
+  if (counter)
+    re->num_counters++;
+  return re->num_slots++;
+}
+
+int tprec_re_addclass(tpre_re_t* re, tpre_class_t cls)
+{
+  for (uint16_t i = 0; i < re->num_classes; i++)
+    if (!memcmp(re->classes[i].bits, cls.bits, sizeof(cls.bits)))
+      return i;
+
+  if (re->num_classes == UINT16_MAX)
+    return -1;
+  void* classes =
+      realloc(re->classes, sizeof(*re->classes) * (re->num_classes + 1));
+  if (!classes)
+    return -1;
+  re->classes = classes;
+  re->classes[re->num_classes] = cls;
+  re->free = true;
+  return re->num_classes++;
+}
+
+bool tprec_pattern_class(tpre_pattern_t pat, tpre_class_t* out)
+{
+  memset(out, 0, sizeof(*out));
+  unsigned c;
+
+  if (!pat.is_special)
+  {
+    tprec_class_add(out, pat.val);
+    return true;
+  }
+
+  switch (pat.val)
+  {
+    case SPECIAL_ANY:
+      for (c = 0; c < 256; c++)
+        tprec_class_add(out, c);
+      return true;
+
+    case SPECIAL_SPACE:
+      tprec_class_add(out, ' ');
+      tprec_class_add(out, '\t');
+      tprec_class_add(out, '\n');
+      tprec_class_add(out, '\r');
+      break;
+
+    case SPECIAL_DIGIT:
+      for (c = '0'; c <= '9'; c++)
+        tprec_class_add(out, c);
+      break;
+
+    case SPECIAL_WORDC:
+      for (c = '0'; c <= '9'; c++)
+        tprec_class_add(out, c);
+      for (c = 'a'; c <= 'z'; c++)
+        tprec_class_add(out, c);
+      for (c = 'A'; c <= 'Z'; c++)
+        tprec_class_add(out, c);
+      tprec_class_add(out, '_');
+      break;
+
+    default: return false;
+  }
+
+  if (pat.invert)
+  {
+    for (c = 0; c < 32; c++)
+      out->bits[c] = ~out->bits[c];
+  }
+  return true;
+}
+
+int tprec_class_pattern(
+    tpre_re_t* re, tpre_class_t const* bits, tpre_pattern_t* out)
+{
+  size_t count = 0;
+  unsigned c, last = 0;
+  for (c = 0; c < 256; c++)
+  {
+    if (tprec_class_has(bits, c))
+    {
+      count++;
+      last = c;
+    }
+  }
+  if (count == 1)
+  {
+    *out = NO(last);
+    return 0;
+  }
+
+  // prefer the patterns that the runtime knows without the class table
+  static uint8_t const known[] = { SPECIAL_ANY, SPECIAL_SPACE, SPECIAL_DIGIT,
+                                   SPECIAL_WORDC };
+  for (size_t i = 0; i < sizeof(known); i++)
+  {
+    for (uint8_t invert = 0; invert < 2; invert++)
+    {
+      tpre_pattern_t cand = SP(known[i]);
+      cand.invert = invert;
+      tpre_class_t cb;
+      if (tprec_pattern_class(cand, &cb) &&
+          !memcmp(cb.bits, bits->bits, sizeof(bits->bits)))
+      {
+        *out = cand;
+        return 0;
+      }
+    }
+  }
+
+  int cls = tprec_re_addclass(re, *bits);
+  if (cls < 0)
+    return 1;
+  *out = SP(SPECIAL_CLASS);
+  out->arg = (uint16_t) cls;
+  return 0;
+}
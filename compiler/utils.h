@@ -1,11 +1,43 @@
 #ifndef _TPREC_UTILS_H
 #define _TPREC_UTILS_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include "include/tpre_compiler.h"
 
 char* tprec_strdup(char const* s);
 
+/** growable stack of pointers, for walking trees without recursing */
+typedef struct
+{
+  void** items;
+  size_t len;
+  size_t cap;
+} tprec_stack_t;
+
+/** false if out of memory */
+static inline bool tprec_stack_push(tprec_stack_t* st, void* item)
+{
+  if (st->len == st->cap)
+  {
+    size_t cap = st->cap ? st->cap * 2 : 32;
+    void** items = realloc(st->items, sizeof(void*) * cap);
+    if (!items)
+      return false;
+    st->items = items;
+    st->cap = cap;
+  }
+  st->items[st->len++] = item;
+  return true;
+}
+
+static inline void* tprec_stack_pop(tprec_stack_t* st)
+{
+  return st->items[--st->len];
+}
+
 
 void tpre_errs_free(tpre_errs_t errs);
 void tprec_add_err(
@@ -14,7 +46,46 @@ void tprec_add_err(
 
 void tprec_re_setnode(
     tpre_re_t* re, tpre_nodeid_t id, tpre_re_node_t nd);
+/** index of the new node, negative on failure */
 tpre_nodeid_t tprec_re_addnode(tpre_re_t* re, tpre_re_node_t nd);
+/** adds a node that is set later, negative on failure */
 tpre_nodeid_t tprec_re_resvnode(tpre_re_t* re);
+static inline bool tprec_class_has(tpre_class_t const* cls, uint8_t c)
+{
+  return (cls->bits[c >> 3] >> (c & 7)) & 1;
+}
+
+static inline void tprec_class_add(tpre_class_t* cls, uint8_t c)
+{
+  cls->bits[c >> 3] |= (uint8_t) (1 << (c & 7));
+}
+
+/** bytes that a pattern consumes, with the same semantics as the runtime.
+ * false for patterns that don't consume a byte, and
+ * for SPECIAL_CLASS, which needs the table */
+bool tprec_pattern_class(tpre_pattern_t pat, tpre_class_t* out);
+
+/** index of the new loop, negative on failure */
+int tprec_re_addloop(tpre_re_t* re, tpre_loop_t loop);
+/** index of the new slot, negative if there are too many. counter is false
+ * for slots that only hold positions, see [tpre_re_t.num_counters] */
+int tprec_re_addslot(tpre_re_t* re, bool counter);
+
+/** index of the run, or of an equal one that was added before. negative on
+ * failure */
+int tprec_re_addrun(tpre_re_t* re, tpre_run_t run);
+
+/** index of the new string, negative on failure. equal strings are not
+ * looked for, merge_strings() does that */
+int tprec_re_addstring(tpre_re_t* re, uint8_t const* bytes, uint16_t len);
+
+/** returns index of class with the same bits, or of the newly added class,
+ * or -1 on failure */
+int tprec_re_addclass(tpre_re_t* re, tpre_class_t cls);
+
+/** the cheapest pattern that matches exactly the bytes in bits. adds a class
+ * to re if needed. 0 = ok */
+int tprec_class_pattern(
+    tpre_re_t* re, tpre_class_t const* bits, tpre_pattern_t* out);
 
 #endif
@@ -10,15 +10,99 @@ extern "C" {
 #include <stdint.h>
 
 typedef uint8_t tpre_groupid_t;
-typedef int16_t tpre_nodeid_t;
+typedef int32_t tpre_nodeid_t;
 typedef uint8_t tpre_backtrack_t;
 typedef struct
 {
   uint8_t is_special;
   uint8_t val;
   uint8_t invert;
+  // operand of some special patterns, like the index into
+  // [tpre_re_t.classes] for classes
+  uint16_t arg;
 } tpre_pattern_t;
 
+/** bit set of bytes */
+typedef struct
+{
+  uint8_t bits[32];
+} tpre_class_t;
+
+// no slot
+#define TPRE_NO_SLOT (UINT16_MAX)
+
+/** counted loop, the iteration count is kept in a slot */
+typedef struct
+{
+  uint16_t slot;
+  // if the body can match the empty string, where the current iteration
+  // began is kept in this slot, see SPECIAL_LOOP. TPRE_NO_SLOT otherwise
+  uint16_t begin_slot;
+  bool lazy;
+  uint32_t min, max;
+} tpre_loop_t;
+
+// pcmpestri checks 8 ranges at once, and the byte after a run can split
+// one of them in two
+#define TPRE_RUN_MAX_RANGES (7)
+
+/** repeat of a single class, see SPECIAL_RUN */
+typedef struct
+{
+  bool lazy;
+  // index into [tpre_re_t.classes]
+  uint16_t cls;
+  // the class as byte ranges lo..hi (inclusive), which can be checked for
+  // many bytes at once. 0 if it needs more than TPRE_RUN_MAX_RANGES
+  uint8_t num_ranges;
+  uint8_t lo[TPRE_RUN_MAX_RANGES];
+  uint8_t hi[TPRE_RUN_MAX_RANGES];
+} tpre_run_t;
+
+/** literal bytes, see SPECIAL_STRING */
+typedef struct
+{
+  // offset into [tpre_re_t.string_bytes]
+  uint32_t off;
+  uint16_t len;
+} tpre_string_t;
+
+/** flags of a dfa state */
+enum
+{
+  // a match ends right before the next byte
+  TPRE_DFA_ACCEPT = 1,
+  // a match ends here if the input ends here
+  TPRE_DFA_ACCEPT_AT_END = 2,
+};
+
+/**
+ * deterministic automaton, see tpre_fsm2dfa(). state 0 is dead: once it is
+ * reached, no match can be found anymore
+ */
+typedef struct
+{
+  uint16_t num_states;
+  uint16_t num_classes;
+  // bytes that the automaton never tells apart share a class
+  uint8_t classes[256];
+  // state before the first byte of the input
+  uint16_t start;
+  // state when starting somewhere in the middle of the input
+  uint16_t start_mid;
+  // num_states * num_classes: the next state after a byte of each class
+  uint16_t* next;
+  // per state, TPRE_DFA_ACCEPT*
+  uint8_t* accept;
+  // longest match in bytes, or UINT32_MAX if there is no limit
+  uint32_t max_len;
+  // a state that every byte but skip_byte stays in, or 0. searches look for
+  // skip_byte with vector instructions there, instead of stepping through
+  // the other bytes, like when they wait for the first byte of a literal
+  uint16_t skip_state;
+  uint8_t skip_byte;
+} tpre_dfa_t;
+
 typedef struct
 {
   tpre_pattern_t pat;
@@ -39,15 +123,62 @@ typedef struct
   tpre_groupid_t num_named_groups;
 
   tpre_re_node_t* i;
+
+  uint16_t num_classes;
+  tpre_class_t* classes;
+
+  // values that are part of the match state, like loop counters
+  uint16_t num_slots;
+  // how many of the slots are counters of loops or atomic groups. the others
+  // hold where the current iteration of a loop began
+  uint16_t num_counters;
+  // captured text is part of the match state too
+  bool has_backrefs;
+
+  uint16_t num_loops;
+  tpre_loop_t* loops;
+
+  uint16_t num_runs;
+  tpre_run_t* runs;
+
+  uint16_t num_strings;
+  tpre_string_t* strings;
+  // the bytes of all strings
+  uint32_t num_string_bytes;
+  uint8_t* string_bytes;
+
+  // per node: byte offset into the pattern + 1, or 0 if unknown.
+  // can be null
+  uint32_t* wherePlus1;
+
+  // leftmost-longest instead of leftmost-first. needs both dfas
+  bool longest;
+  // where matches that begin at a known position can end. can be null
+  tpre_dfa_t* dfa_forward;
+  // run backwards over the input: where matches can begin. can be null
+  tpre_dfa_t* dfa_reverse;
+  // for start unanchored regexes: where the first match ends. used to skip
+  // input that can't match before backtracking. can be null
+  tpre_dfa_t* dfa_search;
 } tpre_re_t;
 
+#ifdef TPRE_SMALL_OFFSETS
+// groups are half as big, which makes backtracking copy less. inputs of
+// 2 GiB or more are not matched then, see [tpre_match_t.aborted]
 typedef int32_t tpre_src_loc_t;
+typedef uint32_t tpre_src_len_t;
+# define TPRE_SRC_MAX ((size_t) INT32_MAX)
+#else
+typedef int64_t tpre_src_loc_t;
+typedef size_t tpre_src_len_t;
+# define TPRE_SRC_MAX (SIZE_MAX)
+#endif
 
 typedef struct
 {
   tpre_src_loc_t begin;
   /** if is 0, then no match */
-  size_t len;
+  tpre_src_len_t len;
 } tpre_group_t;
 
 /**
@@ -55,15 +186,24 @@ typedef struct
  *
  * all named capture groups get their IDs appended to the unnamed capture groups 
  *
- * group 0 currently is always empty, but will contain whole matched string in the future
+ * group 0 is the whole match
  */
 typedef struct
 {
   bool found;
+  // a limit of [tpre_match_cfg_t] was hit before the result was known, or
+  // the input is longer than TPRE_SRC_MAX. found is false then
+  bool aborted;
 
   // including group 0
   size_t ngroups;
   tpre_group_t* groups;
+
+  /* private: */
+  size_t* _slots;
+  // where the latest iteration of a loop began, see SPECIAL_ITER_BEGIN.
+  // SIZE_MAX before the first one
+  size_t _iter_begin;
 } tpre_match_t;
 
 
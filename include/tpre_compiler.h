@@ -54,6 +54,21 @@ typedef struct
 
   // dot matches newline
   bool single_line;
+
+  // leftmost-longest matching: of the matches that begin first, the longest
+  // one is picked, like POSIX does. groups are then captured as if the
+  // regex was end anchored at the end of that match.
+  // backreferences and atomic groups can't be used
+  bool longest;
+
+  // capture groups don't capture, so that matching does no work for them.
+  // for when only tpre_match_t.found is needed. backreferences can't be used
+  bool no_captures;
+
+  // start unanchored regexes get dfas to find where a match is, so that
+  // backtracking starts right there. this turns that off, which makes
+  // compiling faster and the regex smaller
+  bool no_dfa;
 } tpre_opts_t;
 
 typedef enum
@@ -67,6 +82,9 @@ typedef enum
   TPRE_OPT_UTF8,
   TPRE_OPT_UNGREEDY,
   TPRE_OPT_SINGLE_LINE,
+  TPRE_OPT_NO_CAPTURES,
+  TPRE_OPT_LONGEST,
+  TPRE_OPT_NO_DFA,
 } tpre_opt_key_t;
 
 bool tpre_opt_getb(tpre_opts_t const* opts, tpre_opt_key_t key);
@@ -79,6 +97,8 @@ typedef enum
 {
   TPRE_FSM_PAT_START,
   TPRE_FSM_PAT_END,
+  // always succeeds, without consuming anything
+  TPRE_FSM_PAT_EMPTY,
   TPRE_FSM_PAT_ONEOF,
   TPRE_FSM_PAT_ANY_ASCII_EXCEPT,
   // only succeeds if there is a second byte
@@ -104,6 +124,10 @@ typedef struct
 } tpre_fsm_pat_t;
 
 void tpre_fsm_pat_free(tpre_fsm_pat_t pat);
+/** false if the pattern doesn't consume exactly one byte */
+bool tpre_fsm_pat_bits(tpre_fsm_pat_t const* pat, tpre_class_t* out);
+/** ONEOF or ANY_ASCII_EXCEPT, whichever has the shorter list. 0 = ok */
+int tpre_fsm_pat_from_bits(tpre_fsm_pat_t* out, tpre_class_t const* bits);
 
 typedef struct tpre_fsm_node tpre_fsm_node_t;
 
@@ -114,10 +138,21 @@ typedef struct
   uint16_t group;
 } tpre_fsm_case_t;
 
+/**
+ * cases are tried in order. a case whose pattern matches consumes one byte
+ * (nothing for START, END and EMPTY), attributes it to the group, and continues
+ * at then. if no case leads to a match, steps back backtrack.by bytes and
+ * continues at els.
+ *
+ * if backtrack.known is set, at most one case can match at any position, so
+ * the other cases never have to be retried, and els is only taken if no case
+ * matches at all.
+ */
 struct tpre_fsm_node
 {
   /* private: */
   bool _gc_flag;
+  size_t _idx;
 
   struct
   {
@@ -141,17 +176,44 @@ typedef struct
   /* ref to special node that marks end of pattern, with fail status */
   tpre_fsm_node_t* nd_err;
   tpre_fsm_node_t* first;
+  /* matches can begin at every position, and not only where first is
+   * entered the first time. tpre_fsm2re() adds the loop that starts over */
+  bool start_unanchored;
 
   uint16_t total_num_groups, num_named_groups;
   uint16_t first_named_group;
   char const** named_groups;
+
+  /* private: all nodes allocated by this fsm */
+  struct
+  {
+    size_t len, cap;
+    tpre_fsm_node_t** items;
+  } _nodes;
 } tpre_fsm_t;
 
 void tpre_fsm_init(tpre_fsm_t* fsm);
+/** frees all nodes that are not reachable from first, nd_ok or nd_err */
 void tpre_fsm_gc(tpre_fsm_t* fsm);
 void tpre_fsm_free(tpre_fsm_t* fsm);
 tpre_fsm_node_t* tpre_fsm_mknd(tpre_fsm_t* fsm);
+/** 0 = ok. takes ownership of the case pattern */
+int tpre_fsm_addcase(tpre_fsm_node_t* node, tpre_fsm_case_t cas);
+
+/** merges nodes that are indistinguishable (same cases into the same
+ * partitions), and then runs gc. 0 = ok */
+int tpre_fsm_minimize(tpre_fsm_t* fsm);
+
+/** START cases in nodes that can only be reached at the start of the input
+ * become EMPTY, and are removed in nodes that can never be reached at the
+ * start. with start_unanchored, first can be entered anywhere. 0 = ok */
+int tpre_fsm_fold_start(tpre_fsm_t* fsm);
 
+/** sets backtrack.known on nodes whose cases can never match at the same
+ * position, and which fail into nd_err. 0 = ok */
+int tpre_fsm_known_backtracks(tpre_fsm_t* fsm);
+
+/** fsm is built from the pattern, and already optimized */
 int tpre2fsm(
     tpre_fsm_t* out,
     char const* str,
@@ -164,8 +226,57 @@ int tpre_compile(
     char const* str,
     tpre_errs_t* errs_out,
     tpre_opts_t opts);
+
+/**
+ * like tpre_compile, but the cases of alternations are tried in the order of
+ * how often they matched before, most often first. weights has an entry per
+ * byte of str, see tpre_profile_weights(). only cases that can't match at
+ * the same position are reordered, so the same matches are found.
+ * weights can be null. 0 = ok
+ */
+int tpre_compile_weighted(
+    tpre_re_t* out,
+    char const* str,
+    tpre_errs_t* errs_out,
+    tpre_opts_t opts,
+    uint64_t const* weights);
+
+/**
+ * like tpre_compile of the alternation of the words, `words[0]|words[1]|...`,
+ * but every byte of the nul terminated words is matched as it is, and they
+ * don't go through the parser. the words share the nodes of common prefixes,
+ * so matching takes time by the length of the words, and not by how many
+ * there are. num must not be 0. 0 = ok; errs_out can be null
+ */
+int tpre_compile_literals(
+    tpre_re_t* out,
+    char const* const* words,
+    size_t num,
+    tpre_errs_t* errs_out,
+    tpre_opts_t opts);
 void tpre_free(tpre_re_t re);
 
+/** lowers the fsm into the runtime program. 0 = ok */
+int tpre_fsm2re(tpre_re_t* out, tpre_fsm_t const* fsm);
+
+#ifndef TPRE_DFA_MAX_STATES
+# define TPRE_DFA_MAX_STATES (4096)
+#endif
+
+/**
+ * builds a dfa from the fsm. if reverse, the dfa reads the input backwards,
+ * from the end of a match to its start. if unanchored, a match can begin at
+ * every position the dfa reads (for reverse: end there).
+ *
+ * tpre2fsm() assumes that matches begin where the fsm is entered first, so
+ * `^` may already be folded away in its fsms.
+ * fails if the fsm uses utf8 patterns, needs more than TPRE_DFA_MAX_STATES
+ * states, or takes too long to build. 0 = ok
+ */
+int tpre_fsm2dfa(
+    tpre_dfa_t* out, tpre_fsm_t const* fsm, bool reverse, bool unanchored);
+void tpre_dfa_free(tpre_dfa_t dfa);
+
 void tpre_errs_free(tpre_errs_t errs);
 
 #ifdef __cplusplus
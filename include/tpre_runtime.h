@@ -15,6 +15,122 @@ extern "C" {
 tpre_match_t
 tpre_matchn(tpre_re_t const* re, const char* str, size_t strl);
 
+/** only checks if the regex matches. faster than tpre_matchn, because no
+ * capture groups are recorded.
+ *
+ * there are no limits: visited nodes can't be remembered for regexes with
+ * backrefs or counted repeats, so matching those can take exponential time.
+ * use tpre_is_match_cfg() with a step budget or deadline for untrusted
+ * regexes or input */
+bool tpre_is_match(tpre_re_t const* re, const char* str, size_t strl);
+
+/** counters of the work done by one match, see [tpre_match_cfg_t.stats_out] */
+typedef struct
+{
+  // nodes executed. the step count is this plus dfa_bytes
+  uint64_t nodes_visited;
+  uint64_t bt_pushes;
+  // backtracks that were taken. entries dropped by atomic groups or at the
+  // end of the match are not counted
+  uint64_t bt_pops;
+  // deepest the backtrack stack got
+  uint64_t bt_peak_depth;
+  // bytes of groups and slots copied into backtrack entries
+  uint64_t capture_copy_bytes;
+  // for start unanchored regexes: how often matching started over one byte
+  // further into the input
+  uint64_t restarts;
+  // bytes read by the dfas that find where the match is, before backtracking
+  uint64_t dfa_bytes;
+} tpre_match_stats_t;
+
+/** per node counters, see [tpre_match_cfg_t.profile_out] */
+typedef struct
+{
+  uint64_t visits;
+  // how often matching continued at the ok / err successor of the node.
+  // a visit that was cut off because the node was already tried at that
+  // position counts as err
+  uint64_t ok, err;
+} tpre_node_profile_t;
+
+// zero initialized is default (no limits)
+typedef struct
+{
+  // stop after this many steps: nodes executed, and bytes read by the dfas.
+  // 0 = no limit
+  uint64_t max_steps;
+  // stop once tpre_monotonic_ns() reaches this. 0 = no deadline
+  uint64_t deadline_ns;
+  // if not null, the number of steps taken is written here
+  uint64_t* steps_out;
+  // if not null, statistics are written here. they are only counted if this
+  // is set
+  tpre_match_stats_t* stats_out;
+  // if not null, an array of [tpre_re_t.num_nodes] counters, that are added
+  // to. can be summed over many matches, and then shown with
+  // tpre_profile_dump()
+  tpre_node_profile_t* profile_out;
+} tpre_match_cfg_t;
+
+/** like tpre_matchn, but sets [tpre_match_t.aborted] if a limit is hit.
+ * cfg can be null */
+tpre_match_t tpre_matchn_cfg(
+    tpre_re_t const* re,
+    const char* str,
+    size_t strl,
+    tpre_match_cfg_t const* cfg);
+
+/** like tpre_is_match, with the limits of cfg. false if a limit is hit,
+ * use tpre_matchn_cfg() to tell that apart from no match. cfg can be null */
+bool tpre_is_match_cfg(
+    tpre_re_t const* re,
+    const char* str,
+    size_t strl,
+    tpre_match_cfg_t const* cfg);
+
+/** vector instructions that the runtime scans the input with */
+typedef enum
+{
+  TPRE_SIMD_NONE = 0,
+  TPRE_SIMD_SSE2,
+  TPRE_SIMD_SSE42,
+  TPRE_SIMD_AVX2,
+  TPRE_SIMD_AVX512,
+} tpre_simd_t;
+
+/** the instructions in use. picked at first use: the best ones the cpu
+ * has, or the ones named by the TPRE_SIMD environment variable ("none",
+ * "sse2", "sse4.2", "avx2" or "avx512"), if the cpu has them */
+tpre_simd_t tpre_simd(void);
+
+/** uses other instructions from now on, for testing and benchmarking.
+ * 0 = ok, fails if the cpu doesn't have them */
+int tpre_simd_set(tpre_simd_t simd);
+
+/** name of the instructions, like in TPRE_SIMD */
+char const* tpre_simd_name(tpre_simd_t simd);
+
+/** current time of a monotonic clock, in nanoseconds */
+uint64_t tpre_monotonic_ns(void);
+
+/** whether the library was built with TPRE_SMALL_OFFSETS. that changes the
+ * layout of tpre_group_t, so code built with the other setting reads the
+ * groups of matches wrong. see tpre_offsets_ok() */
+bool tpre_small_offsets(void);
+
+/** whether the code that includes this and the library were built with the
+ * same TPRE_SMALL_OFFSETS setting. worth checking once at startup if the
+ * library is built separately */
+static inline bool tpre_offsets_ok(void)
+{
+#ifdef TPRE_SMALL_OFFSETS
+  return tpre_small_offsets();
+#else
+  return !tpre_small_offsets();
+#endif
+}
+
 /** matched_str does not have to be mull terminated because it only prints the slices of it that match */
 void tpre_match_dump(
     tpre_re_t const* re,
@@ -24,6 +140,25 @@ void tpre_match_dump(
 
 void tpre_match_free(tpre_match_t match);
 
+/** prints the program like the compiler's debug dump, with the counters of
+ * profile and the part of the pattern each node was compiled from.
+ * pattern can be null */
+void tpre_profile_dump(
+    tpre_re_t const* re,
+    tpre_node_profile_t const* profile,
+    char const* pattern,
+    FILE* out);
+
+/** adds how often matching went on from the nodes that consume input to
+ * out, at the byte of the pattern each node was compiled from. out has an
+ * entry per byte of the pattern (patl). for tpre_compile_weighted(), to try
+ * the cases of alternations that match most often first */
+void tpre_profile_weights(
+    tpre_re_t const* re,
+    tpre_node_profile_t const* profile,
+    uint64_t* out,
+    size_t patl);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,12 +1,16 @@
+#define _POSIX_C_SOURCE 199309L
 #include <assert.h>
 #include <stdarg.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "include/tpre_runtime.h"
 #include "shared.h"
+#include "simd.h"
 
 #ifdef __GNUC__
 # pragma GCC diagnostic push
@@ -22,6 +26,11 @@ typedef struct
   tpre_nodeid_t cursor;
   tpre_match_t match;
   size_t i;
+  // NODE_ERR, or the SPECIAL_RUN node that this entry is for. it stays on
+  // the stack until all lengths of the run were tried: match is from before
+  // the run, which began at run_begin, and i is where it ended last
+  tpre_nodeid_t run;
+  size_t run_begin;
 } bt_stack_ent;
 
 SLOWARR_Header(bt_stack_ent);
@@ -35,112 +44,726 @@ SLOWARR_Impl(bt_stack_ent);
 void tpre_match_free(tpre_match_t match)
 {
   free(match.groups);
+  free(match._slots);
 }
 
-static tpre_match_t tpre_match_dup(tpre_match_t const* match)
+static tpre_match_t tpre_match_dup(
+    tpre_re_t const* re,
+    tpre_match_t const* match,
+    tpre_match_stats_t* stats)
 {
-  tpre_match_t out;
-  out.found = match->found;
-  out.ngroups = match->ngroups;
-  out.groups = malloc(sizeof(*out.groups) * out.ngroups);
-  for (size_t i = 0; i < match->ngroups; i++)
-    out.groups[i] = match->groups[i];
+  tpre_match_t out = *match;
+  out.groups = NULL;
+  if (out.ngroups)
+  {
+    out.groups = malloc(sizeof(*out.groups) * out.ngroups);
+    memcpy(out.groups, match->groups, sizeof(*out.groups) * out.ngroups);
+  }
+  out._slots = NULL;
+  if (re->num_slots)
+  {
+    out._slots = malloc(sizeof(*out._slots) * re->num_slots);
+    memcpy(out._slots, match->_slots, sizeof(*out._slots) * re->num_slots);
+  }
+  if (stats)
+    stats->capture_copy_bytes += sizeof(*out.groups) * out.ngroups +
+        sizeof(*out._slots) * re->num_slots;
   return out;
 }
 
-static void tpre_match_group_put(
-    tpre_match_t* match,
-    tpre_groupid_t group,
-    char c,
-    tpre_src_loc_t loc)
+static void bt_push_ent(
+    SLOWARR_MANGLE(bt_stack_ent) * bt_stack,
+    bt_stack_ent ent,
+    tpre_match_stats_t* stats)
 {
-  if (group == 0)
-    return;
-  tpre_group_t* g = &match->groups[group];
-  if (g->len == 0)
-    g->begin = loc;
-  g->len++;
+  SLOWARR_MANGLE_F(bt_stack_ent, push)(bt_stack, ent);
+  if (stats)
+  {
+    stats->bt_pushes++;
+    if (bt_stack->len > stats->bt_peak_depth)
+      stats->bt_peak_depth = bt_stack->len;
+  }
+}
+
+static void bt_push(
+    SLOWARR_MANGLE(bt_stack_ent) * bt_stack,
+    tpre_re_t const* re,
+    tpre_nodeid_t cursor,
+    size_t i,
+    tpre_match_t const* match,
+    tpre_match_stats_t* stats)
+{
+  bt_push_ent(
+      bt_stack,
+      (bt_stack_ent) { .cursor = cursor,
+                       .i = i,
+                       .match = tpre_match_dup(re, match, stats),
+                       .run = NODE_ERR },
+      stats);
 }
 
-static int
-pattern_match(tpre_pattern_t pat, char src, bool is_begin)
+/** start unanchored regexes begin with a lazy any-loop:
+ *   first: bt_push(then: regex, onbt: step)
+ *   step: any(ok: first)
+ * backtracking to step means starting over one byte later. NODE_ERR if the
+ * regex doesn't look like that */
+static tpre_nodeid_t restart_node(tpre_re_t const* re)
+{
+  if (re->first_node < 0 || re->first_node >= re->num_nodes)
+    return NODE_ERR;
+  tpre_re_node_t first = re->i[re->first_node];
+  if (!first.pat.is_special || first.pat.val != SPECIAL_BT_PUSH ||
+      first.err < 0 || first.err >= re->num_nodes)
+    return NODE_ERR;
+  tpre_re_node_t step = re->i[first.err];
+  if (!step.pat.is_special || step.pat.val != SPECIAL_ANY ||
+      step.pat.invert || step.ok != re->first_node)
+    return NODE_ERR;
+  return first.err;
+}
+
+static bool class_has(tpre_class_t const* cls, uint8_t b)
+{
+  return (cls->bits[b >> 3] >> (b & 7)) & 1;
+}
+
+static bool run_has(tpre_re_t const* re, tpre_run_t const* run, uint8_t b)
+{
+  return class_has(&re->classes[run->cls], b);
+}
+
+/** first position from from on, where the byte is not in the class of the
+ * run, or is stop (if that is not negative). strl if there is none */
+static size_t run_scan(
+    tpre_re_t const* re,
+    tpre_run_t const* run,
+    const char* str,
+    size_t from,
+    size_t strl,
+    int stop)
+{
+  return tprert_run_scan(&re->classes[run->cls], run, str, from, strl, stop);
+}
+
+/** length of the string if rest begins with it, -1 otherwise */
+static int string_match(
+    tpre_re_t const* re,
+    tpre_string_t const* string,
+    const char* rest,
+    size_t restl)
+{
+  uint8_t const* bytes = re->string_bytes + string->off;
+  size_t len = string->len;
+  // most mismatches are in the first byte, which is cheaper to check alone
+  if (len > restl || (uint8_t) rest[0] != bytes[0])
+    return -1;
+  size_t p = 1;
+  // a word at a time
+  for (; p + sizeof(uint64_t) <= len; p += sizeof(uint64_t))
+  {
+    uint64_t a, b;
+    memcpy(&a, rest + p, sizeof(a));
+    memcpy(&b, bytes + p, sizeof(b));
+    if (a != b)
+      return -1;
+  }
+  return !memcmp(rest + p, bytes + p, len - p) ? (int) len : -1;
+}
+
+// what pattern_match() gets instead of a byte at the end of the input. the
+// input can contain '\0' bytes
+#define END_OF_INPUT (-1)
+
+/** src is the byte at the position, or END_OF_INPUT */
+static int pattern_match(
+    tpre_re_t const* re,
+    tpre_pattern_t pat,
+    int src,
+    bool is_begin)
 {
   if (!pat.is_special)
-    return src == (char) pat.val ? 1 : -1;
+    return src == (uint8_t) pat.val ? 1 : -1;
 
+  bool r;
   switch (pat.val)
   {
-    case SPECIAL_ANY: return src != '\0' ? 1 : -1;
+    case SPECIAL_ANY: return src != END_OF_INPUT ? 1 : -1;
 
     case SPECIAL_SPACE:
-      return (src == ' ' || src == '\n' || src == '\t' ||
-              src == '\r')
-          ? 1
-          : -1;
+      r = src == ' ' || src == '\n' || src == '\t' || src == '\r';
+      break;
 
-    case SPECIAL_DIGIT:
-      return (src >= '0' && src <= '9') ? 1 : -1;
+    case SPECIAL_DIGIT: r = src >= '0' && src <= '9'; break;
 
     case SPECIAL_WORDC:
-      return ((src >= '0' && src <= '9') ||
-              (src >= 'a' && src <= 'z') ||
-              (src >= 'A' && src <= 'Z') || src == '_')
-          ? 1
-          : -1;
+      r = (src >= '0' && src <= '9') || (src >= 'a' && src <= 'z') ||
+          (src >= 'A' && src <= 'Z') || src == '_';
+      break;
+
+    case SPECIAL_CLASS:
+      r = src != END_OF_INPUT &&
+          class_has(&re->classes[pat.arg], (uint8_t) src);
+      break;
 
     case SPECIAL_BT_PUSH: return -2;
 
-    case SPECIAL_END: return src == '\0' ? 0 : -1;
+    case SPECIAL_END: return src == END_OF_INPUT ? 0 : -1;
 
     case SPECIAL_START: return is_begin ? 0 : -1;
 
     default: return -1;
   }
+
+  // inverted classes don't match the end of the input either
+  if (pat.invert)
+    r = !r && src != END_OF_INPUT;
+  return r ? 1 : -1;
 }
 
-static tpre_match_t init_match(tpre_re_t const* re)
+// no position
+#define NO_POS ((size_t) -1)
+
+static tpre_match_t init_match(tpre_re_t const* re, bool captures)
 {
-  tpre_match_t match = { 0 };
-  match.ngroups = re->max_group + 1;
-  match.groups = calloc(sizeof(*match.groups), match.ngroups);
+  tpre_match_t match = { ._iter_begin = NO_POS };
+  if (captures)
+  {
+    match.ngroups = re->max_group + 1;
+    match.groups = calloc(sizeof(*match.groups), match.ngroups);
+    // backrefs to groups that didn't match fail. their begin is negative
+    // until then
+    for (size_t g = 1; re->has_backrefs && match.groups && g < match.ngroups;
+         g++)
+      match.groups[g].begin = -1;
+  }
+  if (re->num_slots)
+    match._slots = calloc(sizeof(*match._slots), re->num_slots);
 
   return match;
 }
 
-tpre_match_t
-tpre_matchn(tpre_re_t const* re, const char* str, size_t strl)
+/**
+ * if a node is reached a second time at the same position, everything that
+ * could be tried from there already failed. remembering this makes matching
+ * O(nodes * input length), but needs a bit per pair, so is only done if that
+ * fits into this many bytes
+ */
+#ifndef TPRE_VISITED_MAX_BYTES
+# define TPRE_VISITED_MAX_BYTES (256 * 1024)
+#endif
+
+static uint8_t* alloc_visited(tpre_re_t const* re, size_t strl)
+{
+  // counters and captured text are part of the state too
+  if (re->num_counters || re->has_backrefs)
+    return NULL;
+  size_t nodes = re->num_nodes > 0 ? (size_t) re->num_nodes : 0;
+  if (strl >= TPRE_VISITED_MAX_BYTES * 8)
+    return NULL;
+  size_t bits = nodes * (strl + 1);
+  if (bits / 8 >= TPRE_VISITED_MAX_BYTES)
+    return NULL;
+  return calloc(bits / 8 + 1, 1);
+}
+
+/** the bit of node at pos. false if that is not remembered: where iterations
+ * began only matters if one began at pos, because its end might be reached
+ * without consuming anything. all other iterations that are still going on
+ * began before the latest one */
+static bool visited_bit(
+    uint8_t const* visited,
+    tpre_match_t const* match,
+    size_t strl,
+    tpre_nodeid_t node,
+    size_t pos,
+    size_t* bit)
+{
+  if (!visited ||
+      (match->_iter_begin != NO_POS && match->_iter_begin >= pos))
+    return false;
+  *bit = (size_t) node * (strl + 1) + pos;
+  return true;
+}
+
+static bool was_visited(
+    uint8_t const* visited,
+    tpre_match_t const* match,
+    size_t strl,
+    tpre_nodeid_t node,
+    size_t pos)
+{
+  size_t bit;
+  return visited_bit(visited, match, strl, node, pos, &bit) &&
+         (visited[bit >> 3] & (1 << (bit & 7)));
+}
+
+static void mark_visited(
+    uint8_t* visited,
+    tpre_match_t const* match,
+    size_t strl,
+    tpre_nodeid_t node,
+    size_t pos)
+{
+  size_t bit;
+  if (visited_bit(visited, match, strl, node, pos, &bit))
+    visited[bit >> 3] |= (uint8_t) (1 << (bit & 7));
+}
+
+uint64_t tpre_monotonic_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+bool tpre_small_offsets(void)
+{
+#ifdef TPRE_SMALL_OFFSETS
+  return true;
+#else
+  return false;
+#endif
+}
+
+// reading the clock is expensive compared to a step
+#define DEADLINE_CHECK_INTERVAL (1024)
+
+#define PROFILE(field)          \
+  do                            \
+  {                             \
+    if (profile)                \
+      profile[cursor].field++;  \
+  } while (0)
+
+/** the byte that has to come next, if the node is a literal that has no
+ * other case to go to. -1 otherwise */
+static int node_literal(tpre_re_t const* re, tpre_nodeid_t node)
+{
+  if (node < 0 || node >= re->num_nodes || re->i[node].err != NODE_ERR)
+    return -1;
+  tpre_pattern_t pat = re->i[node].pat;
+  if (!pat.is_special)
+    return pat.val;
+  if (pat.val == SPECIAL_STRING)
+    return re->string_bytes[re->strings[pat.arg].off];
+  return -1;
+}
+
+/** records that the bytes begin..end were consumed into the group */
+static void group_capture(
+    tpre_match_t* match, tpre_groupid_t group, size_t begin, size_t end)
+{
+  if (!match->ngroups || group == 0 || end == begin)
+    return;
+  tpre_group_t* g = &match->groups[group];
+  if (g->len == 0)
+    g->begin = (tpre_src_loc_t) begin;
+  g->len += (tpre_src_len_t) (end - begin);
+}
+
+/** where the run of the backtrack entry should end next. false if all
+ * lengths were tried. if the run is followed by a literal, only lengths
+ * where that can match are tried. lazy runs set end to how far they got
+ * either way */
+static bool run_next_end(
+    tpre_re_t const* re,
+    bt_stack_ent const* ent,
+    const char* str,
+    size_t strl,
+    size_t* end)
+{
+  tpre_re_node_t nd = re->i[ent->run];
+  tpre_run_t const* run = &re->runs[nd.pat.arg];
+  int stop = node_literal(re, nd.ok);
+  size_t p = ent->i;
+
+  if (run->lazy)
+  {
+    // one byte longer than last time
+    *end = p;
+    if (p >= strl || !run_has(re, run, (uint8_t) str[p]))
+      return false;
+    p++;
+    if (stop >= 0)
+    {
+      p = run_scan(re, run, str, p, strl, stop);
+      *end = p;
+      if (p >= strl || (uint8_t) str[p] != stop)
+        return false;
+    }
+    *end = p;
+    return true;
+  }
+
+  // shorter than last time
+  if (p == ent->run_begin)
+    return false;
+  p--;
+  if (stop >= 0)
+  {
+    while (p > ent->run_begin && (uint8_t) str[p] != stop)
+      p--;
+    if ((uint8_t) str[p] != stop)
+      return false;
+  }
+  *end = p;
+  return true;
+}
+
+/** takes the next backtrack from the stack and frees the old match. entries
+ * of runs are only removed once all of their lengths were tried, and skip
+ * the lengths after which the next node was already visited. false if there
+ * is nothing left */
+static bool bt_pop(
+    SLOWARR_MANGLE(bt_stack_ent) * bt_stack,
+    tpre_re_t const* re,
+    const char* str,
+    size_t strl,
+    uint8_t* visited,
+    tpre_nodeid_t* cursor,
+    size_t* i,
+    tpre_match_t* match,
+    tpre_match_stats_t* stats)
+{
+  while (bt_stack->len)
+  {
+    bt_stack_ent* top = &bt_stack->data[bt_stack->len - 1];
+    if (top->run == NODE_ERR)
+    {
+      bt_stack_ent e = SLOWARR_MANGLE_F(bt_stack_ent, pop)(bt_stack);
+      tpre_match_free(*match);
+      *cursor = e.cursor;
+      *i = e.i;
+      *match = e.match;
+      return true;
+    }
+
+    tpre_re_node_t nd = re->i[top->run];
+    size_t begin = top->run_begin;
+    bool lazy = re->runs[nd.pat.arg].lazy;
+    // a lazy run that gets to where the same run began before can't do
+    // more than that one did. once it is done, the same holds for anywhere
+    // it got to
+    size_t end = top->i;
+    bool more = false;
+    if (!lazy || end >= strl ||
+        !was_visited(visited, &top->match, strl, top->run, end + 1))
+      more = run_next_end(re, top, str, strl, &end);
+    if (more && lazy)
+      more = !was_visited(visited, &top->match, strl, top->run, end);
+    if (!more)
+    {
+      for (size_t p = begin + 1; lazy && p <= end &&
+           !was_visited(visited, &top->match, strl, top->run, p);
+           p++)
+        mark_visited(visited, &top->match, strl, top->run, p);
+      tpre_match_free(SLOWARR_MANGLE_F(bt_stack_ent, pop)(bt_stack).match);
+      continue;
+    }
+
+    // lazy entries stay until they are done, to mark where they ended
+    bool last = !lazy && end == begin;
+    // all longer lengths were tried before this one, which is everything
+    // the same run could do if it began here
+    if (!lazy)
+      mark_visited(visited, &top->match, strl, top->run, end);
+    if (nd.ok >= 0 && nd.ok < re->num_nodes &&
+        was_visited(visited, &top->match, strl, nd.ok, end))
+    {
+      if (last)
+        tpre_match_free(SLOWARR_MANGLE_F(bt_stack_ent, pop)(bt_stack).match);
+      else
+        top->i = end;
+      continue;
+    }
+
+    tpre_match_free(*match);
+    if (last)
+    {
+      *match = SLOWARR_MANGLE_F(bt_stack_ent, pop)(bt_stack).match;
+    }
+    else
+    {
+      top->i = end;
+      *match = tpre_match_dup(re, &top->match, stats);
+    }
+    group_capture(match, nd.group, begin, end);
+    *cursor = nd.ok;
+    *i = end;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * runs the program from the node first at position begin. only a match that
+ * ends at end_at counts, unless that is NO_POS. the step count goes on from
+ * the dfa_steps that the dfas took before.
+ *
+ * without captures, no groups are allocated, recorded or copied. backrefs
+ * need them
+ */
+static tpre_match_t backtrack(
+    tpre_re_t const* re,
+    const char* str,
+    size_t strl,
+    tpre_match_cfg_t const* cfg,
+    bool captures,
+    tpre_nodeid_t first,
+    size_t begin,
+    size_t end_at,
+    uint64_t dfa_steps)
 {
   SLOWARR_MANGLE(bt_stack_ent) bt_stack = { 0 };
 
-  tpre_match_t match = init_match(re);
-  size_t i = 0;
-  tpre_nodeid_t cursor = re->first_node;
+  tpre_match_t match = init_match(re, captures);
+  size_t i = begin;
+  tpre_nodeid_t cursor = first;
+  uint8_t* visited = alloc_visited(re, strl);
+
+  // the match begins where the search last went past the `.*?` of start
+  // unanchored regexes
+  tpre_nodeid_t restart = restart_node(re);
+  tpre_nodeid_t search =
+      first == re->first_node && restart != NODE_ERR ? first : NODE_ERR;
+
+  uint64_t max_steps = cfg ? cfg->max_steps : 0;
+  uint64_t deadline_ns = cfg ? cfg->deadline_ns : 0;
+  uint64_t steps = dfa_steps;
+  bool stop = false;
+
+  tpre_match_stats_t* stats = cfg ? cfg->stats_out : NULL;
+  tpre_node_profile_t* profile = cfg ? cfg->profile_out : NULL;
+  if (stats)
+  {
+    memset(stats, 0, sizeof(*stats));
+    stats->dfa_bytes = dfa_steps;
+  }
 
   do
   {
     while (cursor >= 0)
     {
       if (cursor >= re->num_nodes)
-        return match;
+      {
+        stop = true;
+        break;
+      }
+
+      steps++;
+      if ((max_steps && steps > max_steps) ||
+          (deadline_ns && steps % DEADLINE_CHECK_INTERVAL == 0 &&
+           tpre_monotonic_ns() >= deadline_ns))
+      {
+        match.aborted = true;
+        stop = true;
+        break;
+      }
+
+      PROFILE(visits);
+      if (cursor == search)
+        begin = i;
+
+      if (was_visited(visited, &match, strl, cursor, i))
+      {
+        PROFILE(err);
+        cursor = NODE_ERR;
+        break;
+      }
+      mark_visited(visited, &match, strl, cursor, i);
+
+      tpre_pattern_t pat = re->i[cursor].pat;
+      if (pat.is_special && pat.val == SPECIAL_CTR_INIT)
+      {
+        match._slots[pat.arg] = 0;
+        PROFILE(ok);
+        cursor = re->i[cursor].ok;
+        continue;
+      }
+      if (pat.is_special && pat.val == SPECIAL_ITER_BEGIN)
+      {
+        match._slots[pat.arg] = i;
+        match._iter_begin = i;
+        PROFILE(ok);
+        cursor = re->i[cursor].ok;
+        continue;
+      }
+      if (pat.is_special && pat.val == SPECIAL_ITER_END)
+      {
+        if (match._slots[pat.arg] == i)
+        {
+          PROFILE(err);
+          cursor = re->i[cursor].err;
+        }
+        else
+        {
+          PROFILE(ok);
+          cursor = re->i[cursor].ok;
+        }
+        continue;
+      }
+      if (pat.is_special && pat.val == SPECIAL_GROUP_BEGIN)
+      {
+        if (match.ngroups)
+          match.groups[pat.arg] =
+              (tpre_group_t) { .begin = (tpre_src_loc_t) i, .len = 0 };
+        PROFILE(ok);
+        cursor = re->i[cursor].ok;
+        continue;
+      }
+      if (pat.is_special && pat.val == SPECIAL_ATOMIC_BEGIN)
+      {
+        match._slots[pat.arg] = bt_stack.len;
+        PROFILE(ok);
+        cursor = re->i[cursor].ok;
+        continue;
+      }
+      if (pat.is_special && pat.val == SPECIAL_ATOMIC_END)
+      {
+        while (bt_stack.len > match._slots[pat.arg])
+          tpre_match_free(
+              SLOWARR_MANGLE_F(bt_stack_ent, pop)(&bt_stack).match);
+        PROFILE(ok);
+        cursor = re->i[cursor].ok;
+        continue;
+      }
+      if (pat.is_special && pat.val == SPECIAL_RUN)
+      {
+        tpre_re_node_t nd = re->i[cursor];
+        tpre_run_t const* run = &re->runs[pat.arg];
+        size_t end = i;
+        if (!run->lazy)
+        {
+          // where the same run began or ended before, it tried all lengths
+          // up to here already
+          if (i < strl && was_visited(visited, &match, strl, cursor, i + 1))
+            end = i;
+          else
+          {
+            end = run_scan(re, run, str, i, strl, -1);
+            while (end > i && was_visited(visited, &match, strl, cursor, end))
+              end--;
+          }
+          int stop = node_literal(re, nd.ok);
+          if (stop >= 0)
+          {
+            // the longest length after which the literal matches
+            size_t reached = end;
+            while (end > i && (end >= strl || (uint8_t) str[end] != stop))
+              end--;
+            if (end >= strl || (uint8_t) str[end] != stop)
+            {
+              // and there is none if the run begins later either
+              for (; reached > i; reached--)
+                mark_visited(visited, &match, strl, cursor, reached);
+              PROFILE(err);
+              cursor = nd.err;
+              continue;
+            }
+          }
+        }
+
+        // one entry for all other lengths
+        bool more = run->lazy
+            ? i < strl && run_has(re, run, (uint8_t) str[i])
+            : end > i;
+        if (more)
+          bt_push_ent(
+              &bt_stack,
+              (bt_stack_ent) { .cursor = nd.ok,
+                               .i = end,
+                               .match = tpre_match_dup(re, &match, stats),
+                               .run = cursor,
+                               .run_begin = i },
+              stats);
+        if (!run->lazy)
+          mark_visited(visited, &match, strl, cursor, end);
+        group_capture(&match, nd.group, i, end);
+        i = end;
+        PROFILE(ok);
+        cursor = nd.ok;
+        continue;
+      }
+      if (pat.is_special && pat.val == SPECIAL_LOOP)
+      {
+        tpre_loop_t const* loop = &re->loops[pat.arg];
+        size_t* count = &match._slots[loop->slot];
+        if (loop->begin_slot != TPRE_NO_SLOT)
+        {
+          // an empty iteration that was not needed to get to min ends the
+          // loop, like in star loops
+          if (*count > loop->min && match._slots[loop->begin_slot] == i)
+          {
+            PROFILE(err);
+            cursor = re->i[cursor].err;
+            continue;
+          }
+          match._slots[loop->begin_slot] = i;
+          match._iter_begin = i;
+        }
 
-      int m = pattern_match(
-          re->i[cursor].pat, i >= strl ? '\0' : str[i], i == 0);
+        if (*count < loop->min)
+        {
+          (*count)++;
+          PROFILE(ok);
+          cursor = re->i[cursor].ok;
+        }
+        else if (*count >= loop->max)
+        {
+          PROFILE(err);
+          cursor = re->i[cursor].err;
+        }
+        else if (loop->lazy)
+        {
+          // try exiting first, one more iteration later
+          (*count)++;
+          bt_push(&bt_stack, re, re->i[cursor].ok, i, &match, stats);
+          (*count)--;
+          PROFILE(err);
+          cursor = re->i[cursor].err;
+        }
+        else
+        {
+          bt_push(&bt_stack, re, re->i[cursor].err, i, &match, stats);
+          (*count)++;
+          PROFILE(ok);
+          cursor = re->i[cursor].ok;
+        }
+        continue;
+      }
+
+      // backrefs can be longer than an int
+      int64_t m;
+      if (pat.is_special && pat.val == SPECIAL_BACKREF)
+      {
+        tpre_group_t g = match.groups[pat.arg];
+        m = g.begin >= 0 && g.len <= strl - i &&
+                !memcmp(str + g.begin, str + i, g.len)
+            ? (int64_t) g.len
+            : -1;
+      }
+      else if (pat.is_special && pat.val == SPECIAL_STRING)
+      {
+        m = string_match(re, &re->strings[pat.arg], str + i, strl - i);
+      }
+      else
+      {
+        m = pattern_match(
+            re, pat, i >= strl ? END_OF_INPUT : (uint8_t) str[i], i == 0);
+      }
       if (m == -2)
       {
         // TODO: can do this more efficiently: can reuse memory from dups
-        SLOWARR_MANGLE_F(bt_stack_ent, push)(
-            &bt_stack,
-            (bt_stack_ent) {
-              .cursor = re->i[cursor].err,
-              .i = i,
-              .match = tpre_match_dup(&match) });
+        bt_push(&bt_stack, re, re->i[cursor].err, i, &match, stats);
         m = 0;
       }
       if (m >= 0)
       {
-        for (; m && i < strl; m--, i++)
-          tpre_match_group_put(
-              &match, re->i[cursor].group, str[i], i);
+        size_t end = i + ((size_t) m < strl - i ? (size_t) m : strl - i);
+        if (captures)
+          group_capture(&match, re->i[cursor].group, i, end);
+        i = end;
+        PROFILE(ok);
         cursor = re->i[cursor].ok;
       }
       else
@@ -148,7 +771,7 @@ tpre_matchn(tpre_re_t const* re, const char* str, size_t strl)
         tpre_backtrack_t bt = re->i[cursor].backtrack;
         i -= bt;
         tpre_groupid_t g = re->i[cursor].group;
-        if (bt > 0)
+        if (captures && bt > 0)
         {
           if (match.groups[g].len >= bt)
           {
@@ -158,31 +781,370 @@ tpre_matchn(tpre_re_t const* re, const char* str, size_t strl)
             match.groups[g].len -= n;
           }
         }
+        PROFILE(err);
         cursor = re->i[cursor].err;
       }
     }
 
-    if (cursor == NODE_DONE)
+    if (stop)
+      break;
+
+    if (cursor == NODE_DONE && (end_at == NO_POS || i == end_at))
     {
       match.found = true;
+      if (match.ngroups)
+        match.groups[0] = (tpre_group_t) { .begin = (tpre_src_loc_t) begin,
+                                           .len = i - begin };
+      // groups that didn't match are empty at 0, like without backrefs
+      for (size_t g = 1; g < match.ngroups; g++)
+        if (match.groups[g].begin < 0)
+          match.groups[g].begin = 0;
       break;
     }
 
-    if (!bt_stack.len)
-      return match;
-
-    tpre_match_free(match);
+    if (!bt_pop(
+            &bt_stack, re, str, strl, visited, &cursor, &i, &match, stats))
+      break;
 
-    bt_stack_ent e =
-        SLOWARR_MANGLE_F(bt_stack_ent, pop)(&bt_stack);
-    cursor = e.cursor;
-    i = e.i;
-    match = e.match;
+    if (stats)
+    {
+      stats->bt_pops++;
+      if (cursor == restart)
+        stats->restarts++;
+    }
   } while (1);
 
+  while (bt_stack.len)
+    tpre_match_free(SLOWARR_MANGLE_F(bt_stack_ent, pop)(&bt_stack).match);
+  SLOWARR_MANGLE_F(bt_stack_ent, unsafeClear)(&bt_stack);
+  free(visited);
+
+  if (cfg && cfg->steps_out)
+    *cfg->steps_out = steps;
+  if (stats)
+    stats->nodes_visited = steps - dfa_steps;
   return match;
 }
 
+// a dfa reads a byte in much less time than a step of the backtracking takes
+#define DFA_DEADLINE_CHECK_INTERVAL (64 * 1024)
+
+/** the limits of [tpre_match_cfg_t] while the dfas read the input. every
+ * byte they read is a step */
+typedef struct
+{
+  uint64_t max_steps;
+  uint64_t deadline_ns;
+  uint64_t steps;
+  bool aborted;
+} scan_limits;
+
+static scan_limits scan_limits_of(tpre_match_cfg_t const* cfg)
+{
+  scan_limits lim = { 0 };
+  if (cfg)
+  {
+    lim.max_steps = cfg->max_steps;
+    lim.deadline_ns = cfg->deadline_ns;
+  }
+  return lim;
+}
+
+/** counts the bytes that were read, and returns how many more can be read
+ * before this has to be called again. 0 if a limit was hit */
+static size_t scan_allowance(scan_limits* lim, size_t read)
+{
+  lim->steps += read;
+  if ((lim->max_steps && lim->steps >= lim->max_steps) ||
+      (lim->deadline_ns && tpre_monotonic_ns() >= lim->deadline_ns))
+  {
+    lim->aborted = true;
+    return 0;
+  }
+  size_t left = lim->deadline_ns ? DFA_DEADLINE_CHECK_INTERVAL : SIZE_MAX;
+  if (lim->max_steps && lim->max_steps - lim->steps < left)
+    left = (size_t) (lim->max_steps - lim->steps);
+  return left;
+}
+
+/** where the first match that ends at or before from, and doesn't begin
+ * before until, begins. NO_POS if there is none, or if a limit was hit */
+static size_t dfa_leftmost_begin(
+    tpre_dfa_t const* rev,
+    const char* str,
+    size_t strl,
+    size_t from,
+    size_t until,
+    scan_limits* lim)
+{
+  size_t found = NO_POS;
+  uint16_t state = from == strl ? rev->start : rev->start_mid;
+  size_t p = from;
+  size_t counted = p;
+  size_t left = 0;
+  while (state)
+  {
+    if (rev->accept[state] &
+        (p == 0 ? TPRE_DFA_ACCEPT_AT_END : TPRE_DFA_ACCEPT))
+      found = p;
+    if (p == until)
+      break;
+    if (!left)
+    {
+      left = scan_allowance(lim, counted - p);
+      counted = p;
+      if (!left)
+        return NO_POS;
+    }
+    left--;
+    p--;
+    state =
+        rev->next[state * rev->num_classes + rev->classes[(uint8_t) str[p]]];
+  }
+  lim->steps += counted - p;
+  return found;
+}
+
+/** where the longest match that begins at begin ends. NO_POS if there is
+ * none, or if a limit was hit */
+static size_t dfa_longest_end(
+    tpre_dfa_t const* fwd,
+    const char* str,
+    size_t strl,
+    size_t begin,
+    scan_limits* lim)
+{
+  size_t found = NO_POS;
+  uint16_t state = begin == 0 ? fwd->start : fwd->start_mid;
+  size_t p = begin;
+  size_t counted = p;
+  size_t left = 0;
+  while (state)
+  {
+    if (fwd->accept[state] &
+        (p == strl ? TPRE_DFA_ACCEPT_AT_END : TPRE_DFA_ACCEPT))
+      found = p;
+    if (p == strl)
+      break;
+    if (!left)
+    {
+      left = scan_allowance(lim, p - counted);
+      counted = p;
+      if (!left)
+        return NO_POS;
+    }
+    left--;
+    state =
+        fwd->next[state * fwd->num_classes + fwd->classes[(uint8_t) str[p]]];
+    p++;
+  }
+  lim->steps += p - counted;
+  return found;
+}
+
+/** where the match that ends first ends. NO_POS if there is none, or if a
+ * limit was hit */
+static size_t dfa_earliest_end(
+    tpre_dfa_t const* fwd, const char* str, size_t strl, scan_limits* lim)
+{
+  uint16_t state = fwd->start;
+  size_t p = 0;
+  size_t counted = p;
+  size_t left = 0;
+  while (state)
+  {
+    if (fwd->accept[state] &
+        (p == strl ? TPRE_DFA_ACCEPT_AT_END : TPRE_DFA_ACCEPT))
+      break;
+    if (p == strl)
+    {
+      state = 0;
+      break;
+    }
+    if (!left)
+    {
+      left = scan_allowance(lim, p - counted);
+      counted = p;
+      if (!left)
+        return NO_POS;
+    }
+    if (state == fwd->skip_state)
+    {
+      // the bytes before the next skip_byte don't change the state
+      size_t until = strl - p > left ? p + left : strl;
+      size_t q = tprert_byte_scan(str, p, until, fwd->skip_byte);
+      left -= q - p;
+      p = q;
+      if (p == until)
+        continue;
+    }
+    left--;
+    state =
+        fwd->next[state * fwd->num_classes + fwd->classes[(uint8_t) str[p]]];
+    p++;
+  }
+  lim->steps += p - counted;
+  return state ? p : NO_POS;
+}
+
+/** result of a match that was decided by the dfas alone, or that they hit a
+ * limit in */
+static tpre_match_t dfa_only_match(
+    tpre_re_t const* re,
+    tpre_match_cfg_t const* cfg,
+    bool found,
+    scan_limits const* lim)
+{
+  tpre_match_t match = init_match(re, false);
+  match.found = found && !lim->aborted;
+  match.aborted = lim->aborted;
+  if (cfg && cfg->steps_out)
+    *cfg->steps_out = lim->steps;
+  if (cfg && cfg->stats_out)
+  {
+    memset(cfg->stats_out, 0, sizeof(*cfg->stats_out));
+    cfg->stats_out->dfa_bytes = lim->steps;
+  }
+  return match;
+}
+
+/** runs the regex without the `.*?` of start unanchored regexes from begin */
+static tpre_match_t backtrack_from(
+    tpre_re_t const* re,
+    const char* str,
+    size_t strl,
+    tpre_match_cfg_t const* cfg,
+    bool captures,
+    size_t begin,
+    size_t end_at,
+    uint64_t dfa_steps)
+{
+  tpre_nodeid_t first = re->first_node;
+  if (restart_node(re) != NODE_ERR)
+    first = re->i[first].ok;
+  return backtrack(
+      re, str, strl, cfg, captures, first, begin, end_at, dfa_steps);
+}
+
+/** the dfas find the span of the match, and then the groups are captured by
+ * backtracking only from its beginning, and only up to its end */
+static tpre_match_t match_longest(
+    tpre_re_t const* re,
+    const char* str,
+    size_t strl,
+    tpre_match_cfg_t const* cfg,
+    bool captures)
+{
+  tpre_dfa_t const* fwd = re->dfa_forward;
+  scan_limits lim = scan_limits_of(cfg);
+  size_t begin = 0;
+  // if nothing can begin in the middle, there is no need to search
+  if (fwd->start_mid)
+    begin = dfa_leftmost_begin(re->dfa_reverse, str, strl, strl, 0, &lim);
+  size_t end = begin == NO_POS
+      ? NO_POS
+      : dfa_longest_end(fwd, str, strl, begin, &lim);
+
+  if (lim.aborted || end == NO_POS || !captures)
+    return dfa_only_match(re, cfg, end != NO_POS, &lim);
+  return backtrack_from(re, str, strl, cfg, true, begin, end, lim.steps);
+}
+
+/**
+ * search of start unanchored regexes in three steps: the search dfa finds
+ * the end of the match that ends first, or that there is none. the leftmost
+ * match can't begin after that end, and ends no earlier. so if matches are
+ * at most max_len long, the reverse dfa only has to look at max_len bytes on
+ * both sides of it to find where the leftmost match begins. only then the
+ * backtracking runtime runs, from that position, to pick the match and
+ * capture the groups.
+ */
+static tpre_match_t match_search(
+    tpre_re_t const* re,
+    const char* str,
+    size_t strl,
+    tpre_match_cfg_t const* cfg,
+    bool captures)
+{
+  scan_limits lim = scan_limits_of(cfg);
+  size_t end = dfa_earliest_end(re->dfa_search, str, strl, &lim);
+  if (lim.aborted || end == NO_POS || !captures)
+    return dfa_only_match(re, cfg, end != NO_POS, &lim);
+
+  tpre_dfa_t const* rev = re->dfa_reverse;
+  size_t from = strl;
+  size_t until = 0;
+  if (rev->max_len != UINT32_MAX)
+  {
+    if (rev->max_len < strl - end)
+      from = end + rev->max_len;
+    if (rev->max_len < end)
+      until = end - rev->max_len;
+  }
+  size_t begin = dfa_leftmost_begin(rev, str, strl, from, until, &lim);
+  if (lim.aborted)
+    return dfa_only_match(re, cfg, false, &lim);
+  if (begin == NO_POS)
+    return backtrack(
+        re, str, strl, cfg, captures, re->first_node, 0, NO_POS, lim.steps);
+  return backtrack_from(
+      re, str, strl, cfg, captures, begin, NO_POS, lim.steps);
+}
+
+static tpre_match_t matchn(
+    tpre_re_t const* re,
+    const char* str,
+    size_t strl,
+    tpre_match_cfg_t const* cfg,
+    bool captures)
+{
+  if (strl > TPRE_SRC_MAX)
+  {
+    // the positions of the groups can't be represented
+    tpre_match_t match = init_match(re, false);
+    match.aborted = true;
+    return match;
+  }
+  if (re->longest && re->dfa_forward && re->dfa_reverse)
+    return match_longest(re, str, strl, cfg, captures);
+  if (re->dfa_search && re->dfa_reverse && restart_node(re) != NODE_ERR)
+    return match_search(re, str, strl, cfg, captures);
+  return backtrack(
+      re, str, strl, cfg, captures, re->first_node, 0, NO_POS, 0);
+}
+
+tpre_match_t tpre_matchn_cfg(
+    tpre_re_t const* re,
+    const char* str,
+    size_t strl,
+    tpre_match_cfg_t const* cfg)
+{
+  return matchn(re, str, strl, cfg, true);
+}
+
+tpre_match_t
+tpre_matchn(tpre_re_t const* re, const char* str, size_t strl)
+{
+  return tpre_matchn_cfg(re, str, strl, NULL);
+}
+
+bool tpre_is_match_cfg(
+    tpre_re_t const* re,
+    const char* str,
+    size_t strl,
+    tpre_match_cfg_t const* cfg)
+{
+  tpre_match_t match = matchn(re, str, strl, cfg, re->has_backrefs);
+  bool found = match.found && !match.aborted;
+  tpre_match_free(match);
+  return found;
+}
+
+bool tpre_is_match(tpre_re_t const* re, const char* str, size_t strl)
+{
+  return tpre_is_match_cfg(re, str, strl, NULL);
+}
+
 void tpre_match_dump(
     tpre_re_t const* re,
     tpre_match_t match,
@@ -213,3 +1175,75 @@ void tpre_match_dump(
     fprintf(out, "does not match\n");
   }
 }
+
+void tpre_profile_dump(
+    tpre_re_t const* re,
+    tpre_node_profile_t const* profile,
+    char const* pattern,
+    FILE* out)
+{
+  fprintf(out, "start = %i\n", re->first_node);
+  fprintf(out, "nd\tok\terr\tv\tbt\tg\tvisits\tok\terr\twhere\n");
+  size_t patl = pattern ? strlen(pattern) : 0;
+  for (tpre_nodeid_t i = 0; i < re->num_nodes; i++)
+  {
+    tpre_re_node_t nd = re->i[i];
+    char s[3];
+    tpre_pattern_str(nd.pat, s);
+    fprintf(
+        out, "%i\t%i\t%i\t%s\t%u\t%u\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64,
+        i, nd.ok, nd.err, s, nd.backtrack, nd.group, profile[i].visits,
+        profile[i].ok, profile[i].err);
+
+    uint32_t wherePlus1 = re->wherePlus1 ? re->wherePlus1[i] : 0;
+    if (wherePlus1)
+    {
+      size_t where = wherePlus1 - 1;
+      fprintf(out, "\t%zu", where);
+      if (where < patl)
+      {
+        // a bit of the pattern from there on, to find it at a glance
+        size_t n = patl - where;
+        if (n > 12)
+          n = 12;
+        fprintf(out, "\t%.*s", (int) n, pattern + where);
+      }
+    }
+    fprintf(out, "\n");
+  }
+}
+
+/** whether the pattern consumes input when it matches */
+static bool pattern_consumes(tpre_pattern_t pat)
+{
+  if (!pat.is_special)
+    return true;
+  switch (pat.val)
+  {
+    case SPECIAL_ANY:
+    case SPECIAL_SPACE:
+    case SPECIAL_DIGIT:
+    case SPECIAL_WORDC:
+    case SPECIAL_CLASS:
+    case SPECIAL_STRING: return true;
+
+    default: return false;
+  }
+}
+
+void tpre_profile_weights(
+    tpre_re_t const* re,
+    tpre_node_profile_t const* profile,
+    uint64_t* out,
+    size_t patl)
+{
+  if (!re->wherePlus1)
+    return;
+  for (tpre_nodeid_t i = 0; i < re->num_nodes; i++)
+  {
+    uint32_t wherePlus1 = re->wherePlus1[i];
+    if (wherePlus1 && wherePlus1 - 1 < patl &&
+        pattern_consumes(re->i[i].pat))
+      out[wherePlus1 - 1] += profile[i].ok;
+  }
+}
@@ -1,3 +1,8 @@
+#ifndef _TPRE_SHARED_H
+#define _TPRE_SHARED_H
+
+#include "include/tpre_common.h"
+
 #define NODE_DONE ((tpre_nodeid_t) - 2)
 #define NODE_ERR ((tpre_nodeid_t) - 1)
 
@@ -8,9 +13,75 @@
 #define SPECIAL_DIGIT (4)
 #define SPECIAL_WORDC (5)
 #define SPECIAL_BT_PUSH (6)
+/* arg is the index of the class */
+#define SPECIAL_CLASS (7)
+/* sets the slot arg to 0 */
+#define SPECIAL_CTR_INIT (8)
+/* arg is the index of the loop. ok is the body, err is where the loop exits to.
+ * an empty iteration after the first min ones exits the loop */
+#define SPECIAL_LOOP (9)
+/* stores the depth of the backtrack stack in the slot arg */
+#define SPECIAL_ATOMIC_BEGIN (10)
+/* drops all backtracks pushed since the ATOMIC_BEGIN with the same slot */
+#define SPECIAL_ATOMIC_END (11)
+/* matches the text that the group arg captured */
+#define SPECIAL_BACKREF (12)
+/* repeat of a class, arg is the index of the run. ok is what follows the
+ * repeat. consumes as many bytes as it can (or as few, if lazy), and pushes
+ * a single backtrack for all the other lengths */
+#define SPECIAL_RUN (13)
+/* literal bytes, arg is the index of the string. consumes all of them or
+ * nothing */
+#define SPECIAL_STRING (14)
+/* stores the position in the slot arg. begins an iteration of a loop whose
+ * body can match the empty string */
+#define SPECIAL_ITER_BEGIN (15)
+/* ends such an iteration: goes to err if nothing was consumed since the
+ * ITER_BEGIN with the same slot, and to ok otherwise */
+#define SPECIAL_ITER_END (16)
+/* the group arg is captured again from here on */
+#define SPECIAL_GROUP_BEGIN (17)
 #define NO(c)         \
   ((tpre_pattern_t) { \
     .is_special = 0, .val = (uint8_t) c, .invert = 0 })
 #define SP(c)         \
   ((tpre_pattern_t) { \
     .is_special = 1, .val = (uint8_t) c, .invert = 0 })
+
+/** short name of the pattern for program dumps, like "a" or "\\d" */
+static inline void tpre_pattern_str(tpre_pattern_t pat, char s[3])
+{
+  if (!pat.is_special)
+  {
+    s[0] = (char) pat.val;
+    s[1] = '\0';
+    return;
+  }
+  s[0] = '\\';
+  s[1] = '?';
+  switch (pat.val)
+  {
+    case SPECIAL_ANY:     s[1] = '*'; break;
+    case SPECIAL_END:     s[1] = '$'; break;
+    case SPECIAL_SPACE:   s[1] = 's'; break;
+    case SPECIAL_START:   s[1] = '^'; break;
+    case SPECIAL_DIGIT:   s[1] = 'd'; break;
+    case SPECIAL_WORDC:   s[1] = 'w'; break;
+    case SPECIAL_BT_PUSH: s[1] = '{'; break;
+    case SPECIAL_CLASS:   s[1] = '['; break;
+    case SPECIAL_CTR_INIT: s[1] = '0'; break;
+    case SPECIAL_LOOP:    s[1] = '@'; break;
+    case SPECIAL_ATOMIC_BEGIN: s[1] = '>'; break;
+    case SPECIAL_ATOMIC_END:   s[1] = '<'; break;
+    case SPECIAL_BACKREF:      s[1] = '1'; break;
+    case SPECIAL_RUN:          s[1] = '+'; break;
+    case SPECIAL_STRING:       s[1] = '"'; break;
+    case SPECIAL_ITER_BEGIN:   s[1] = '('; break;
+    case SPECIAL_ITER_END:     s[1] = ')'; break;
+    case SPECIAL_GROUP_BEGIN:  s[1] = 'g'; break;
+    default:              break;
+  }
+  s[2] = '\0';
+}
+
+#endif
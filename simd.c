@@ -0,0 +1,389 @@
+#include <stdlib.h>
+#include <string.h>
+#include "simd.h"
+
+// the vector kernels are compiled for their instructions, no matter what
+// the rest is compiled for, and only called if the cpu has them
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define TPRE_SIMD_X86
+# include <immintrin.h>
+#endif
+
+typedef size_t (*scan_fn)(
+    tpre_class_t const* cls,
+    tpre_run_t const* run,
+    const char* str,
+    size_t p,
+    size_t strl,
+    int stop);
+
+/** the reference that the vector kernels are tested against, and that does
+ * their tails */
+static size_t scan_scalar(
+    tpre_class_t const* cls,
+    tpre_run_t const* run,
+    const char* str,
+    size_t p,
+    size_t strl,
+    int stop)
+{
+  (void) run;
+  for (; p < strl; p++)
+  {
+    uint8_t b = (uint8_t) str[p];
+    if (!((cls->bits[b >> 3] >> (b & 7)) & 1) || b == stop)
+      break;
+  }
+  return p;
+}
+
+#ifdef TPRE_SIMD_X86
+// a byte v is in the range lo..hi if v - lo <= hi - lo, unsigned
+
+__attribute__((target("sse2"))) static size_t scan_sse2(
+    tpre_class_t const* cls,
+    tpre_run_t const* run,
+    const char* str,
+    size_t p,
+    size_t strl,
+    int stop)
+{
+  if (!run->num_ranges)
+    return scan_scalar(cls, run, str, p, strl, stop);
+
+  __m128i lo[TPRE_RUN_MAX_RANGES], width[TPRE_RUN_MAX_RANGES];
+  for (uint8_t r = 0; r < run->num_ranges; r++)
+  {
+    lo[r] = _mm_set1_epi8((char) run->lo[r]);
+    width[r] = _mm_set1_epi8((char) (run->hi[r] - run->lo[r]));
+  }
+  __m128i stop_v = _mm_set1_epi8((char) stop);
+  for (; p + 16 <= strl; p += 16)
+  {
+    __m128i v = _mm_loadu_si128((__m128i const*) (str + p));
+    __m128i in = _mm_setzero_si128();
+    for (uint8_t r = 0; r < run->num_ranges; r++)
+    {
+      __m128i d = _mm_sub_epi8(v, lo[r]);
+      in = _mm_or_si128(in, _mm_cmpeq_epi8(_mm_min_epu8(d, width[r]), d));
+    }
+    if (stop >= 0)
+      in = _mm_andnot_si128(_mm_cmpeq_epi8(v, stop_v), in);
+    unsigned out = ~(unsigned) _mm_movemask_epi8(in) & 0xFFFF;
+    if (out)
+      return p + (size_t) __builtin_ctz(out);
+  }
+  return scan_scalar(cls, run, str, p, strl, stop);
+}
+
+__attribute__((target("sse4.2"))) static size_t scan_sse42(
+    tpre_class_t const* cls,
+    tpre_run_t const* run,
+    const char* str,
+    size_t p,
+    size_t strl,
+    int stop)
+{
+  if (!run->num_ranges)
+    return scan_scalar(cls, run, str, p, strl, stop);
+
+  // pcmpestri checks up to 8 ranges at once. the stop byte is cut out of
+  // its range, which makes at most one more
+  uint8_t pairs[16] = { 0 };
+  int num = 0;
+  for (uint8_t r = 0; r < run->num_ranges; r++)
+  {
+    int lo = run->lo[r], hi = run->hi[r];
+    if (stop >= lo && stop <= hi)
+    {
+      if (stop > lo)
+      {
+        pairs[num++] = (uint8_t) lo;
+        pairs[num++] = (uint8_t) (stop - 1);
+      }
+      if (stop < hi)
+      {
+        pairs[num++] = (uint8_t) (stop + 1);
+        pairs[num++] = (uint8_t) hi;
+      }
+      continue;
+    }
+    pairs[num++] = (uint8_t) lo;
+    pairs[num++] = (uint8_t) hi;
+  }
+
+  __m128i ranges = _mm_loadu_si128((__m128i const*) pairs);
+  for (; p + 16 <= strl; p += 16)
+  {
+    __m128i v = _mm_loadu_si128((__m128i const*) (str + p));
+    // the lengths are explicit, so '\0' bytes are compared like any other
+    int out = _mm_cmpestri(
+        ranges, num, v, 16,
+        _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_NEGATIVE_POLARITY |
+            _SIDD_LEAST_SIGNIFICANT);
+    if (out < 16)
+      return p + (size_t) out;
+  }
+  return scan_scalar(cls, run, str, p, strl, stop);
+}
+
+__attribute__((target("avx2"))) static size_t scan_avx2(
+    tpre_class_t const* cls,
+    tpre_run_t const* run,
+    const char* str,
+    size_t p,
+    size_t strl,
+    int stop)
+{
+  if (!run->num_ranges)
+    return scan_scalar(cls, run, str, p, strl, stop);
+
+  __m256i lo[TPRE_RUN_MAX_RANGES], width[TPRE_RUN_MAX_RANGES];
+  for (uint8_t r = 0; r < run->num_ranges; r++)
+  {
+    lo[r] = _mm256_set1_epi8((char) run->lo[r]);
+    width[r] = _mm256_set1_epi8((char) (run->hi[r] - run->lo[r]));
+  }
+  __m256i stop_v = _mm256_set1_epi8((char) stop);
+  for (; p + 32 <= strl; p += 32)
+  {
+    __m256i v = _mm256_loadu_si256((__m256i const*) (str + p));
+    __m256i in = _mm256_setzero_si256();
+    for (uint8_t r = 0; r < run->num_ranges; r++)
+    {
+      __m256i d = _mm256_sub_epi8(v, lo[r]);
+      in = _mm256_or_si256(
+          in, _mm256_cmpeq_epi8(_mm256_min_epu8(d, width[r]), d));
+    }
+    if (stop >= 0)
+      in = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, stop_v), in);
+    uint32_t out = ~(uint32_t) _mm256_movemask_epi8(in);
+    if (out)
+      return p + (size_t) __builtin_ctz(out);
+  }
+  return scan_scalar(cls, run, str, p, strl, stop);
+}
+
+__attribute__((target("avx512bw"))) static size_t scan_avx512(
+    tpre_class_t const* cls,
+    tpre_run_t const* run,
+    const char* str,
+    size_t p,
+    size_t strl,
+    int stop)
+{
+  if (!run->num_ranges)
+    return scan_scalar(cls, run, str, p, strl, stop);
+
+  __m512i lo[TPRE_RUN_MAX_RANGES], width[TPRE_RUN_MAX_RANGES];
+  for (uint8_t r = 0; r < run->num_ranges; r++)
+  {
+    lo[r] = _mm512_set1_epi8((char) run->lo[r]);
+    width[r] = _mm512_set1_epi8((char) (run->hi[r] - run->lo[r]));
+  }
+  __m512i stop_v = _mm512_set1_epi8((char) stop);
+  while (p < strl)
+  {
+    // the tail is loaded with a mask, which doesn't read past the end
+    __mmask64 valid = strl - p >= 64
+        ? ~(__mmask64) 0
+        : ((__mmask64) 1 << (strl - p)) - 1;
+    __m512i v = _mm512_maskz_loadu_epi8(valid, str + p);
+    __mmask64 in = 0;
+    for (uint8_t r = 0; r < run->num_ranges; r++)
+      in |= _mm512_cmple_epu8_mask(_mm512_sub_epi8(v, lo[r]), width[r]);
+    if (stop >= 0)
+      in &= ~_mm512_cmpeq_epi8_mask(v, stop_v);
+    uint64_t out = ~(uint64_t) in & valid;
+    if (out)
+      return p + (size_t) __builtin_ctzll(out);
+    p = strl - p >= 64 ? p + 64 : strl;
+  }
+  return p;
+}
+#endif
+
+typedef size_t (*find_fn)(
+    const char* str, size_t p, size_t strl, uint8_t byte);
+
+static size_t find_scalar(
+    const char* str, size_t p, size_t strl, uint8_t byte)
+{
+  if (p >= strl)
+    return strl;
+  char const* found = memchr(str + p, byte, strl - p);
+  return found ? (size_t) (found - str) : strl;
+}
+
+#ifdef TPRE_SIMD_X86
+__attribute__((target("sse2"))) static size_t find_sse2(
+    const char* str, size_t p, size_t strl, uint8_t byte)
+{
+  __m128i b = _mm_set1_epi8((char) byte);
+  for (; p + 16 <= strl; p += 16)
+  {
+    __m128i v = _mm_loadu_si128((__m128i const*) (str + p));
+    unsigned eq = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, b));
+    if (eq)
+      return p + (size_t) __builtin_ctz(eq);
+  }
+  return find_scalar(str, p, strl, byte);
+}
+
+__attribute__((target("avx2"))) static size_t find_avx2(
+    const char* str, size_t p, size_t strl, uint8_t byte)
+{
+  __m256i b = _mm256_set1_epi8((char) byte);
+  for (; p + 32 <= strl; p += 32)
+  {
+    __m256i v = _mm256_loadu_si256((__m256i const*) (str + p));
+    uint32_t eq = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, b));
+    if (eq)
+      return p + (size_t) __builtin_ctz(eq);
+  }
+  return find_scalar(str, p, strl, byte);
+}
+
+__attribute__((target("avx512bw"))) static size_t find_avx512(
+    const char* str, size_t p, size_t strl, uint8_t byte)
+{
+  __m512i b = _mm512_set1_epi8((char) byte);
+  while (p < strl)
+  {
+    __mmask64 valid = strl - p >= 64
+        ? ~(__mmask64) 0
+        : ((__mmask64) 1 << (strl - p)) - 1;
+    __m512i v = _mm512_maskz_loadu_epi8(valid, str + p);
+    uint64_t eq = _mm512_cmpeq_epi8_mask(v, b) & valid;
+    if (eq)
+      return p + (size_t) __builtin_ctzll(eq);
+    p = strl - p >= 64 ? p + 64 : strl;
+  }
+  return p;
+}
+#endif
+
+static scan_fn scan_for(tpre_simd_t simd)
+{
+  switch (simd)
+  {
+#ifdef TPRE_SIMD_X86
+    case TPRE_SIMD_SSE2:   return scan_sse2;
+    case TPRE_SIMD_SSE42:  return scan_sse42;
+    case TPRE_SIMD_AVX2:   return scan_avx2;
+    case TPRE_SIMD_AVX512: return scan_avx512;
+#endif
+    default: return scan_scalar;
+  }
+}
+
+static find_fn find_for(tpre_simd_t simd)
+{
+  switch (simd)
+  {
+#ifdef TPRE_SIMD_X86
+    // sse4.2 has nothing better for a single byte
+    case TPRE_SIMD_SSE2:
+    case TPRE_SIMD_SSE42:  return find_sse2;
+    case TPRE_SIMD_AVX2:   return find_avx2;
+    case TPRE_SIMD_AVX512: return find_avx512;
+#endif
+    default: return find_scalar;
+  }
+}
+
+/** the best instructions that the cpu has */
+static tpre_simd_t cpu_simd(void)
+{
+#ifdef TPRE_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw"))
+    return TPRE_SIMD_AVX512;
+  if (__builtin_cpu_supports("avx2"))
+    return TPRE_SIMD_AVX2;
+  if (__builtin_cpu_supports("sse4.2"))
+    return TPRE_SIMD_SSE42;
+  if (__builtin_cpu_supports("sse2"))
+    return TPRE_SIMD_SSE2;
+#endif
+  return TPRE_SIMD_NONE;
+}
+
+static char const* const simd_names[] = {
+  "none", "sse2", "sse4.2", "avx2", "avx512",
+};
+
+#define NUM_SIMD (sizeof(simd_names) / sizeof(*simd_names))
+
+// the tpre_simd_t in use, or -1 before the first use. matching can happen
+// on many threads, which all pick the same
+static int simd_in_use = -1;
+
+static int simd_load(void)
+{
+#ifdef __GNUC__
+  return __atomic_load_n(&simd_in_use, __ATOMIC_RELAXED);
+#else
+  return simd_in_use;
+#endif
+}
+
+static void simd_store(tpre_simd_t simd)
+{
+#ifdef __GNUC__
+  __atomic_store_n(&simd_in_use, (int) simd, __ATOMIC_RELAXED);
+#else
+  simd_in_use = (int) simd;
+#endif
+}
+
+tpre_simd_t tpre_simd(void)
+{
+  int simd = simd_load();
+  if (simd >= 0)
+    return (tpre_simd_t) simd;
+
+  tpre_simd_t best = cpu_simd();
+  tpre_simd_t pick = best;
+  char const* env = getenv("TPRE_SIMD");
+  for (size_t i = 0; env && i <= (size_t) best; i++)
+    if (!strcmp(env, simd_names[i]))
+      pick = (tpre_simd_t) i;
+  simd_store(pick);
+  return pick;
+}
+
+int tpre_simd_set(tpre_simd_t simd)
+{
+  if ((unsigned) simd >= NUM_SIMD || simd > cpu_simd())
+    return 1;
+  simd_store(simd);
+  return 0;
+}
+
+char const* tpre_simd_name(tpre_simd_t simd)
+{
+  if ((unsigned) simd >= NUM_SIMD)
+    return "?";
+  return simd_names[simd];
+}
+
+size_t tprert_run_scan(
+    tpre_class_t const* cls,
+    tpre_run_t const* run,
+    const char* str,
+    size_t from,
+    size_t strl,
+    int stop)
+{
+  if (run->num_ranges == 1 && run->lo[0] == 0 && run->hi[0] == 255 &&
+      stop < 0)
+    return strl;
+  return scan_for(tpre_simd())(cls, run, str, from, strl, stop);
+}
+
+size_t tprert_byte_scan(
+    const char* str, size_t from, size_t strl, uint8_t byte)
+{
+  return find_for(tpre_simd())(str, from, strl, byte);
+}
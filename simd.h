@@ -0,0 +1,22 @@
+#ifndef _TPRE_SIMD_H
+#define _TPRE_SIMD_H
+
+#include "include/tpre_runtime.h"
+
+/** first position from from on, where the byte is not in the class cls of
+ * the run, or is stop (if that is not negative). strl if there is none.
+ * uses the instructions picked by tpre_simd() */
+size_t tprert_run_scan(
+    tpre_class_t const* cls,
+    tpre_run_t const* run,
+    const char* str,
+    size_t from,
+    size_t strl,
+    int stop);
+
+/** first position from from on, where the byte is byte. strl if there is
+ * none. uses the instructions picked by tpre_simd() */
+size_t tprert_byte_scan(
+    const char* str, size_t from, size_t strl, uint8_t byte);
+
+#endif
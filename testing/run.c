@@ -58,7 +58,7 @@ static int read_cmp_result(tpre_match_t res, cJSON* jr)
   return 0;
 }
 
-int main()
+static void run_tests(void)
 {
   DIR* d = opendir("test-cases/test-cases");
   assert(d);
@@ -121,6 +121,16 @@ int main()
       tpre_re_t anchored;
       nok |=
           tpre_compile(&anchored, src, NULL, (tpre_opts_t) { 0 });
+      // leftmost-longest needs a dfa, so fails for more patterns
+      int nok_longest = 0;
+      tpre_re_t longest_unanchored;
+      nok_longest |= tpre_compile(
+          &longest_unanchored, src, NULL,
+          (tpre_opts_t) {
+            .start_unanchored = 1, .end_unanchored = 1, .longest = 1 });
+      tpre_re_t longest_anchored;
+      nok_longest |= tpre_compile(
+          &longest_anchored, src, NULL, (tpre_opts_t) { .longest = 1 });
       printf("postcomp\n");
       fflush(stdout);
 
@@ -156,10 +166,30 @@ int main()
             num_fail++;
           else
             num_pass++;
-          printf("done. pass: %u/2\n", num_pass - old_num_pass);
+          unsigned num_checks = 2;
+          if (!nok_longest)
+          {
+            num_checks += 2;
+            if (read_cmp_result(
+                    tpre_matchn(&longest_anchored, str, strl),
+                    cJSON_GetArrayItem(val, 2)))
+              num_fail++;
+            else
+              num_pass++;
+            if (read_cmp_result(
+                    tpre_matchn(&longest_unanchored, str, strl),
+                    cJSON_GetArrayItem(val, 3)))
+              num_fail++;
+            else
+              num_pass++;
+          }
+          printf(
+              "done. pass: %u/%u\n", num_pass - old_num_pass, num_checks);
           fflush(stdout);
         }
 
+      if (!nok && nok_longest)
+        printf("no longest: '%s'\n", src);
       if (nok)
         printf("FAIL compile: '%s'\n", src);
       else if (num_fail)
@@ -177,3 +207,199 @@ int main()
 
   closedir(d);
 }
+
+// a single match is stopped after this many steps. a step limit instead of a
+// deadline, so that the same matches are cut off on every machine
+#define BENCH_MAX_STEPS (1u << 16)
+
+struct bench_category
+{
+  char* name;
+  unsigned num_patterns;
+  unsigned num_compile_fail;
+  unsigned num_timeouts;
+  uint64_t compile_ns;
+  uint64_t num_matches;
+  uint64_t match_ns;
+  uint64_t match_bytes;
+};
+
+#define BENCH_MAX_CATEGORIES (64)
+
+static struct bench_category bench_cats[BENCH_MAX_CATEGORIES];
+static size_t bench_num_cats;
+
+/** category of a test case name like "EgrepLiterals.Lowercase" */
+static struct bench_category* bench_category_of(char const* test_name)
+{
+  size_t len = strcspn(test_name, ".");
+  size_t i;
+  for (i = 0; i < bench_num_cats; i++)
+    if (strlen(bench_cats[i].name) == len &&
+        !memcmp(bench_cats[i].name, test_name, len))
+      return &bench_cats[i];
+
+  assert(bench_num_cats < BENCH_MAX_CATEGORIES);
+  struct bench_category* c = &bench_cats[bench_num_cats++];
+  c->name = malloc(len + 1);
+  assert(c->name);
+  memcpy(c->name, test_name, len);
+  c->name[len] = '\0';
+  return c;
+}
+
+static void bench_print(struct bench_category const* c)
+{
+  unsigned ok = c->num_patterns - c->num_compile_fail;
+  printf(
+      "%-20s %8u %8u %8u %12.1f %12.1f %10.3f\n", c->name,
+      c->num_patterns, c->num_compile_fail, c->num_timeouts,
+      ok ? (double) c->compile_ns / ok : 0.0,
+      c->num_matches ? (double) c->match_ns / c->num_matches : 0.0,
+      c->match_ns ? (double) c->match_bytes * 1e3 / c->match_ns : 0.0);
+}
+
+/** compiles every regex of the corpus, and matches it against the strings of
+ * its test case, reps times, anchored and unanchored */
+static void run_bench(unsigned reps)
+{
+  DIR* d = opendir("test-cases/test-cases");
+  assert(d);
+
+  struct dirent* ent;
+  while ((ent = readdir(d)))
+  {
+    if (!strcmp(ent->d_name, ".."))
+      continue;
+
+    if (!strcmp(ent->d_name, "."))
+      continue;
+
+    char buf[512];
+
+    sprintf(buf, "test-cases/test-cases/%s", ent->d_name);
+    struct cjson_buf_pair test_case = read_json_file(buf);
+
+    char const* test_name = cJSON_GetStringValue(
+        cJSON_GetObjectItem(test_case.json, "name"));
+    assert(test_name);
+    struct bench_category* cat = bench_category_of(test_name);
+
+    cJSON* strs = cJSON_GetObjectItem(test_case.json, "strs");
+    assert(strs);
+
+    cJSON* regexs = cJSON_GetObjectItem(test_case.json, "regexs");
+    assert(regexs);
+
+    for (size_t regex_i = 0;
+         regex_i < cJSON_GetArraySize(regexs); regex_i++)
+    {
+      char const* regex_src = cJSON_GetStringValue(
+          cJSON_GetArrayItem(regexs, regex_i));
+      assert(regex_src);
+
+      static char src[1028];
+      sprintf(src, "(%s)", regex_src);
+
+      cat->num_patterns++;
+
+      uint64_t begin = tpre_monotonic_ns();
+      tpre_re_t unanchored;
+      int nok_unanchored = tpre_compile(
+          &unanchored, src, NULL,
+          (tpre_opts_t) {
+            .start_unanchored = 1, .end_unanchored = 1 });
+      tpre_re_t anchored;
+      int nok_anchored =
+          tpre_compile(&anchored, src, NULL, (tpre_opts_t) { 0 });
+      uint64_t compile_ns = tpre_monotonic_ns() - begin;
+
+      if (nok_unanchored || nok_anchored)
+      {
+        if (!nok_unanchored)
+          tpre_free(unanchored);
+        if (!nok_anchored)
+          tpre_free(anchored);
+        cat->num_compile_fail++;
+        continue;
+      }
+      cat->compile_ns += compile_ns / 2;
+
+      // patterns that hit the step limit are only counted as timeouts
+      struct bench_category pat = { 0 };
+      bool aborted = false;
+      for (unsigned rep = 0; rep < reps && !aborted; rep++)
+      {
+        for (size_t value_i = 0;
+             value_i < cJSON_GetArraySize(strs) && !aborted; value_i++)
+        {
+          char const* str = cJSON_GetStringValue(
+              cJSON_GetArrayItem(strs, value_i));
+          size_t strl = strlen(str);
+
+          for (int mode = 0; mode < 2 && !aborted; mode++)
+          {
+            tpre_match_cfg_t cfg = { 0 };
+            cfg.max_steps = BENCH_MAX_STEPS;
+            begin = tpre_monotonic_ns();
+            tpre_match_t m = tpre_matchn_cfg(
+                mode ? &unanchored : &anchored, str, strl, &cfg);
+            pat.match_ns += tpre_monotonic_ns() - begin;
+            aborted = m.aborted;
+            tpre_match_free(m);
+            pat.num_matches++;
+            pat.match_bytes += strl;
+          }
+        }
+      }
+
+      if (aborted)
+      {
+        cat->num_timeouts++;
+      }
+      else
+      {
+        cat->match_ns += pat.match_ns;
+        cat->num_matches += pat.num_matches;
+        cat->match_bytes += pat.match_bytes;
+      }
+
+      tpre_free(unanchored);
+      tpre_free(anchored);
+    }
+
+    cjson_buf_pair_free(test_case);
+  }
+
+  closedir(d);
+
+  printf(
+      "%-20s %8s %8s %8s %12s %12s %10s\n", "category", "patterns",
+      "no-comp", "timeout", "compile ns", "ns/match", "MB/s");
+  struct bench_category all = { .name = "all" };
+  for (size_t i = 0; i < bench_num_cats; i++)
+  {
+    struct bench_category* c = &bench_cats[i];
+    bench_print(c);
+    all.num_patterns += c->num_patterns;
+    all.num_compile_fail += c->num_compile_fail;
+    all.num_timeouts += c->num_timeouts;
+    all.compile_ns += c->compile_ns;
+    all.num_matches += c->num_matches;
+    all.match_ns += c->match_ns;
+    all.match_bytes += c->match_bytes;
+    free(c->name);
+  }
+  bench_print(&all);
+}
+
+/** `run` checks the corpus against the re2 results,
+ * `run --bench [reps]` measures compile time and match throughput instead */
+int main(int argc, char** argv)
+{
+  if (argc > 1 && !strcmp(argv[1], "--bench"))
+    run_bench(argc > 2 ? (unsigned) atoi(argv[2]) : 1);
+  else
+    run_tests();
+  return 0;
+}
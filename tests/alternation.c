@@ -0,0 +1,45 @@
+#include "testing.h"
+
+int main()
+{
+  tpre_match_t m;
+
+  // continuation after an or is shared, not copied into every case
+  tpre_re_t re;
+  if (tpre_compile(
+          &re, "(ab|cd)(ef|gh)(ij|kl)(mn|op)(qr|st)(uv|wx)yz", NULL,
+          (tpre_opts_t) { 0 }))
+    assert(false && "compile fail");
+  assert(re.num_nodes < 64);
+  m = tpre_matchn(&re, "cdefklmnstwxyz", 14);
+  assert(m.found);
+  assert(m.ngroups == 7);
+  assert(m.groups[6].begin == 10);
+  assert(m.groups[6].len == 2);
+  tpre_match_free(m);
+  tpre_free(re);
+
+  // common prefix is only factored out if all cases share it
+  m = match("(xa|y|xb)", "y", (tpre_opts_t) { 0 });
+  assert(m.found);
+  m = match("(xa|y|xb)", "xb", (tpre_opts_t) { 0 });
+  assert(m.found);
+
+  // cases with the same starting pattern in a repeating sequence
+  m = match("a*?b|ac", "ac", (tpre_opts_t) { 0 });
+  assert(m.found);
+  m = match("(ab)*|(ac)*", "acac", (tpre_opts_t) { 0 });
+  assert(m.found);
+  assert(m.ngroups == 3);
+  assert(m.groups[2].begin == 0);
+  assert(m.groups[2].len == 4);
+
+  // backtracking into an earlier or after the continuation failed
+  m = match("(a|ab)(c|bcd)(d*)", "abcd", (tpre_opts_t) { 0 });
+  assert(m.found);
+  assert(m.ngroups == 4);
+  assert(m.groups[1].len == 1);
+  assert(m.groups[2].begin == 1);
+  assert(m.groups[2].len == 3);
+  assert(m.groups[3].len == 0);
+}
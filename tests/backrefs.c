@@ -0,0 +1,76 @@
+#include <assert.h>
+#include "testing.h"
+
+int main()
+{
+  tpre_match_t m;
+
+  m = match("(a|b)\\1", "aa", (tpre_opts_t) { 0 });
+  assert(m.found);
+  m = match("(a|b)\\1", "ab", (tpre_opts_t) { 0 });
+  assert(!m.found);
+
+  // duplicate words
+  m = match(
+      "(\\w+) (\\1)", "the the",
+      (tpre_opts_t) { .start_unanchored = 1, .end_unanchored = 1 });
+  assert(m.found);
+  assert(m.ngroups == 3);
+  assert(m.groups[2].begin == 4);
+  assert(m.groups[2].len == 3);
+  m = match(
+      "(\\w+) \\1", "the then",
+      (tpre_opts_t) { .start_unanchored = 1, .end_unanchored = 0 });
+  assert(!m.found);
+
+  // backtracks into the group to find a shorter match
+  m = match("(a+)\\1", "aaaa", (tpre_opts_t) { 0 });
+  assert(m.found);
+  assert(m.groups[1].len == 2);
+
+  m = match("(?'q'[\"'])(.*)\\g{q}", "'hi'", (tpre_opts_t) { 0 });
+  assert(m.found);
+  assert(m.groups[1].len == 2);
+  m = match("(?'q'[\"'])(.*)\\g{q}", "'hi\"", (tpre_opts_t) { 0 });
+  assert(!m.found);
+
+  // compares with what the group captured in the last iteration
+  m = match("(a|b)+\\1", "abb", (tpre_opts_t) { 0 });
+  assert(m.found);
+  assert(m.groups[1].begin == 1);
+  assert(m.groups[1].len == 1);
+  m = match("(?:(a|b)c)+\\1", "acbcb", (tpre_opts_t) { 0 });
+  assert(m.found);
+  assert(m.groups[1].begin == 2);
+  m = match("(?:(a|b)c)+\\1", "acbca", (tpre_opts_t) { 0 });
+  assert(!m.found);
+
+  // groups that didn't match don't match anything
+  m = match("(a)|b\\1", "b", (tpre_opts_t) { 0 });
+  assert(!m.found);
+  m = match("(a)?b\\1", "b", (tpre_opts_t) { 0 });
+  assert(!m.found);
+  m = match("(a*)b\\1", "b", (tpre_opts_t) { 0 });
+  assert(m.found);
+  m = match("(a)|b(c)?\\1?", "b", (tpre_opts_t) { 0 });
+  assert(m.found);
+  assert(m.groups[1].begin == 0 && m.groups[1].len == 0);
+  assert(m.groups[2].begin == 0 && m.groups[2].len == 0);
+
+  // past the end of the input
+  m = match("(abc)x?\\1", "abcab", (tpre_opts_t) { 0 });
+  assert(!m.found);
+
+  tpre_re_t re;
+  tpre_errs_t errs;
+  assert(tpre_compile(&re, "(a)\\2", &errs, (tpre_opts_t) { 0 }));
+  assert(errs.len == 1);
+  tpre_errs_free(errs);
+  assert(tpre_compile(&re, "(a)\\g{nope}", &errs, (tpre_opts_t) { 0 }));
+  assert(errs.len == 1);
+  tpre_errs_free(errs);
+
+  assert(!tpre_compile(&re, "(?'x'a)(?'y'b)", NULL, (tpre_opts_t) { 0 }));
+  assert(tpre_find_group(&re, "y") == 2);
+  tpre_free(re);
+}
@@ -0,0 +1,69 @@
+#include <assert.h>
+#include <string.h>
+#include "tpre.h"
+
+/** begin < 0 means no match */
+static void check(
+    char const* pat,
+    tpre_opts_t opts,
+    char const* str,
+    size_t strl,
+    int begin,
+    size_t len)
+{
+  tpre_re_t re;
+  assert(!tpre_compile(&re, pat, NULL, opts));
+  tpre_match_t m = tpre_matchn(&re, str, strl);
+  assert(m.found == (begin >= 0));
+  assert(tpre_is_match(&re, str, strl) == m.found);
+  if (m.found)
+  {
+    assert(m.groups[0].begin == begin);
+    assert(m.groups[0].len == len);
+  }
+  tpre_match_free(m);
+  tpre_free(re);
+}
+
+static void check_all(tpre_opts_t opts)
+{
+  // '\0' is a byte like any other
+  check("a.c", opts, "a\0c", 3, 0, 3);
+  check("a[^b]c", opts, "a\0c", 3, 0, 3);
+  check("a\\Wc", opts, "a\0c", 3, 0, 3);
+  check("a\\Sc", opts, "a\0c", 3, 0, 3);
+  check("a\\D+", opts, "a\0\0", 3, 0, 3);
+  check("a\\wc", opts, "a\0c", 3, -1, 0);
+  check("a[a-z]c", opts, "a\0c", 3, -1, 0);
+
+  // and not the end of the input
+  check("a$", opts, "a\0", 2, -1, 0);
+  check("a.", opts, "a", 1, -1, 0);
+  check("a[^b]", opts, "a", 1, -1, 0);
+}
+
+int main()
+{
+  check_all((tpre_opts_t) { 0 });
+  check_all((tpre_opts_t) { .longest = true });
+
+  tpre_opts_t unanchored = { 0 };
+  tpre_opt_setb(&unanchored, TPRE_OPT_ANCHORED, false);
+  check_all(unanchored);
+  unanchored.no_dfa = true;
+  check_all(unanchored);
+  unanchored.no_dfa = false;
+
+  // searching goes past '\0'
+  char const bin[] = "\0\0GET\0/x\0";
+  size_t binl = sizeof(bin) - 1;
+  check("GET.(/\\w)", unanchored, bin, binl, 2, 6);
+  check("x$", unanchored, bin, binl, -1, 0);
+  check("x.$", unanchored, bin, binl, 7, 2);
+  unanchored.no_dfa = true;
+  check("GET.(/\\w)", unanchored, bin, binl, 2, 6);
+  check("x.$", unanchored, bin, binl, 7, 2);
+  unanchored.longest = true;
+  check("GET.(/\\w)", unanchored, bin, binl, 2, 6);
+  check("x.$", unanchored, bin, binl, 7, 2);
+}
@@ -0,0 +1,166 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tpre.h"
+
+static tpre_fsm_pat_t oneof(uint8_t c)
+{
+  tpre_fsm_pat_t pat = { .kind = TPRE_FSM_PAT_ONEOF };
+  pat.v.ascii.len = 1;
+  pat.v.ascii.items = malloc(1);
+  pat.v.ascii.items[0] = c;
+  return pat;
+}
+
+static tpre_fsm_pat_t pat(tpre_fsm_patkind kind)
+{
+  return (tpre_fsm_pat_t) { .kind = kind };
+}
+
+static tpre_match_t
+match_fsm(char const* pat, char const* str, tpre_opts_t opts)
+{
+  tpre_fsm_t fsm;
+  assert(!tpre2fsm(&fsm, pat, NULL, opts));
+  tpre_re_t re;
+  assert(!tpre_fsm2re(&re, &fsm));
+  tpre_fsm_free(&fsm);
+  tpre_match_t m = tpre_matchn(&re, str, strlen(str));
+  tpre_free(re);
+  return m;
+}
+
+static void same(char const* pat, char const* str, tpre_opts_t opts)
+{
+  tpre_re_t re;
+  assert(!tpre_compile(&re, pat, NULL, opts));
+  tpre_match_t want = tpre_matchn(&re, str, strlen(str));
+  tpre_match_t got = match_fsm(pat, str, opts);
+  tpre_free(re);
+
+  assert(got.found == want.found);
+  if (want.found)
+  {
+    assert(got.ngroups == want.ngroups);
+    assert(got.groups[0].begin == want.groups[0].begin);
+    assert(got.groups[0].len == want.groups[0].len);
+    for (size_t i = 1; i < want.ngroups; i++)
+    {
+      assert(got.groups[i].len == want.groups[i].len);
+      if (want.groups[i].len)
+        assert(got.groups[i].begin == want.groups[i].begin);
+    }
+  }
+  tpre_match_free(want);
+  tpre_match_free(got);
+}
+
+int main()
+{
+  static char const* pats[] = {
+    "abc", "a(b|c)d", "(a|ab)(c|bcd)(d*)", "a*?b|ac", "(ab)*|(ac)*",
+    "x(a+)(b*)y", "(a?)(ab)", "[a-c]+(d|e)?", "\\d+(\\s*)\\w", "a(?:a?)$",
+    "(a{2,3})(a*)", "(ab){2}|a(c{0,2})", "([^a-c]*)(b|c)", "a[^\\d\\s]+",
+    "a(|b|)c", "()(a|)",
+  };
+  static char const* strs[] = {
+    "abc", "abd", "acd", "abcd", "ab", "aaab", "ac", "abab", "acac",
+    "xaaby", "xy", "aab", "cbad", "cce", "12  x", "1a", "", "aaaaa",
+    "accc",
+  };
+  // and where matches begin, if they can begin anywhere
+  tpre_opts_t unanchored = { .start_unanchored = 1 };
+  for (size_t p = 0; p < sizeof(pats) / sizeof(*pats); p++)
+    for (size_t s = 0; s < sizeof(strs) / sizeof(*strs); s++)
+    {
+      same(pats[p], strs[s], (tpre_opts_t) { 0 });
+      same(pats[p], strs[s], unanchored);
+    }
+
+  tpre_match_t m = match_fsm("[^a-c]\\S", "dx", (tpre_opts_t) { 0 });
+  assert(m.found);
+  tpre_match_free(m);
+  m = match_fsm("[^a-c]\\S", "b1", (tpre_opts_t) { 0 });
+  assert(!m.found);
+  tpre_match_free(m);
+  m = match_fsm("\\S", " ", (tpre_opts_t) { 0 });
+  assert(!m.found);
+  tpre_match_free(m);
+
+  m = match_fsm("[a1]*", "a aa1 aa", unanchored);
+  assert(m.found);
+  assert(m.groups[0].begin == 6);
+  assert(m.groups[0].len == 2);
+  tpre_match_free(m);
+  m = match_fsm("\\S*", "1 1baab", unanchored);
+  assert(m.found);
+  assert(m.groups[0].begin == 2);
+  assert(m.groups[0].len == 5);
+  tpre_match_free(m);
+  m = match_fsm("^a", "ba", unanchored);
+  assert(!m.found);
+  tpre_match_free(m);
+
+  assert(tpre2fsm(&(tpre_fsm_t) { 0 }, "(a)\\1", NULL, (tpre_opts_t) { 0 }));
+
+  tpre_fsm_t fsm;
+  tpre_fsm_init(&fsm);
+
+  tpre_fsm_node_t* first = tpre_fsm_mknd(&fsm);
+  tpre_fsm_node_t* a = tpre_fsm_mknd(&fsm);
+  tpre_fsm_node_t* b1 = tpre_fsm_mknd(&fsm);
+  tpre_fsm_node_t* b2 = tpre_fsm_mknd(&fsm);
+  tpre_fsm_node_t* unused = tpre_fsm_mknd(&fsm);
+  fsm.first = first;
+
+  // ^[xy]^?$
+  tpre_fsm_addcase(
+      first, (tpre_fsm_case_t) { pat(TPRE_FSM_PAT_START), a, 0 });
+  tpre_fsm_addcase(a, (tpre_fsm_case_t) { oneof('x'), b1, 1 });
+  tpre_fsm_addcase(a, (tpre_fsm_case_t) { oneof('y'), b2, 1 });
+  tpre_fsm_addcase(
+      b1, (tpre_fsm_case_t) { pat(TPRE_FSM_PAT_START), b1, 0 });
+  tpre_fsm_addcase(
+      b1, (tpre_fsm_case_t) { pat(TPRE_FSM_PAT_END), fsm.nd_ok, 0 });
+  tpre_fsm_addcase(
+      b2, (tpre_fsm_case_t) { pat(TPRE_FSM_PAT_END), fsm.nd_ok, 0 });
+  tpre_fsm_addcase(
+      unused, (tpre_fsm_case_t) { oneof('z'), fsm.nd_ok, 0 });
+  assert(fsm._nodes.len == 7);
+
+  tpre_fsm_gc(&fsm);
+  assert(fsm._nodes.len == 6);
+
+  assert(!tpre_fsm_fold_start(&fsm));
+  assert(first->cases.len == 1);
+  assert(first->cases.items[0].pat.kind == TPRE_FSM_PAT_EMPTY);
+  assert(b1->cases.len == 1);
+  assert(b1->cases.items[0].pat.kind == TPRE_FSM_PAT_END);
+
+  assert(!tpre_fsm_minimize(&fsm));
+  assert(fsm._nodes.len == 5);
+  assert(a->cases.items[0].then == a->cases.items[1].then);
+  assert(fsm.first == first);
+
+  tpre_fsm_free(&fsm);
+
+  // a chain of the same byte, where every node is only told apart from the
+  // next one by its distance to the end
+  size_t len = 20000;
+  char* long_pat = malloc(len + 1);
+  memset(long_pat, 'a', len);
+  long_pat[len] = '\0';
+  assert(!tpre2fsm(&fsm, long_pat, NULL, (tpre_opts_t) { 0 }));
+  assert(fsm._nodes.len > len);
+  tpre_re_t re;
+  assert(!tpre_fsm2re(&re, &fsm));
+  tpre_fsm_free(&fsm);
+  m = tpre_matchn(&re, long_pat, len);
+  assert(m.found);
+  tpre_match_free(m);
+  m = tpre_matchn(&re, long_pat, len - 1);
+  assert(!m.found);
+  tpre_match_free(m);
+  tpre_free(re);
+  free(long_pat);
+}
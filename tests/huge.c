@@ -0,0 +1,162 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tpre.h"
+
+// generated patterns can be much larger than hand written ones, and compiling
+// them must not recurse once per case or per char
+
+static bool matches(tpre_re_t const* re, char const* str)
+{
+  tpre_match_t m = tpre_matchn(re, str, strlen(str));
+  bool found = m.found;
+  tpre_match_free(m);
+  return found;
+}
+
+int main()
+{
+  // kw0x|kw1x|...
+  size_t num = 20000;
+  char* pat = malloc(num * 16);
+  size_t len = 0;
+  for (size_t i = 0; i < num; i++)
+    len += (size_t) sprintf(pat + len, "%skw%zux", i ? "|" : "", i);
+
+  tpre_re_t re;
+  assert(!tpre_compile(&re, pat, NULL, (tpre_opts_t) { 0 }));
+  assert(matches(&re, "kw0x"));
+  assert(matches(&re, "kw12345x"));
+  assert(matches(&re, "kw19999x"));
+  assert(!matches(&re, "kw20000x"));
+  assert(!matches(&re, "kw123"));
+  tpre_free(re);
+
+  // more different words than there can be strings: the ones that don't fit
+  // are matched byte by byte
+  num = 70000;
+  pat = realloc(pat, num * 11);
+  len = 0;
+  uint32_t rng = 1;
+  for (size_t i = 0; i < num; i++)
+  {
+    if (i)
+      pat[len++] = '|';
+    for (size_t k = 0; k < 10; k++)
+    {
+      rng = rng * 1103515245u + 12345u;
+      pat[len++] = (char) ('a' + (rng >> 16) % 26);
+    }
+  }
+  pat[len] = '\0';
+  assert(!tpre_compile(&re, pat, NULL, (tpre_opts_t) { 0 }));
+  assert(re.num_strings == UINT16_MAX);
+  char word[11] = { 0 };
+  memcpy(word, pat, 10);
+  assert(matches(&re, word));
+  memcpy(word, pat + len - 10, 10);
+  assert(matches(&re, word));
+  assert(!matches(&re, "0123456789"));
+  tpre_free(re);
+
+  // a long literal is a long chain
+  len = 100000;
+  pat = realloc(pat, len + 1);
+  for (size_t i = 0; i < len; i++)
+    pat[i] = (char) ('a' + i % 26);
+  pat[len] = '\0';
+  assert(!tpre_compile(&re, pat, NULL, (tpre_opts_t) { 0 }));
+  assert(matches(&re, pat));
+  pat[len / 2] = '!';
+  assert(!matches(&re, pat));
+  tpre_free(re);
+
+  // and has too many positions for a dfa, which is not even tried. searches
+  // work without one, leftmost-longest matching needs it
+  pat[len / 2] = 'a';
+  tpre_opts_t search = { .start_unanchored = 1 };
+  assert(!tpre_compile(&re, pat, NULL, search));
+  assert(!re.dfa_search);
+  assert(matches(&re, pat));
+  tpre_free(re);
+  tpre_errs_t dfa_errs;
+  search.longest = 1;
+  assert(tpre_compile(&re, pat, &dfa_errs, search));
+  assert(dfa_errs.len == 1);
+  tpre_errs_free(dfa_errs);
+
+  // groups can be nested 1000 deep, but not deeper
+  for (size_t depth = 1000; depth <= 1001; depth++)
+  {
+    len = 0;
+    for (size_t i = 0; i < depth; i++)
+      len += (size_t) sprintf(pat + len, "(?:");
+    pat[len++] = 'a';
+    for (size_t i = 0; i < depth; i++)
+      pat[len++] = ')';
+    pat[len] = '\0';
+
+    tpre_errs_t errs;
+    int status = tpre_compile(&re, pat, &errs, (tpre_opts_t) { 0 });
+    if (depth == 1000)
+    {
+      assert(!status);
+      assert(matches(&re, "a"));
+      tpre_free(re);
+    }
+    else
+    {
+      assert(status);
+      assert(errs.len == 1);
+    }
+    tpre_errs_free(errs);
+  }
+
+  // two long chains that only differ in their first byte, which share all
+  // of their nodes but the first one
+  len = 0;
+  for (char c = 'x'; c <= 'y'; c++)
+  {
+    pat = realloc(pat, len + 16000 * 4 + 8);
+    len += (size_t) sprintf(pat + len, "%s%c", c == 'x' ? "(?:" : "|", c);
+    for (size_t i = 0; i < 16000; i++)
+      len += (size_t) sprintf(pat + len, "[ab]");
+  }
+  strcpy(pat + len, ")");
+  assert(!tpre_compile(&re, pat, NULL, (tpre_opts_t) { 0 }));
+  char* str = malloc(16002);
+  for (size_t i = 0; i < 16001; i++)
+    str[i] = i ? "ab"[i % 2] : 'y';
+  str[16001] = '\0';
+  assert(matches(&re, str));
+  str[16000] = 'c';
+  assert(!matches(&re, str));
+  free(str);
+  tpre_free(re);
+  free(pat);
+
+  // counted repeats and atomic groups each need a slot, and there can't be
+  // more than 65535 of them
+  char const* const slot_parts[] = { "a{9,}", "(?>a)" };
+  for (size_t k = 0; k < 2; k++)
+  {
+    size_t part_len = strlen(slot_parts[k]);
+    num = 66000;
+    pat = malloc(num * part_len + 1);
+    for (size_t i = 0; i < num; i++)
+      memcpy(pat + i * part_len, slot_parts[k], part_len);
+    pat[num * part_len] = '\0';
+
+    tpre_errs_t errs;
+    assert(tpre_compile(&re, pat, &errs, (tpre_opts_t) { 0 }));
+    assert(errs.len == 1);
+    tpre_errs_free(errs);
+    free(pat);
+  }
+
+  // empty cases are left out
+  assert(!tpre_compile(&re, "a||b", NULL, (tpre_opts_t) { 0 }));
+  assert(matches(&re, "b"));
+  tpre_free(re);
+}
@@ -0,0 +1,87 @@
+#include <assert.h>
+#include <string.h>
+#include "tpre.h"
+
+static char const* const pats[] = {
+  "abc", "(a|b)*c", "(?'x'a+)(b?)c", "[^a-c]+d", "a{2,3}(?>b+)c",
+  "(\\w+) \\1",
+};
+
+static char const* const strs[] = {
+  "abc", "ababc", "aac", "aabc", "xyzd", "aabbc", "aaabc",
+  "the the", "the then", "", "c",
+};
+
+#define LEN(a) (sizeof(a) / sizeof(*(a)))
+
+static void check(char const* pat, tpre_opts_t opts)
+{
+  tpre_re_t re;
+  assert(!tpre_compile(&re, pat, NULL, opts));
+  for (size_t i = 0; i < LEN(strs); i++)
+  {
+    tpre_match_t m = tpre_matchn(&re, strs[i], strlen(strs[i]));
+    assert(tpre_is_match(&re, strs[i], strlen(strs[i])) == m.found);
+    tpre_match_free(m);
+  }
+  tpre_free(re);
+}
+
+int main()
+{
+  tpre_opts_t unanchored = { 0 };
+  tpre_opt_setb(&unanchored, TPRE_OPT_ANCHORED, false);
+
+  for (size_t i = 0; i < LEN(pats); i++)
+  {
+    check(pats[i], (tpre_opts_t) { 0 });
+    check(pats[i], unanchored);
+  }
+
+  // no captures: same result, but nothing is recorded
+  tpre_opts_t opts = { .no_captures = true };
+  assert(tpre_opt_getb(&opts, TPRE_OPT_NO_CAPTURES));
+  for (size_t i = 0; i + 1 < LEN(pats); i++)
+    check(pats[i], opts);
+
+  tpre_re_t re;
+  assert(!tpre_compile(&re, "(?'x'a+)(b?)c", NULL, opts));
+  assert(re.max_group == 0);
+  assert(re.num_named_groups == 0);
+  assert(tpre_find_group(&re, "x") < 0);
+  tpre_match_t m = tpre_matchn(&re, "aabc", 4);
+  assert(m.found);
+  assert(m.ngroups == 1);
+  tpre_match_free(m);
+  tpre_free(re);
+
+  // backreferences turn off remembering visited nodes, so the compiler
+  // records whether there are any
+  assert(!tpre_compile(&re, "(\\w+) \\1", NULL, (tpre_opts_t) { 0 }));
+  assert(re.has_backrefs);
+  tpre_free(re);
+  assert(!tpre_compile(&re, "(\\w+) 1", NULL, (tpre_opts_t) { 0 }));
+  assert(!re.has_backrefs);
+  tpre_free(re);
+
+  // with limits. nothing is remembered for backrefs, so this takes
+  // exponential time without them
+  assert(!tpre_compile(&re, "(a+)+\\1b", NULL, (tpre_opts_t) { 0 }));
+  char str[41];
+  memset(str, 'a', sizeof(str));
+  strcpy(str + sizeof(str) - 3, "cb");
+  uint64_t steps = 0;
+  tpre_match_cfg_t cfg = { .max_steps = 10000, .steps_out = &steps };
+  assert(!tpre_is_match_cfg(&re, str, strlen(str), &cfg));
+  assert(steps >= 10000 && steps <= 10001);
+  assert(tpre_is_match_cfg(&re, "aab", 3, &cfg));
+  assert(tpre_is_match_cfg(&re, "aab", 3, NULL));
+  tpre_free(re);
+
+  // backreferences need the captures
+  tpre_errs_t errs;
+  assert(tpre_compile(&re, "(a)\\1", &errs, opts));
+  assert(errs.len == 1);
+  assert(errs.items[0].pat_byte_loc == 3);
+  tpre_errs_free(errs);
+}
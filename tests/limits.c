@@ -0,0 +1,99 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tpre.h"
+
+int main()
+{
+  tpre_re_t re;
+  assert(!tpre_compile(&re, "(?:a|aa)*(a)c", NULL, (tpre_opts_t) { 0 }));
+
+  size_t len = 1000000;
+  char* str = malloc(len);
+  memset(str, 'a', len);
+
+  uint64_t steps;
+  tpre_match_cfg_t cfg = { .max_steps = 100, .steps_out = &steps };
+  tpre_match_t m = tpre_matchn_cfg(&re, str, len, &cfg);
+  assert(!m.found);
+  assert(m.aborted);
+  assert(steps == 101);
+  tpre_match_free(m);
+
+  // already over the deadline. too long for the visited bitmap, so this would
+  // take forever otherwise
+  cfg = (tpre_match_cfg_t) { .deadline_ns = tpre_monotonic_ns() };
+  m = tpre_matchn_cfg(&re, str, len, &cfg);
+  assert(!m.found);
+  assert(m.aborted);
+  tpre_match_free(m);
+
+  // limits that are not hit
+  str[9] = 'c';
+  cfg = (tpre_match_cfg_t) { .max_steps = 1000000, .steps_out = &steps };
+  m = tpre_matchn_cfg(&re, str, 10, &cfg);
+  assert(m.found);
+  assert(!m.aborted);
+  assert(steps > 0 && steps < 1000000);
+  tpre_match_free(m);
+
+  tpre_free(re);
+
+  // searches read the input with dfas first, which count a step per byte
+  tpre_opts_t search = { .start_unanchored = 1 };
+  assert(!tpre_compile(&re, "b", NULL, search));
+  assert(re.dfa_search);
+  cfg = (tpre_match_cfg_t) { .max_steps = 1000, .steps_out = &steps };
+  m = tpre_matchn_cfg(&re, str, len, &cfg);
+  assert(!m.found);
+  assert(m.aborted);
+  assert(steps <= 1001);
+  tpre_match_free(m);
+
+  cfg = (tpre_match_cfg_t) { .deadline_ns = tpre_monotonic_ns() };
+  m = tpre_matchn_cfg(&re, str, len, &cfg);
+  assert(!m.found);
+  assert(m.aborted);
+  tpre_match_free(m);
+
+  str[len - 1] = 'b';
+  cfg = (tpre_match_cfg_t) { .max_steps = 2 * len, .steps_out = &steps };
+  m = tpre_matchn_cfg(&re, str, len, &cfg);
+  assert(m.found);
+  assert(!m.aborted);
+  assert(m.groups[0].begin == len - 1);
+  assert(steps >= len && steps < 2 * len);
+  tpre_match_free(m);
+
+  tpre_free(re);
+
+  // and so do the forward and reverse dfas of leftmost-longest matching
+  for (int unanchored = 0; unanchored < 2; unanchored++)
+  {
+    tpre_opts_t longest = { .start_unanchored = unanchored, .longest = 1 };
+    assert(!tpre_compile(&re, "[ac]*b", NULL, longest));
+    assert(re.dfa_forward && re.dfa_reverse);
+    cfg = (tpre_match_cfg_t) { .max_steps = 1000, .steps_out = &steps };
+    m = tpre_matchn_cfg(&re, str, len, &cfg);
+    assert(!m.found);
+    assert(m.aborted);
+    assert(steps <= 1001);
+    tpre_match_free(m);
+
+    cfg = (tpre_match_cfg_t) { .deadline_ns = tpre_monotonic_ns() };
+    m = tpre_matchn_cfg(&re, str, len, &cfg);
+    assert(!m.found);
+    assert(m.aborted);
+    tpre_match_free(m);
+
+    cfg = (tpre_match_cfg_t) { .max_steps = 4 * len, .steps_out = &steps };
+    m = tpre_matchn_cfg(&re, str, len, &cfg);
+    assert(m.found);
+    assert(!m.aborted);
+    assert(steps >= len);
+    tpre_match_free(m);
+    tpre_free(re);
+  }
+
+  free(str);
+}
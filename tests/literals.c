@@ -0,0 +1,135 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tpre.h"
+
+static tpre_opts_t mode_opts(int mode)
+{
+  tpre_opts_t opts = { 0 };
+  tpre_opt_setb(&opts, TPRE_OPT_START_ANCHORED, !(mode & 1));
+  tpre_opt_setb(&opts, TPRE_OPT_END_ANCHORED, !(mode & 2));
+  tpre_opt_setb(&opts, TPRE_OPT_LONGEST, mode & 4);
+  return opts;
+}
+
+/** length of the match, or -1 */
+static long match_len(tpre_re_t const* re, char const* str)
+{
+  tpre_match_t m = tpre_matchn(re, str, strlen(str));
+  long len = m.found ? (long) m.groups[0].len : -1;
+  tpre_match_free(m);
+  return len;
+}
+
+/** both find the same matches in str */
+static void check_same(
+    tpre_re_t const* a, tpre_re_t const* b, char const* str)
+{
+  tpre_match_t ma = tpre_matchn(a, str, strlen(str));
+  tpre_match_t mb = tpre_matchn(b, str, strlen(str));
+  assert(ma.found == mb.found);
+  if (ma.found)
+  {
+    assert(ma.groups[0].begin == mb.groups[0].begin);
+    assert(ma.groups[0].len == mb.groups[0].len);
+  }
+  tpre_match_free(ma);
+  tpre_match_free(mb);
+}
+
+static uint32_t rng = 1;
+
+static char* random_str(size_t min, size_t max, char letters)
+{
+  rng = rng * 1103515245u + 12345u;
+  size_t len = min + (rng >> 16) % (max - min + 1);
+  char* str = malloc(len + 1);
+  for (size_t i = 0; i < len; i++)
+  {
+    rng = rng * 1103515245u + 12345u;
+    str[i] = (char) ('a' + (rng >> 16) % (unsigned) letters);
+  }
+  str[len] = '\0';
+  return str;
+}
+
+int main()
+{
+  tpre_re_t re;
+  tpre_opts_t end_unanchored = mode_opts(2);
+
+  // the first word that matches wins, like in abcd|ab|abc
+  char const* const abc[] = { "abcd", "ab", "abc" };
+  assert(!tpre_compile_literals(&re, abc, 3, NULL, end_unanchored));
+  assert(match_len(&re, "abcz") == 2);
+  assert(match_len(&re, "abcd") == 4);
+  assert(match_len(&re, "a") == -1);
+  tpre_free(re);
+
+  // and the longest one in longest mode
+  tpre_opts_t longest = mode_opts(2 | 4);
+  assert(!tpre_compile_literals(&re, abc, 3, NULL, longest));
+  assert(match_len(&re, "abcz") == 3);
+  tpre_free(re);
+
+  // bytes are not syntax, the empty word and duplicates are fine
+  char const* const odd[] = { "a|b", "(x)", "", "a|b", "\xff" };
+  assert(!tpre_compile_literals(&re, odd, 5, NULL, (tpre_opts_t) { 0 }));
+  assert(match_len(&re, "a|b") == 3);
+  assert(match_len(&re, "(x)") == 3);
+  assert(match_len(&re, "") == 0);
+  assert(match_len(&re, "\xff") == 1);
+  assert(match_len(&re, "a") == -1);
+  assert(match_len(&re, "x") == -1);
+  tpre_free(re);
+
+  char const* const empty[] = { "" };
+  assert(!tpre_compile_literals(&re, empty, 1, NULL, (tpre_opts_t) { 0 }));
+  assert(match_len(&re, "") == 0);
+  assert(match_len(&re, "a") == -1);
+  tpre_free(re);
+
+  tpre_errs_t errs;
+  assert(tpre_compile_literals(&re, abc, 0, &errs, (tpre_opts_t) { 0 }));
+  assert(errs.len == 1);
+  tpre_errs_free(errs);
+
+  // the same matches as the alternation, in every mode. few letters, so that
+  // many words are prefixes of others
+  size_t num = 300;
+  char** words = malloc(sizeof(char*) * num);
+  char* pat = malloc(num * 8);
+  size_t len = 0;
+  for (size_t i = 0; i < num; i++)
+  {
+    words[i] = random_str(1, 6, 4);
+    if (i)
+      pat[len++] = '|';
+    strcpy(pat + len, words[i]);
+    len += strlen(words[i]);
+  }
+
+  for (int mode = 0; mode < 8; mode++)
+  {
+    tpre_re_t alt;
+    tpre_opts_t opts = mode_opts(mode);
+    assert(!tpre_compile(&alt, pat, NULL, opts));
+    assert(!tpre_compile_literals(
+        &re, (char const* const*) words, num, NULL, opts));
+    for (size_t i = 0; i < 300; i++)
+    {
+      char* str = random_str(0, 12, 5);
+      check_same(&alt, &re, str);
+      free(str);
+    }
+    for (size_t i = 0; i < num; i++)
+      check_same(&alt, &re, words[i]);
+    tpre_free(alt);
+    tpre_free(re);
+  }
+
+  for (size_t i = 0; i < num; i++)
+    free(words[i]);
+  free(words);
+  free(pat);
+}
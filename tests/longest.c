@@ -0,0 +1,97 @@
+#include <assert.h>
+#include <string.h>
+#include "tpre.h"
+
+static tpre_re_t compile(char const* pat, bool unanchored)
+{
+  tpre_opts_t opts = { .longest = true };
+  if (unanchored)
+    tpre_opt_setb(&opts, TPRE_OPT_ANCHORED, false);
+  assert(tpre_opt_getb(&opts, TPRE_OPT_LONGEST));
+
+  tpre_re_t re;
+  assert(!tpre_compile(&re, pat, NULL, opts));
+  assert(re.longest);
+  return re;
+}
+
+/** begin < 0 means no match */
+static void check(
+    char const* pat,
+    bool unanchored,
+    char const* str,
+    int begin,
+    size_t len)
+{
+  tpre_re_t re = compile(pat, unanchored);
+  tpre_match_t m = tpre_matchn(&re, str, strlen(str));
+  assert(m.found == (begin >= 0));
+  assert(tpre_is_match(&re, str, strlen(str)) == m.found);
+  if (m.found)
+  {
+    assert(m.groups[0].begin == begin);
+    assert(m.groups[0].len == len);
+  }
+  tpre_match_free(m);
+  tpre_free(re);
+}
+
+static void check_group(
+    char const* pat,
+    bool unanchored,
+    char const* str,
+    tpre_groupid_t group,
+    int begin,
+    size_t len)
+{
+  tpre_re_t re = compile(pat, unanchored);
+  tpre_match_t m = tpre_matchn(&re, str, strlen(str));
+  assert(m.found);
+  assert(group < m.ngroups);
+  assert(m.groups[group].begin == begin);
+  assert(m.groups[group].len == len);
+  tpre_match_free(m);
+  tpre_free(re);
+}
+
+int main()
+{
+  // the backtracker would take the first alternative
+  check("a|ab|abc", false, "abc", 0, 3);
+  check("a|ab|abc", false, "abd", -1, 0);
+  check("(a|ab)(c|bcd)", false, "abcd", 0, 4);
+  check("^a*", false, "aaa", 0, 3);
+  check("(a*)(a|b)", false, "aab", 0, 3);
+
+  // leftmost first, then longest
+  check("(a|ab)(c|bcd)", true, "xxabcdy", 2, 4);
+  check("a|ab|abc", true, "xabcabc", 1, 3);
+  check("ab|bcdef", true, "abcdef", 0, 2);
+  check("b|bcdef", true, "abcdef", 1, 5);
+  check("ab$|b", true, "abab", 1, 1);
+  check("^ab|b", true, "xab", 2, 1);
+  check("x*", true, "abc", 0, 0);
+  check("a+", true, "bbb", -1, 0);
+
+  // captures are taken from within the longest span
+  check_group("(a|ab)(c|bcd)", false, "abcd", 1, 0, 1);
+  check_group("(a|ab)(c|bcd)", false, "abcd", 2, 1, 3);
+  check_group("(\\w+)\\s(\\d+)", true, "-- ab 12 --", 0, 3, 5);
+  check_group("(\\w+)\\s(\\d+)", true, "-- ab 12 --", 1, 3, 2);
+  check_group("(\\w+)\\s(\\d+)", true, "-- ab 12 --", 2, 6, 2);
+
+  // only needs the dfas without captures
+  tpre_opts_t opts = { .longest = true, .no_captures = true };
+  tpre_re_t re;
+  assert(!tpre_compile(&re, "a|ab|abc", NULL, opts));
+  tpre_match_t m = tpre_matchn(&re, "abc", 3);
+  assert(m.found);
+  tpre_match_free(m);
+  tpre_free(re);
+
+  // backreferences can't be done by a dfa
+  tpre_errs_t errs;
+  assert(tpre_compile(&re, "(a)\\1", &errs, (tpre_opts_t) { .longest = true }));
+  assert(errs.len == 1);
+  tpre_errs_free(errs);
+}
@@ -0,0 +1,57 @@
+#define _DEFAULT_SOURCE
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include "tpre.h"
+
+#if defined(__unix__) && SIZE_MAX > UINT32_MAX
+# include <sys/mman.h>
+# define HAVE_BIG_INPUT
+#endif
+
+int main()
+{
+  // this test and the library are built with the same setting
+  assert(tpre_offsets_ok());
+
+  // group positions are as wide as the input can be long
+#ifdef TPRE_SMALL_OFFSETS
+  assert(tpre_small_offsets());
+  assert(sizeof(tpre_src_loc_t) == 4);
+#else
+  assert(!tpre_small_offsets());
+  assert(sizeof(tpre_src_loc_t) == 8);
+  assert(sizeof(tpre_src_len_t) == sizeof(size_t));
+#endif
+
+#ifdef HAVE_BIG_INPUT
+  // a match after the first 2 GiB. the pages that are only read stay the
+  // shared zero page, so this doesn't need that much memory
+  size_t where = ((size_t) 1 << 31) + 100;
+  size_t strl = where + 4096;
+  char* str = mmap(
+      NULL, strl, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (str == MAP_FAILED)
+    return 0;
+  memcpy(str + where, "abc", 3);
+
+  tpre_opts_t opts = { 0 };
+  tpre_opt_setb(&opts, TPRE_OPT_END_ANCHORED, false);
+  tpre_re_t re;
+  assert(!tpre_compile(&re, "[^a]*(abc)", NULL, opts));
+  tpre_match_t m = tpre_matchn(&re, str, strl);
+# ifdef TPRE_SMALL_OFFSETS
+  assert(!m.found && m.aborted);
+# else
+  assert(m.found);
+  assert(m.groups[0].begin == 0);
+  assert(m.groups[0].len == where + 3);
+  assert(m.groups[1].begin == (tpre_src_loc_t) where);
+  assert(m.groups[1].len == 3);
+# endif
+  tpre_match_free(m);
+  tpre_free(re);
+  munmap(str, strl);
+#endif
+}
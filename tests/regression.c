@@ -19,7 +19,10 @@ int main()
       "((?:(?:a(?:a?)))$)", "bba",
       (tpre_opts_t) {
         .start_unanchored = 1, .end_unanchored = 1 });
-  assert(!m.found);
+  assert(m.found);
+  assert(m.ngroups == 2);
+  assert(m.groups[1].begin == 2);
+  assert(m.groups[1].len == 1);
 
   // regression 3
   m = match("((?:a*))", "", (tpre_opts_t) { 0 });
@@ -55,4 +58,50 @@ int main()
   assert(m.ngroups == 2);
   assert(m.groups[1].begin == 2);
   assert(m.groups[1].len == 1);
+
+  // regression 7: empty groups crashed the compiler, and then were
+  // rejected. they match the empty string, like empty cases of ors
+  tpre_re_t re;
+  m = match("a()b", "ab", (tpre_opts_t) { 0 });
+  assert(m.found);
+  assert(m.ngroups == 2);
+  assert(m.groups[1].len == 0);
+  m = match("(?:)*", "", (tpre_opts_t) { 0 });
+  assert(m.found);
+  m = match("(?>)a(?'x')", "a", (tpre_opts_t) { 0 });
+  assert(m.found);
+  m = match("", "", (tpre_opts_t) { 0 });
+  assert(m.found);
+  m = match("a(|b|)c", "ac", (tpre_opts_t) { 0 });
+  assert(m.found);
+  m = match("a(|b|)c", "abc", (tpre_opts_t) { 0 });
+  assert(m.found);
+  assert(m.groups[1].begin == 1 && m.groups[1].len == 1);
+  m = match("(a|)", "", (tpre_opts_t) { 0 });
+  assert(m.found);
+  // the empty case comes first
+  m = match("(|a)", "a", (tpre_opts_t) { .end_unanchored = 1 });
+  assert(m.found);
+  assert(m.groups[0].len == 0);
+  tpre_fsm_t fsm;
+  assert(!tpre2fsm(&fsm, "a(?:)", NULL, (tpre_opts_t) { 0 }));
+  tpre_fsm_free(&fsm);
+  tpre_errs_t errs;
+  assert(tpre_compile(&re, "(*)", &errs, (tpre_opts_t) { 0 }));
+  assert(errs.len >= 1);
+  tpre_errs_free(errs);
+
+  // regression 8: a postfix operator without operand crashed the parser
+  assert(tpre_compile(&re, "*", NULL, (tpre_opts_t) { 0 }));
+  m = match("(a?" "?)(a*)", "aa", (tpre_opts_t) { 0 });
+  assert(m.found);
+  assert(m.groups[1].len == 0);
+  assert(m.groups[2].len == 2);
+
+  // regression 9: `]` first in a class, and unclosed groups
+  m = match("[]a]+", "a]", (tpre_opts_t) { 0 });
+  assert(m.found);
+  m = match("[^]]", "]", (tpre_opts_t) { 0 });
+  assert(!m.found);
+  assert(tpre_compile(&re, "(a", NULL, (tpre_opts_t) { 0 }));
 }
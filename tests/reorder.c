@@ -0,0 +1,94 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tpre.h"
+
+/** compiles pat with the cases ordered by how often they matched in strs */
+static tpre_re_t compile_profiled(
+    char const* pat, tpre_opts_t opts, char const* const* strs, size_t num)
+{
+  tpre_re_t re;
+  assert(!tpre_compile(&re, pat, NULL, opts));
+  tpre_node_profile_t* prof = calloc(re.num_nodes, sizeof(*prof));
+  tpre_match_cfg_t cfg = { .profile_out = prof };
+  for (size_t i = 0; i < num; i++)
+    tpre_match_free(tpre_matchn_cfg(&re, strs[i], strlen(strs[i]), &cfg));
+
+  size_t patl = strlen(pat);
+  uint64_t* weights = calloc(patl, sizeof(uint64_t));
+  tpre_profile_weights(&re, prof, weights, patl);
+  free(prof);
+  tpre_free(re);
+
+  assert(!tpre_compile_weighted(&re, pat, NULL, opts, weights));
+  free(weights);
+  return re;
+}
+
+static uint64_t steps_for(tpre_re_t const* re, char const* str)
+{
+  uint64_t steps;
+  tpre_match_cfg_t cfg = { .steps_out = &steps };
+  tpre_match_t m = tpre_matchn_cfg(re, str, strlen(str), &cfg);
+  assert(m.found);
+  tpre_match_free(m);
+  return steps;
+}
+
+/** both find the same matches in str */
+static void check_same(
+    tpre_re_t const* a, tpre_re_t const* b, char const* str)
+{
+  tpre_match_t ma = tpre_matchn(a, str, strlen(str));
+  tpre_match_t mb = tpre_matchn(b, str, strlen(str));
+  assert(ma.found == mb.found);
+  assert(ma.ngroups == mb.ngroups);
+  for (size_t g = 0; ma.found && g < ma.ngroups; g++)
+  {
+    assert(ma.groups[g].begin == mb.groups[g].begin);
+    assert(ma.groups[g].len == mb.groups[g].len);
+  }
+  tpre_match_free(ma);
+  tpre_match_free(mb);
+}
+
+int main()
+{
+  char const* pat = "(GET|HEAD|POST|OPTIONS|DELETE) (\\w+)";
+  char const* const seen[] = { "DELETE a", "DELETE b", "DELETE c", "GET d" };
+  tpre_re_t plain, profiled;
+  assert(!tpre_compile(&plain, pat, NULL, (tpre_opts_t) { 0 }));
+  profiled = compile_profiled(pat, (tpre_opts_t) { 0 }, seen, 4);
+
+  // the case that matched most is tried first
+  assert(steps_for(&profiled, "DELETE x") < steps_for(&plain, "DELETE x"));
+  char const* const strs[] = { "GET a",    "HEAD b", "POST c", "OPTIONS d",
+                               "DELETE e", "PUT f",  "",       "DELETE" };
+  for (size_t i = 0; i < sizeof(strs) / sizeof(*strs); i++)
+    check_same(&plain, &profiled, strs[i]);
+  tpre_free(plain);
+  tpre_free(profiled);
+
+  // cases that can begin with the same byte keep their order
+  char const* const ab[] = { "ab", "ab", "ab" };
+  tpre_opts_t unanchored = { 0 };
+  tpre_opt_setb(&unanchored, TPRE_OPT_END_ANCHORED, false);
+  profiled = compile_profiled("(a|ab|b)", unanchored, ab, 3);
+  tpre_match_t m = tpre_matchn(&profiled, "ab", 2);
+  assert(m.found && m.groups[1].len == 1);
+  tpre_match_free(m);
+  tpre_free(profiled);
+
+  // and so do cases that can match nothing
+  char const* const empty[] = { "b", "b" };
+  profiled = compile_profiled("(a|x?|b)", unanchored, empty, 2);
+  m = tpre_matchn(&profiled, "b", 1);
+  assert(m.found && m.groups[1].len == 0);
+  tpre_match_free(m);
+  tpre_free(profiled);
+
+  // no weights is the same as tpre_compile
+  assert(!tpre_compile_weighted(&plain, pat, NULL, (tpre_opts_t) { 0 }, NULL));
+  assert(steps_for(&plain, "GET x") > 0);
+  tpre_free(plain);
+}
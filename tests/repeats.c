@@ -53,4 +53,149 @@ int main()
   assert(m.groups[1].len == 5);
   assert(m.groups[2].begin == 5);
   assert(m.groups[2].len = 1);
+
+  // exponential without remembering visited nodes
+  m = match(
+      "(?:a|aa)*(a)c", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+      (tpre_opts_t) { 0 });
+  assert(!m.found);
+  m = match(
+      "(?:a|aa)*(a)c", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaac",
+      (tpre_opts_t) { 0 });
+  assert(m.found);
+  assert(m.ngroups == 2);
+  assert(m.groups[1].begin == 42);
+  assert(m.groups[1].len == 1);
+
+  // an iteration that matches the empty string ends the repeat, like in pcre
+  for (int no_dfa = 0; no_dfa < 2; no_dfa++)
+  {
+    tpre_opts_t opts = { .end_unanchored = 1, .no_dfa = no_dfa };
+    m = match("(?:.*?)+", "abc", opts);
+    assert(m.found);
+    assert(m.groups[0].len == 0);
+    m = match("(?:.*?)+", "aabbb", opts);
+    assert(m.found);
+    assert(m.groups[0].len == 0);
+    m = match("(?:a?|b)*", "aab", opts);
+    assert(m.found);
+    assert(m.groups[0].len == 2);
+    m = match("(?:a?|b)*c", "aabc", opts);
+    assert(m.found);
+    assert(m.groups[0].len == 4);
+    m = match("(?:a?)*?b", "aab", opts);
+    assert(m.found);
+    assert(m.groups[0].len == 3);
+
+    opts.start_unanchored = 1;
+    m = match("(?:.*?)+", "abc", opts);
+    assert(m.found);
+    assert(m.groups[0].begin == 0);
+    assert(m.groups[0].len == 0);
+  }
+  m = match("(?:a?)*", "aab", (tpre_opts_t) { 0 });
+  assert(!m.found);
+
+  // and in counted repeats, after the first min iterations. counters turn
+  // off remembering visited nodes, so these didn't end before
+  m = match("(a?)*x{20}", "b", (tpre_opts_t) { 0 });
+  assert(!m.found);
+  m = match("(?:a?){0,1000}c", "aaaaaaaaaaaaaaaaaaaa", (tpre_opts_t) { 0 });
+  assert(!m.found);
+  m = match("(?:a?){3,1000}", "aab", (tpre_opts_t) { .end_unanchored = 1 });
+  assert(m.found);
+  assert(m.groups[0].len == 2);
+  m = match("(?:a?){20}b", "aab", (tpre_opts_t) { 0 });
+  assert(m.found);
+  m = match("(?:a?){9,}?b", "aab", (tpre_opts_t) { 0 });
+  assert(m.found);
+
+  // x?? and small lazy counted repeats are unrolled, and need no slots
+  tpre_re_t re;
+  assert(!tpre_compile(&re, "a?\?(?:b{1,3}?)*", NULL, (tpre_opts_t) { 0 }));
+  assert(re.num_slots == 0);
+  tpre_free(re);
+  m = match("(a?\?)*", "", (tpre_opts_t) { 0 });
+  assert(m.found);
+  m = match("(a{0,2}?)*", "", (tpre_opts_t) { 0 });
+  assert(m.found);
+  m = match("(?:a?\?)*b", "aab", (tpre_opts_t) { 0 });
+  assert(m.found);
+  m = match("(a{1,3}?)(a*)", "aaaa", (tpre_opts_t) { 0 });
+  assert(m.found);
+  assert(m.groups[1].len == 1);
+  assert(m.groups[2].len == 3);
+
+  // counted
+  m = match("(\\d{4})-(\\d{2,})", "2024-123", (tpre_opts_t) { 0 });
+  assert(m.found);
+  assert(m.groups[1].begin == 0);
+  assert(m.groups[1].len == 4);
+  assert(m.groups[2].begin == 5);
+  assert(m.groups[2].len == 3);
+  m = match("\\d{4}", "123", (tpre_opts_t) { 0 });
+  assert(!m.found);
+  m = match("(a{2,3})(a*)", "aaaaa", (tpre_opts_t) { 0 });
+  assert(m.found);
+  assert(m.groups[1].len == 3);
+  assert(m.groups[2].len == 2);
+  m = match("(a{2,3}?)(a*)", "aaaaa", (tpre_opts_t) { 0 });
+  assert(m.found);
+  assert(m.groups[1].len == 2);
+  assert(m.groups[2].len == 3);
+  m = match("a{0}b", "b", (tpre_opts_t) { 0 });
+  assert(m.found);
+  m = match("a{,2}", "a{,2}", (tpre_opts_t) { 0 });
+  assert(m.found);
+
+  // large bounds are not unrolled
+  assert(!tpre_compile(&re, "([a-z]{1,4096})(x{100,}?)y", NULL, (tpre_opts_t) { 0 }));
+  assert(re.num_nodes < 64);
+  char buf[300];
+  memset(buf, 'x', sizeof(buf));
+  buf[sizeof(buf) - 1] = 'y';
+  m = tpre_matchn(&re, buf, sizeof(buf));
+  assert(m.found);
+  assert(m.groups[1].begin == 0);
+  assert(m.groups[1].len == 199);
+  assert(m.groups[2].len == 100);
+  tpre_free(re);
+  m = match("(?:ab){100}", "ab", (tpre_opts_t) { 0 });
+  assert(!m.found);
+
+  // possessive and atomic
+  m = match("a*+a", "aaa", (tpre_opts_t) { 0 });
+  assert(!m.found);
+  m = match("(a++)b", "aaab", (tpre_opts_t) { 0 });
+  assert(m.found);
+  assert(m.groups[1].len == 3);
+  m = match("a?+a", "a", (tpre_opts_t) { 0 });
+  assert(!m.found);
+  m = match("a{1,3}+a", "aaaa", (tpre_opts_t) { 0 });
+  assert(m.found);
+  m = match("a{1,3}+a", "aaa", (tpre_opts_t) { 0 });
+  assert(!m.found);
+  m = match("(?>a|ab)c", "abc", (tpre_opts_t) { 0 });
+  assert(!m.found);
+  m = match("(?>ab|a)c", "abc", (tpre_opts_t) { 0 });
+  assert(m.found);
+  m = match("(?:(?>a|ab)|b)*c", "abc", (tpre_opts_t) { 0 });
+  assert(m.found);
+  m = match(
+      "(?:\\w++,)*x", "aa,bb,cc,dd,ee,ff,gg,hh,ii,jj,kk,ll,mm,nn,oo,pp",
+      (tpre_opts_t) { 0 });
+  assert(!m.found);
+
+  // atomic groups turn off remembering visited nodes too, so empty
+  // iterations before them must still end the loop
+  m = match("(a?)*(?>x)", "b", (tpre_opts_t) { 0 });
+  assert(!m.found);
+  m = match("(a?)*?(?>x)", "b", (tpre_opts_t) { 0 });
+  assert(!m.found);
+  m = match(
+      "(?:a?b?)*?(?>x)", "abababx",
+      (tpre_opts_t) { .start_unanchored = 1, .end_unanchored = 1 });
+  assert(m.found);
+  assert(m.groups[0].begin == 0);
+  assert(m.groups[0].len == 7);
 }
@@ -0,0 +1,122 @@
+#include <assert.h>
+#include <string.h>
+#include "tpre.h"
+
+// repeats of a single class are matched by scanning many bytes at once, so
+// the runs have to be longer than a vector, and end at every offset in one
+
+static char buf[256];
+
+/** the match of group 1 in buf[0..len), or -1 if no match */
+static int group1_len(tpre_re_t const* re, size_t len)
+{
+  tpre_match_t m = tpre_matchn(re, buf, len);
+  int out = m.found ? (int) m.groups[1].len : -1;
+  tpre_match_free(m);
+  return out;
+}
+
+/** fills buf with n bytes out of in, then the byte end */
+static size_t fill(char const* in, size_t n, char end)
+{
+  size_t inl = strlen(in);
+  for (size_t i = 0; i < n; i++)
+    buf[i] = in[i % inl];
+  buf[n] = end;
+  return n + 1;
+}
+
+static void check_greedy(char const* pat, char const* in, char end)
+{
+  tpre_re_t re;
+  assert(!tpre_compile(&re, pat, NULL, (tpre_opts_t) { 0 }));
+  for (size_t n = 0; n < 100; n++)
+    assert(group1_len(&re, fill(in, n, end)) == (int) n);
+  tpre_free(re);
+}
+
+int main()
+{
+  // classes made of one to four byte ranges, and one with more
+  check_greedy("([^\"]*)\"", "ab c\t", '"');
+  check_greedy("(\\d*)-", "0123456789", '-');
+  check_greedy("(\\s*)x", " \t\n\r", 'x');
+  check_greedy("(\\w*)!", "az_09AZ", '!');
+  check_greedy("([acegikmoq]*)b", "qaecgmiko", 'b');
+  check_greedy("(.*)x$", "anything", 'x');
+
+  // backtracking into a run
+  tpre_re_t re;
+  assert(!tpre_compile(&re, "(a*)ab", NULL, (tpre_opts_t) { 0 }));
+  for (size_t n = 0; n < 100; n++)
+  {
+    memset(buf, 'a', n);
+    buf[n] = 'b';
+    assert(group1_len(&re, n + 1) == (n ? (int) n - 1 : -1));
+  }
+  tpre_free(re);
+
+  // lazy: as short as possible, also when the literal after it is in the
+  // class
+  assert(!tpre_compile(&re, "([a-z]*?)q(.*)", NULL, (tpre_opts_t) { 0 }));
+  for (size_t n = 0; n < 100; n++)
+  {
+    memset(buf, 'x', n);
+    memcpy(buf + n, "qaqa", 4);
+    assert(group1_len(&re, n + 4) == (int) n);
+  }
+  tpre_free(re);
+
+  assert(!tpre_compile(&re, "(\\d*?)(\\d)$", NULL, (tpre_opts_t) { 0 }));
+  for (size_t n = 1; n < 100; n++)
+  {
+    memset(buf, '7', n);
+    assert(group1_len(&re, n) == (int) n - 1);
+    buf[n / 2] = 'x';
+    assert(group1_len(&re, n) == -1);
+  }
+  tpre_free(re);
+
+  // lengths after which the next node was already visited are not tried
+  // again, and neither are runs that begin where the same run was before,
+  // so runs that can't match don't take quadratic steps
+  static char long_buf[4000];
+  memset(long_buf, 'a', sizeof(long_buf));
+  char const* const slow_pats[] = {
+    "\\w*\\w*\\w*!", "\\w*?\\w*?!", "\\w*\\w*?!", "\\w*?\\w*!",
+    "(?:[a-z]*[a-z]*)*!", "(?:\\w*?,)*!", "(?:a|ab)*\\w*!",
+  };
+  for (size_t k = 0; k < sizeof(slow_pats) / sizeof(*slow_pats); k++)
+  {
+    for (int unanchored = 0; unanchored < 2; unanchored++)
+    {
+      tpre_opts_t opts = { .start_unanchored = unanchored, .no_dfa = 1 };
+      assert(!tpre_compile(&re, slow_pats[k], NULL, opts));
+      uint64_t steps;
+      tpre_match_cfg_t cfg = { .steps_out = &steps };
+      tpre_match_t m = tpre_matchn_cfg(&re, long_buf, sizeof(long_buf), &cfg);
+      assert(!m.found);
+      assert(steps < 20 * sizeof(long_buf));
+      tpre_match_free(m);
+      tpre_free(re);
+    }
+  }
+  long_buf[sizeof(long_buf) - 1] = '!';
+  assert(!tpre_compile(&re, "(\\w*)(\\w*?)(\\w*)!", NULL, (tpre_opts_t) { 0 }));
+  tpre_match_t m = tpre_matchn(&re, long_buf, sizeof(long_buf));
+  assert(m.found);
+  assert(m.groups[1].len == sizeof(long_buf) - 1);
+  assert(m.groups[2].len == 0);
+  assert(m.groups[3].len == 0);
+  tpre_match_free(m);
+  tpre_free(re);
+
+  // a run that stops at the end of the input
+  assert(!tpre_compile(&re, "(b*)", NULL, (tpre_opts_t) { 0 }));
+  for (size_t n = 0; n < 100; n++)
+  {
+    memset(buf, 'b', n);
+    assert(group1_len(&re, n) == (int) n);
+  }
+  tpre_free(re);
+}
@@ -0,0 +1,86 @@
+#include <assert.h>
+#include <string.h>
+#include "tpre.h"
+
+// the dfas must not change which match is found, only how fast
+static char const* const pats[] = {
+  "abc",          "a|ab|abc",       "(a|ab)(c|bcd)", "a.*z|b",
+  "(\\w+)@(\\w+)", "x*",            "^ab|b",          "ab$|b",
+  "(a+?)(a*)",    "[0-9]{2,4}-(x)", "(?'n'b+)c",     "a(?:b|c)*d",
+};
+
+static char const* const strs[] = {
+  "",        "abc",        "xxabcdy",   "a b z",   "b a z",
+  "me@host", "to: a@b, c", "aaaa",      "xab",     "abab",
+  "1-x 123-x", "bbbc bc",  "abcbd abx", "zzzzzzzzzzzzzzzzzzzzb",
+};
+
+#define LEN(a) (sizeof(a) / sizeof(*(a)))
+
+static void check(char const* pat, tpre_opts_t opts)
+{
+  tpre_re_t with, without;
+  assert(!tpre_compile(&with, pat, NULL, opts));
+  opts.no_dfa = true;
+  assert(!tpre_compile(&without, pat, NULL, opts));
+  assert(!without.dfa_search);
+
+  for (size_t i = 0; i < LEN(strs); i++)
+  {
+    size_t strl = strlen(strs[i]);
+    tpre_match_t a = tpre_matchn(&with, strs[i], strl);
+    tpre_match_t b = tpre_matchn(&without, strs[i], strl);
+    assert(a.found == b.found);
+    assert(tpre_is_match(&with, strs[i], strl) == a.found);
+    if (a.found)
+    {
+      assert(a.ngroups == b.ngroups);
+      for (size_t g = 0; g < a.ngroups; g++)
+      {
+        assert(a.groups[g].begin == b.groups[g].begin);
+        assert(a.groups[g].len == b.groups[g].len);
+      }
+    }
+    tpre_match_free(a);
+    tpre_match_free(b);
+  }
+
+  tpre_free(with);
+  tpre_free(without);
+}
+
+int main()
+{
+  tpre_opts_t unanchored = { 0 };
+  tpre_opt_setb(&unanchored, TPRE_OPT_ANCHORED, false);
+  tpre_opts_t end_anchored = { 0 };
+  tpre_opt_setb(&end_anchored, TPRE_OPT_START_ANCHORED, false);
+
+  for (size_t i = 0; i < LEN(pats); i++)
+  {
+    check(pats[i], unanchored);
+    check(pats[i], end_anchored);
+  }
+
+  // only start unanchored regexes need them
+  tpre_re_t re;
+  assert(!tpre_compile(&re, "abc", NULL, unanchored));
+  assert(re.dfa_search && re.dfa_reverse);
+  assert(re.dfa_reverse->max_len == 3);
+  // the search skips to the next a
+  assert(re.dfa_search->skip_state);
+  assert(re.dfa_search->skip_byte == 'a');
+  tpre_free(re);
+  assert(!tpre_compile(&re, "(a|b)c", NULL, unanchored));
+  assert(!re.dfa_search->skip_state);
+  tpre_free(re);
+  assert(!tpre_compile(&re, "abc", NULL, (tpre_opts_t) { 0 }));
+  assert(!re.dfa_search);
+  tpre_free(re);
+
+  // without the fsm, there are no dfas, but matching still works
+  assert(!tpre_compile(&re, "(a)\\1", NULL, unanchored));
+  assert(!re.dfa_search);
+  assert(tpre_is_match(&re, "xaa", 3));
+  tpre_free(re);
+}
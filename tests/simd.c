@@ -0,0 +1,87 @@
+#define _POSIX_C_SOURCE 200112L
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tpre.h"
+
+// every kernel the cpu has must find the same matches as the scalar one
+
+static char const* const pats[] = {
+  "([^\"]*)\"",    "(\\d*)-",        "(\\s*)x",       "(\\w*)!",
+  "([acegikmoq]*)b", "(.*)x",        "([a-z]*?)q(.*)", "(\\D+)",
+  "([\\t-a]*)b",  "(a*)a",         "([0-9a-f]*)g",  "([^a]*)(a)",
+  "([a-z0-9 ,.!]*)\"",
+  // the search dfa looks for the first byte
+  "x(a*)", "!([^!]*)!",
+};
+
+// the bytes at the edges of the classes, and '\0'
+static char const alphabet[] = "\0\x01 \t\n\"-!_09afgqxzAZ\x7f\x80\xff";
+
+#define LEN(a) (sizeof(a) / sizeof(*(a)))
+
+static uint32_t rng = 1;
+
+static uint32_t next_rand(void)
+{
+  rng = rng * 1103515245u + 12345u;
+  return rng >> 16;
+}
+
+/** match of every pattern in str, group 1 lengths or -1, in out */
+static void run_all(char const* str, size_t strl, int* out)
+{
+  for (size_t i = 0; i < LEN(pats); i++)
+  {
+    tpre_opts_t opts = { 0 };
+    tpre_opt_setb(&opts, TPRE_OPT_ANCHORED, false);
+    tpre_re_t re;
+    if (tpre_compile(&re, pats[i], NULL, opts))
+    {
+      out[i] = -2;
+      continue;
+    }
+    tpre_match_t m = tpre_matchn(&re, str, strl);
+    out[i] = m.found ? (int) m.groups[1].len : -1;
+    tpre_match_free(m);
+    tpre_free(re);
+  }
+}
+
+int main()
+{
+  // picked by the environment at first use, if the cpu has it
+  setenv("TPRE_SIMD", "none", 1);
+  assert(tpre_simd() == TPRE_SIMD_NONE);
+  assert(!strcmp(tpre_simd_name(TPRE_SIMD_SSE42), "sse4.2"));
+  assert(!tpre_simd_set(TPRE_SIMD_NONE));
+
+  static char str[300];
+  int want[LEN(pats)], got[LEN(pats)];
+  for (int round = 0; round < 300; round++)
+  {
+    size_t strl = next_rand() % sizeof(str);
+    // long runs of the same few bytes, so that the runs span vectors
+    char c = alphabet[next_rand() % (sizeof(alphabet) - 1)];
+    for (size_t i = 0; i < strl; i++)
+    {
+      if (next_rand() % 16 == 0)
+        c = alphabet[next_rand() % (sizeof(alphabet) - 1)];
+      str[i] = c;
+    }
+
+    assert(!tpre_simd_set(TPRE_SIMD_NONE));
+    run_all(str, strl, want);
+    for (int simd = TPRE_SIMD_SSE2; simd <= TPRE_SIMD_AVX512; simd++)
+    {
+      // not all cpus have all of them
+      if (tpre_simd_set((tpre_simd_t) simd))
+        continue;
+      assert(tpre_simd() == (tpre_simd_t) simd);
+      run_all(str, strl, got);
+      assert(!memcmp(want, got, sizeof(want)));
+    }
+  }
+
+  assert(tpre_simd_set((tpre_simd_t) 100));
+}
@@ -0,0 +1,126 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tpre.h"
+
+int main()
+{
+  tpre_re_t re;
+  tpre_match_stats_t st;
+  tpre_match_cfg_t cfg = { .stats_out = &st };
+  tpre_match_t m;
+
+  // unanchored, without the search dfas: tries every start position until
+  // "abc"
+  tpre_opts_t opts = { 0 };
+  tpre_opt_setb(&opts, TPRE_OPT_ANCHORED, false);
+  tpre_opt_setb(&opts, TPRE_OPT_NO_DFA, true);
+  assert(!tpre_compile(&re, "abc", NULL, opts));
+
+  char const* str = "xxxxabc";
+  m = tpre_matchn_cfg(&re, str, strlen(str), &cfg);
+  assert(m.found);
+  assert(st.restarts == 4);
+  assert(st.bt_pops == 4);
+  assert(st.bt_pushes == 5);
+  assert(st.bt_peak_depth == 1);
+  assert(st.nodes_visited > 0);
+  assert(st.capture_copy_bytes ==
+         st.bt_pushes * sizeof(tpre_group_t) * m.ngroups);
+  tpre_match_free(m);
+
+  uint64_t steps;
+  cfg.steps_out = &steps;
+  m = tpre_matchn_cfg(&re, "abd", 3, &cfg);
+  assert(!m.found);
+  assert(st.nodes_visited == steps);
+  assert(st.bt_pops == st.bt_pushes);
+  tpre_match_free(m);
+  tpre_free(re);
+
+  // with them, backtracking starts right at "abc"
+  opts.no_dfa = false;
+  assert(!tpre_compile(&re, "abc", NULL, opts));
+  cfg = (tpre_match_cfg_t) { .stats_out = &st };
+  m = tpre_matchn_cfg(&re, str, strlen(str), &cfg);
+  assert(m.found);
+  assert(m.groups[0].begin == 4);
+  assert(st.restarts == 0);
+  assert(st.bt_pops == 0);
+  assert(st.dfa_bytes >= strlen(str));
+  tpre_match_free(m);
+  m = tpre_matchn_cfg(&re, "abd", 3, &cfg);
+  assert(!m.found);
+  assert(st.nodes_visited == 0);
+  assert(st.dfa_bytes == 3);
+  tpre_match_free(m);
+  tpre_free(re);
+
+  // anchored: never restarts
+  assert(!tpre_compile(&re, "(aa|a)*ab", NULL, (tpre_opts_t) { 0 }));
+  cfg = (tpre_match_cfg_t) { .stats_out = &st };
+  m = tpre_matchn_cfg(&re, "aaab", 4, &cfg);
+  assert(m.found);
+  assert(st.restarts == 0);
+  assert(st.bt_pops > 0);
+  assert(st.bt_peak_depth > 1);
+  tpre_match_free(m);
+  tpre_free(re);
+
+  // a repeated class pushes one backtrack for all of its lengths
+  assert(!tpre_compile(&re, "(a*)a[ab]", NULL, (tpre_opts_t) { 0 }));
+  m = tpre_matchn_cfg(&re, "aaaaab", 6, &cfg);
+  assert(m.found);
+  assert(m.groups[1].len == 4);
+  assert(st.bt_pushes == 1);
+  assert(st.bt_peak_depth == 1);
+  tpre_match_free(m);
+  m = tpre_matchn_cfg(&re, "aaaaaa", 6, &cfg);
+  assert(m.found);
+  assert(m.groups[1].len == 4);
+  assert(st.bt_pushes == 1);
+  assert(st.bt_pops == 1);
+  tpre_match_free(m);
+  tpre_free(re);
+
+  // per node profile, summed over two matches
+  char const* pat = "a(?:b|c)*d";
+  assert(!tpre_compile(&re, pat, NULL, (tpre_opts_t) { 0 }));
+  tpre_node_profile_t* prof = calloc(re.num_nodes, sizeof(*prof));
+  uint64_t total = 0;
+  cfg = (tpre_match_cfg_t) { .steps_out = &steps, .profile_out = prof };
+  m = tpre_matchn_cfg(&re, "abcbd", 5, &cfg);
+  assert(m.found);
+  tpre_match_free(m);
+  total += steps;
+  m = tpre_matchn_cfg(&re, "abx", 3, &cfg);
+  assert(!m.found);
+  tpre_match_free(m);
+  total += steps;
+
+  uint64_t visits = 0;
+  bool found_d = false;
+  for (tpre_nodeid_t i = 0; i < re.num_nodes; i++)
+  {
+    assert(prof[i].visits == prof[i].ok + prof[i].err);
+    visits += prof[i].visits;
+    assert(re.wherePlus1);
+    if (re.wherePlus1[i] == 10)
+    {
+      // the 'd'
+      assert(prof[i].ok == 1);
+      found_d = true;
+    }
+  }
+  assert(visits == total);
+  assert(found_d);
+
+  FILE* f = tmpfile();
+  assert(f);
+  tpre_profile_dump(&re, prof, pat, f);
+  assert(ftell(f) > 0);
+  fclose(f);
+
+  free(prof);
+  tpre_free(re);
+}
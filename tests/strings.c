@@ -0,0 +1,68 @@
+#include <assert.h>
+#include <string.h>
+#include "tpre.h"
+
+/** begin < 0 means no match */
+static void check(
+    char const* pat,
+    tpre_opts_t opts,
+    char const* str,
+    int begin,
+    size_t len)
+{
+  tpre_re_t re;
+  assert(!tpre_compile(&re, pat, NULL, opts));
+  tpre_match_t m = tpre_matchn(&re, str, strlen(str));
+  assert(m.found == (begin >= 0));
+  if (m.found)
+  {
+    assert(m.groups[0].begin == begin);
+    assert(m.groups[0].len == len);
+  }
+  tpre_match_free(m);
+  tpre_free(re);
+}
+
+static void check_all(tpre_opts_t opts)
+{
+  check("green", opts, "green", 0, 5);
+  check("green", opts, "gree", -1, 0);
+  check("green", opts, "greem", -1, 0);
+  check("green", opts, "Green", -1, 0);
+  check("a very long literal string", opts, "a very long literal string",
+        0, 26);
+  check("a very long literal string", opts, "a very long literal strinG",
+        -1, 0);
+
+  // after a failed case, the next one starts at the same byte again
+  check("(?:grey|green|gr)n", opts, "grn", 0, 3);
+  check("(?:abc|abd)*x", opts, "abdabcx", 0, 7);
+  check("[a-z]*green", opts, "ggreengreen", 0, 11);
+  check("\\d+?123x", opts, "1123123x", 0, 8);
+}
+
+int main()
+{
+  check_all((tpre_opts_t) { 0 });
+  tpre_opts_t unanchored = { 0 };
+  tpre_opt_setb(&unanchored, TPRE_OPT_ANCHORED, false);
+  unanchored.no_dfa = true;
+  check_all(unanchored);
+  check("green", unanchored, "gregreen green", 3, 5);
+
+  // the literal is a single node, between the anchors
+  tpre_re_t re;
+  assert(!tpre_compile(&re, "green", NULL, (tpre_opts_t) { 0 }));
+  assert(re.num_nodes == 3);
+  assert(re.num_strings == 1);
+  tpre_free(re);
+
+  // strings don't span groups
+  assert(!tpre_compile(&re, "(ab)(cd)e", NULL, (tpre_opts_t) { 0 }));
+  tpre_match_t m = tpre_matchn(&re, "abcde", 5);
+  assert(m.found);
+  assert(m.groups[1].begin == 0 && m.groups[1].len == 2);
+  assert(m.groups[2].begin == 2 && m.groups[2].len == 2);
+  tpre_match_free(m);
+  tpre_free(re);
+}